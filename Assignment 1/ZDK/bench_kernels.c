@@ -0,0 +1,154 @@
+/*
+**  bench_kernels.c
+**
+**  Micro-benchmark for the fill and diff kernels in cab202_kernels.c.
+**
+**  Every available implementation level is first checked against the
+**  scalar implementation on randomised rows; the program exits with a
+**  non-zero status if any result differs. Each level is then timed at
+**  several screen sizes. With --check, only the comparison is run.
+**
+**  Usage: ./bench_kernels [--check]
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cab202_kernels.h"
+
+#define MAX_CELLS (400 * 200)
+
+static const int sizes[][2] = { { 80, 24 }, { 200, 60 }, { 400, 200 } };
+#define NUM_SIZES ((int)(sizeof(sizes) / sizeof(sizes[0])))
+
+static uint32_t front[MAX_CELLS + 64];
+static uint32_t back[MAX_CELLS + 64];
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1.0e+9;
+}
+
+/*
+ *	Compares the selected level with the scalar level over rows of every
+ *	length up to 300 bytes, with zero, one or two differences at random
+ *	offsets and random alignment.
+ */
+static int check_level(ZdkKernelLevel level) {
+	uint8_t * a = (uint8_t *)front;
+	uint8_t * b = (uint8_t *)back;
+	int failures = 0;
+
+	srand(202);
+
+	for (int n = 0; n <= 300; n++) {
+		for (int trial = 0; trial < 20; trial++) {
+			int offset = rand() % 4;
+
+			for (int i = 0; i < n + 8; i++) {
+				a[offset + i] = b[offset + i] = rand() % 3;
+			}
+
+			for (int k = trial % 3; k > 0 && n > 0; k--) {
+				a[offset + rand() % n] ^= 1 + rand() % 255;
+			}
+
+			int f[3][2], l[3][2];
+			bool r[3][2];
+
+			for (int pass = 0; pass < 2; pass++) {
+				zdk_select_kernels(pass ? level : ZDK_KERNELS_SCALAR);
+				f[0][pass] = l[0][pass] = f[1][pass] = l[1][pass] = f[2][pass] = l[2][pass] = -1;
+				r[0][pass] = zdk_diff8(a + offset, b + offset, n, &f[0][pass], &l[0][pass]);
+				r[1][pass] = zdk_diff16((uint16_t *)(a + 2 * offset), (uint16_t *)(b + 2 * offset), n / 2, &f[1][pass], &l[1][pass]);
+				r[2][pass] = zdk_diff32(front + offset, back + offset, n / 4, &f[2][pass], &l[2][pass]);
+			}
+
+			for (int k = 0; k < 3; k++) {
+				if (r[k][0] != r[k][1] || f[k][0] != f[k][1] || l[k][0] != l[k][1]) {
+					fprintf(stderr, "diff%d mismatch (%s): n=%d\n", 8 << k, zdk_kernel_level_name(level), n);
+					failures++;
+				}
+			}
+
+			zdk_select_kernels(level);
+			memset(a, 0, n * 4 + 64);
+			zdk_fill16((uint16_t *)(a + 2 * offset), 0x5a2b, n);
+			zdk_fill32(back + offset, 0x01020304, n);
+
+			for (int i = 0; i < n; i++) {
+				if (((uint16_t *)(a + 2 * offset))[i] != 0x5a2b || back[offset + i] != 0x01020304) {
+					fprintf(stderr, "fill mismatch (%s): n=%d\n", zdk_kernel_level_name(level), n);
+					failures++;
+					break;
+				}
+			}
+		}
+	}
+
+	return failures;
+}
+
+/*
+ *	Times one full-screen fill plus one diff per row, the work done by a
+ *	clear_screen and show_screen pair on a packed screen, and reports the
+ *	average time per frame.
+ */
+static void bench_level(ZdkKernelLevel level, int width, int height) {
+	const int frames = 2000000 / (width * height / 16 + 1) + 10;
+	uint16_t * a = (uint16_t *)front;
+	uint16_t * b = (uint16_t *)back;
+	int first, last;
+	long found = 0;
+
+	zdk_select_kernels(level);
+	zdk_fill16(b, 0x0720, width * height);
+
+	double start = now();
+
+	for (int frame = 0; frame < frames; frame++) {
+		zdk_fill16(a, 0x0720, width * height);
+		a[(frame * 7919) % (width * height)] = 0x0741;
+
+		for (int y = 0; y < height; y++) {
+			found += zdk_diff16(a + y * width, b + y * width, width, &first, &last);
+		}
+	}
+
+	double elapsed = now() - start;
+
+	printf("{\"kernel\":\"%s\",\"width\":%d,\"height\":%d,\"frames\":%d,\"ns_per_frame\":%.1f,\"rows_changed\":%ld}\n",
+		zdk_kernel_level_name(level), width, height, frames, elapsed * 1.0e+9 / frames, found);
+}
+
+int main(int argc, char * argv[]) {
+	bool check_only = argc > 1 && strcmp(argv[1], "--check") == 0;
+	ZdkKernelLevel best = zdk_select_kernels(ZDK_KERNELS_AVX2);
+	int failures = 0;
+
+	for (ZdkKernelLevel level = ZDK_KERNELS_SSE2; level <= best; level++) {
+		failures += check_level(level);
+	}
+
+	if (failures) {
+		fprintf(stderr, "%d kernel mismatches\n", failures);
+		return 1;
+	}
+
+	if (check_only) {
+		printf("fill and diff kernels agree up to %s\n", zdk_kernel_level_name(best));
+		return 0;
+	}
+
+	for (int i = 0; i < NUM_SIZES; i++) {
+		for (ZdkKernelLevel level = ZDK_KERNELS_SCALAR; level <= best; level++) {
+			bench_level(level, sizes[i][0], sizes[i][1]);
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,271 @@
+/*
+**  bench_particles.c
+**
+**  Update benchmark for the particles in cab202_particles.c.
+**
+**  Scatters projectiles over a 200 x 60 screen with walls, each aimed at a
+**  random point, then times:
+**
+**      sprites   - one struct of doubles per projectile, steered and moved
+**                  one at a time with sqrt(), as the game used to move its
+**                  fireworks.
+**      advance   - particles_advance() at each available kernel level.
+**      collide   - particles_cells(), a check of every cell against the
+**                  walls, and particles_compact(), as one batch.
+**
+**  Every kernel level is first checked against the scalar level; the
+**  program exits with a non-zero status if any position differs. Each
+**  update is timed several times and the fastest is reported, as
+**  microseconds per 10,000 projectiles. With --check, only the comparison
+**  is run.
+**
+**  Usage: ./bench_particles [--check] [projectiles] [steps]
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cab202_kernels.h"
+#include "cab202_particles.h"
+
+#define REPEATS (5)
+#define WIDTH (200)
+#define HEIGHT (60)
+#define SPEED (0.5f)
+
+/*
+ *	A projectile as the game used to store it, among the other members of
+ *	a sprite.
+ */
+typedef struct {
+	double x, y;
+	double dx, dy;
+	double aim_x, aim_y;
+	char image;
+	bool draw;
+	int cell;
+	void * next_in_cell, * prev_in_cell;
+} sprite_t;
+
+static int number_of_projectiles = 10000;
+static int steps = 100;
+
+static sprite_t * sprites;
+static ZdkParticles start;
+static ZdkParticles particles;
+static bool open_cells[WIDTH * HEIGHT];
+static int * cells;
+static bool * keep;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1.0e+9;
+}
+
+static float random_float(float limit) {
+	return rand() % 10000 * limit / 10000;
+}
+
+/*
+ *	Fills the screen with a border and a few random walls, and places the
+ *	projectiles at random, each with its own aim point.
+ */
+static void setup(void) {
+	for (int y = 0; y < HEIGHT; y++) {
+		for (int x = 0; x < WIDTH; x++) {
+			open_cells[y * WIDTH + x] = x > 0 && x < WIDTH - 1 && y > 3 && y < HEIGHT - 1;
+		}
+	}
+
+	for (int w = 0; w < 20; w++) {
+		int x = 1 + rand() % (WIDTH - 2);
+		int y = 4 + rand() % (HEIGHT - 5);
+
+		for (int i = 0; i < 10 && x + i < WIDTH; i++) open_cells[y * WIDTH + x + i] = false;
+	}
+
+	particles_init(&start, number_of_projectiles);
+	particles_init(&particles, number_of_projectiles);
+	sprites = calloc(number_of_projectiles, sizeof(sprite_t));
+	cells = malloc(number_of_projectiles * sizeof(int));
+	keep = malloc(number_of_projectiles * sizeof(bool));
+
+	for (int i = 0; i < number_of_projectiles; i++) {
+		particles_add(&start, random_float(WIDTH), random_float(HEIGHT));
+		start.aim_x[i] = random_float(WIDTH);
+		start.aim_y[i] = random_float(HEIGHT);
+	}
+}
+
+static void copy_particles(ZdkParticles * to, const ZdkParticles * from) {
+	size_t n = from->count * sizeof(float);
+
+	memcpy(to->x, from->x, n);
+	memcpy(to->y, from->y, n);
+	memcpy(to->dx, from->dx, n);
+	memcpy(to->dy, from->dy, n);
+	memcpy(to->aim_x, from->aim_x, n);
+	memcpy(to->aim_y, from->aim_y, n);
+	to->count = from->count;
+}
+
+static void reset_sprites(void) {
+	for (int i = 0; i < number_of_projectiles; i++) {
+		sprite_t * s = &sprites[i];
+		s->x = start.x[i];
+		s->y = start.y[i];
+		s->dx = s->dy = 0;
+		s->aim_x = start.aim_x[i];
+		s->aim_y = start.aim_y[i];
+		s->image = 'F';
+		s->draw = true;
+	}
+}
+
+static void move_sprites(void) {
+	for (int step = 0; step < steps; step++) {
+		for (int i = 0; i < number_of_projectiles; i++) {
+			sprite_t * s = &sprites[i];
+			double t1 = s->aim_x - s->x;
+			double t2 = s->aim_y - s->y;
+			double d = sqrt(t1 * t1 + t2 * t2);
+
+			if (d > 0) {
+				s->dx = t1 * SPEED / d;
+				s->dy = t2 * SPEED / d;
+			}
+
+			s->x += s->dx;
+			s->y += s->dy;
+		}
+	}
+}
+
+static void move_particles(void) {
+	for (int step = 0; step < steps; step++) {
+		particles_advance(&particles, SPEED);
+	}
+}
+
+/*
+ *	Times one update of every projectile, in microseconds per 10,000
+ *	projectiles, excluding the time taken by reset.
+ */
+static double best_time(void (*reset)(void), void (*update)(void), int updates) {
+	double best = 1e9;
+
+	for (int r = 0; r < REPEATS; r++) {
+		reset();
+
+		double started = now();
+		update();
+		double elapsed = now() - started;
+
+		if (elapsed < best) best = elapsed;
+	}
+
+	return best * 1e6 / updates * 10000 / number_of_projectiles;
+}
+
+static void reset_particles(void) {
+	copy_particles(&particles, &start);
+}
+
+static void collide_particles(void) {
+	particles_cells(&particles, WIDTH, HEIGHT, cells);
+
+	for (int i = 0; i < particles.count; i++) {
+		keep[i] = cells[i] >= 0 && open_cells[cells[i]];
+	}
+
+	particles_compact(&particles, keep);
+}
+
+/*
+ *	Moves the particles at the selected level and compares every position
+ *	and velocity with those moved by the scalar level.
+ */
+static int check_level(ZdkKernelLevel level) {
+	ZdkParticles expected;
+	particles_init(&expected, number_of_projectiles);
+
+	zdk_select_kernels(ZDK_KERNELS_SCALAR);
+	reset_particles();
+	move_particles();
+	copy_particles(&expected, &particles);
+
+	zdk_select_kernels(level);
+	reset_particles();
+	move_particles();
+
+	size_t n = particles.count * sizeof(float);
+	int failures = memcmp(expected.x, particles.x, n) != 0
+		|| memcmp(expected.y, particles.y, n) != 0
+		|| memcmp(expected.dx, particles.dx, n) != 0
+		|| memcmp(expected.dy, particles.dy, n) != 0;
+
+	if (failures) fprintf(stderr, "advance mismatch (%s)\n", zdk_kernel_level_name(level));
+
+	particles_destroy(&expected);
+	return failures;
+}
+
+static void report(const char * method, const char * level, double us_per_10k) {
+	printf("{\"method\":\"%s\",\"level\":\"%s\",\"projectiles\":%d,\"us_per_10k\":%.2f}\n",
+		method, level, number_of_projectiles, us_per_10k);
+}
+
+int main(int argc, char * argv[]) {
+	bool check_only = argc > 1 && strcmp(argv[1], "--check") == 0;
+	char ** args = argv + check_only;
+	int num_args = argc - check_only;
+
+	if (num_args > 1) number_of_projectiles = atoi(args[1]);
+	if (num_args > 2) steps = atoi(args[2]);
+
+	if (number_of_projectiles < 1 || steps < 1) {
+		fprintf(stderr, "usage: %s [--check] [projectiles] [steps]\n", argv[0]);
+		return 2;
+	}
+
+	srand(202);
+	setup();
+
+	int failures = 0;
+	ZdkKernelLevel best = zdk_select_kernels(ZDK_KERNELS_AVX2);
+
+	for (ZdkKernelLevel level = ZDK_KERNELS_SSE2; level <= best; level++) {
+		failures += check_level(level);
+	}
+
+	if (check_only) {
+		if (failures) {
+			fprintf(stderr, "%d kernel levels differ\n", failures);
+			return 1;
+		}
+
+		printf("advance kernels agree up to %s\n", zdk_kernel_level_name(best));
+		return 0;
+	}
+
+	report("sprites", "scalar", best_time(reset_sprites, move_sprites, steps));
+
+	for (ZdkKernelLevel level = ZDK_KERNELS_SCALAR; level <= best; level++) {
+		zdk_select_kernels(level);
+		report("advance", zdk_kernel_level_name(level), best_time(reset_particles, move_particles, steps));
+	}
+
+	report("collide", "scalar", best_time(reset_particles, collide_particles, 1));
+
+	if (failures) {
+		fprintf(stderr, "%d kernel levels differ\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+**  bench_render.c
+**
+**  Headless rendering benchmark for the ZDK.
+**
+**  Curses output is suppressed and the screen size is set with
+**  override_screen_size(), so no terminal is required. Each workload
+**  draws a synthetic frame and calls show_screen(); the cost per frame
+**  and the counters from zdk_render_stats are reported as JSON. All
+**  counters are averages per frame.
+**
+**  Usage: ./bench_render [frames] [backend]
+**
+**  backend is "null" (the default), "curses" or "ansi". A terminal backend
+**  draws into the terminal, at the size of the terminal, so that the frame
+**  latency of the backends may be compared.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "cab202_backend.h"
+#include "cab202_graphics.h"
+
+#define NUM_SPRITES (20)
+#define NUM_WALLS (200)
+
+static const int sizes[][2] = { { 80, 24 }, { 160, 48 }, { 240, 100 }, { 400, 200 } };
+#define NUM_SIZES ((int)(sizeof(sizes) / sizeof(sizes[0])))
+
+/*
+ *	Sparse sprite scene: the screen is cleared, then a handful of sprites
+ *	are drawn at slowly changing positions. This is the common game case.
+ */
+static void sparse_sprites(int frame, int w, int h) {
+	clear_screen();
+
+	for (int i = 0; i < NUM_SPRITES; i++) {
+		int x = (i * 37 + frame / (1 + i % 4)) % w;
+		int y = (i * 11 + frame / (3 + i % 5)) % h;
+		draw_char(x, y, 'A' + i);
+	}
+}
+
+/*
+ *	Full redraw: every cell changes character and colour on every frame.
+ */
+static void full_redraw(int frame, int w, int h) {
+	set_colours(frame % NUM_COLOURS, (frame + 1) % NUM_COLOURS);
+
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++) {
+			draw_char(x, y, '!' + (x + y + frame) % 90);
+		}
+	}
+
+	set_colours(WHITE, BLACK);
+}
+
+/*
+ *	Wall-heavy scene: the screen is cleared and a fixed set of horizontal,
+ *	vertical and diagonal wall segments is redrawn every frame.
+ */
+static void wall_lines(int frame, int w, int h) {
+	clear_screen();
+	srand(202);
+
+	for (int i = 0; i < NUM_WALLS; i++) {
+		int x1 = rand() % w, y1 = rand() % h;
+		int x2 = rand() % w, y2 = rand() % h;
+
+		if (i % 3 == 0) y2 = y1;
+		else if (i % 3 == 1) x2 = x1;
+
+		draw_line(x1, y1, x2, y2, '*');
+	}
+
+	draw_char(frame % w, h / 2, '@');
+}
+
+/*
+ *	HUD text: the screen is cleared and a status display similar to the
+ *	game's is formatted every frame. Only the time field changes often.
+ */
+static void hud_text(int frame, int w, int h) {
+	clear_screen();
+	draw_line(0, 3, w, 3, '~');
+	draw_formatted(0.05 * w, 0, "Student #: n10133810");
+	draw_formatted(0.2 * w, 0, "Score: %d", frame / 500);
+	draw_formatted(0.3 * w, 0, "Lives: %d", 5);
+	draw_formatted(0.4 * w, 0, "Active Sprite: %c", 'J');
+	draw_formatted(0.5 * w, 0, "Time: %02d:%02d", frame / 6000, frame / 100 % 60);
+	draw_formatted(0.05 * w, 2, "Cheese: %d", frame / 200 % 6);
+	draw_formatted(0.2 * w, 2, "Traps: %d", frame / 300 % 6);
+	draw_formatted(0.3 * w, 2, "Fireworks: %d", 0);
+	draw_formatted(0.4 * w, 2, "Level: %d", 1);
+}
+
+/*
+ *	HUD labels: the same status display as hud_text, retained as labels
+ *	which are created on the first frame and bound to variables. Only the
+ *	labels whose values change are formatted again.
+ */
+#define NUM_LABELS (9)
+
+static ZdkLabel * labels[NUM_LABELS];
+static int hud[6];
+
+static void hud_labels(int frame, int w, int h) {
+	if (frame == 0) {
+		static const int lives = 5, fireworks = 0, level = 1;
+		static const char sprite = 'J';
+
+		labels[0] = create_label(0.05 * w, 0, "Student #: n10133810");
+		bind_label_int(labels[1] = create_label(0.2 * w, 0, "Score: %d"), &hud[0]);
+		bind_label_int(labels[2] = create_label(0.3 * w, 0, "Lives: %d"), &lives);
+		bind_label_char(labels[3] = create_label(0.4 * w, 0, "Active Sprite: %c"), &sprite);
+		bind_label_int(labels[4] = create_label(0.5 * w, 0, "Time: %02d:%02d"), &hud[1]);
+		bind_label_int(labels[4], &hud[2]);
+		bind_label_int(labels[5] = create_label(0.05 * w, 2, "Cheese: %d"), &hud[3]);
+		bind_label_int(labels[6] = create_label(0.2 * w, 2, "Traps: %d"), &hud[4]);
+		bind_label_int(labels[7] = create_label(0.3 * w, 2, "Fireworks: %d"), &fireworks);
+		bind_label_int(labels[8] = create_label(0.4 * w, 2, "Level: %d"), &level);
+	}
+
+	hud[0] = frame / 500;
+	hud[1] = frame / 6000;
+	hud[2] = frame / 100 % 60;
+	hud[3] = frame / 200 % 6;
+	hud[4] = frame / 300 % 6;
+
+	clear_screen();
+	draw_line(0, 3, w, 3, '~');
+}
+
+static void hud_labels_done(void) {
+	for (int i = 0; i < NUM_LABELS; i++) {
+		destroy_label(labels[i]);
+		labels[i] = NULL;
+	}
+}
+
+typedef struct {
+	const char * name;
+	void (*draw)(int frame, int w, int h);
+	void (*done)(void);
+} Workload;
+
+static const Workload workloads[] = {
+	{ "sparse_sprites", sparse_sprites, NULL },
+	{ "full_redraw", full_redraw, NULL },
+	{ "wall_lines", wall_lines, NULL },
+	{ "hud_text", hud_text, NULL },
+	{ "hud_labels", hud_labels, hud_labels_done },
+};
+#define NUM_WORKLOADS ((int)(sizeof(workloads) / sizeof(workloads[0])))
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1.0e+9;
+}
+
+int main(int argc, char * argv[]) {
+	int frames = argc > 1 ? atoi(argv[1]) : 1000;
+	const char * backend_name = argc > 2 ? argv[2] : "null";
+
+	if (frames < 1) frames = 1;
+
+	zdk_backend = zdk_find_backend(backend_name);
+
+	if (!zdk_backend) {
+		fprintf(stderr, "bench_render: unknown backend %s\n", backend_name);
+		return 2;
+	}
+
+	zdk_suppress_output = zdk_backend == &zdk_null_backend;
+	setup_screen();
+
+	// A terminal backend is measured at the size of the terminal only, and
+	// the results are held until the terminal has been restored.
+	int num_sizes = zdk_suppress_output ? NUM_SIZES : 1;
+	int terminal_size[2] = { screen_width(), screen_height() };
+	static char results[NUM_SIZES * NUM_WORKLOADS][400];
+	int num_results = 0;
+
+	for (int i = 0; i < num_sizes; i++) {
+		int w = zdk_suppress_output ? sizes[i][0] : terminal_size[0];
+		int h = zdk_suppress_output ? sizes[i][1] : terminal_size[1];
+
+		override_screen_size(w, h);
+
+		for (int j = 0; j < NUM_WORKLOADS; j++) {
+			// Warm up, so that the first frame's full-screen diff is not timed.
+			workloads[j].draw(0, w, h);
+			show_screen();
+			reset_render_stats();
+
+			double start = now();
+
+			for (int frame = 1; frame <= frames; frame++) {
+				workloads[j].draw(frame, w, h);
+				show_screen();
+			}
+
+			double ns = (now() - start) * 1.0e+9 / frames;
+			ZdkRenderStats * s = &zdk_render_stats;
+
+			snprintf(results[num_results++], sizeof(results[0]),
+				"{\"workload\":\"%s\",\"backend\":\"%s\",\"width\":%d,\"height\":%d,"
+				"\"frames\":%d,\"ns_per_frame\":%.1f,\"cells_diffed\":%lu,"
+				"\"cells_emitted\":%lu,\"spans\":%lu,\"attr_changes\":%lu,\"bytes\":%lu}",
+				workloads[j].name, backend_name, w, h, frames, ns,
+				s->cells_examined / frames, s->cells_emitted / frames,
+				s->spans / frames, s->attr_changes / frames, s->bytes / frames);
+
+			if (workloads[j].done) workloads[j].done();
+		}
+	}
+
+	cleanup_screen();
+
+	printf("[\n");
+
+	for (int i = 0; i < num_results; i++) {
+		printf("  %s%s\n", results[i], i == num_results - 1 ? "" : ",");
+	}
+
+	printf("]\n");
+
+	return 0;
+}
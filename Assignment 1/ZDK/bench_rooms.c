@@ -0,0 +1,261 @@
+/*
+**  bench_rooms.c
+**
+**  Startup benchmark for room loading in cab202_rooms.c.
+**
+**  Writes a set of random room files to a temporary directory, then times
+**  four ways of loading all of them:
+**
+**      fscanf    - fopen() and one fscanf("%c %f %f %f %f") per command,
+**                  as the game used to read its rooms.
+**      mmap      - map_room_file() and parse_room().
+**      build     - parsing the files and compiling them into a level pack.
+**      pack      - levelpack_open(), which checks the pack, then
+**                  levelpack_room() for every room.
+**
+**  The rooms loaded each way are compared, and the program exits with a
+**  non-zero status if any value differs. Each way is timed several times
+**  and the fastest is reported.
+**
+**  Usage: ./bench_rooms [rooms] [walls per room]
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "cab202_rooms.h"
+
+#define REPEATS (5)
+#define FILE_NAME_MAX (64)
+
+static int number_of_rooms = 500;
+static int walls_per_room = 40;
+static char directory[] = "/tmp/bench_rooms.XXXXXX";
+static char pack_name[FILE_NAME_MAX];
+
+static Room * expected;
+static Room * loaded;
+static RoomWall * wall_store;
+
+static double now(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1.0e+9;
+}
+
+static void room_file_name(char * buffer, int i) {
+	snprintf(buffer, FILE_NAME_MAX, "%s/room%04d.txt", directory, i);
+}
+
+/*
+ *	Writes a room with walls_per_room walls and a few of the quirks of the
+ *	real room files: mixed precision, and lines in any order. Some values
+ *	have 15 significant digits, which must go through strtof().
+ */
+static void write_room(int i) {
+	char file_name[FILE_NAME_MAX];
+	room_file_name(file_name, i);
+
+	FILE * f = fopen(file_name, "w");
+
+	for (int w = 0; w < walls_per_room; w++) {
+		if (w == walls_per_room / 2) fprintf(f, "J %.2f %.2f\n", rand() % 100 / 100.0, rand() % 100 / 100.0);
+		if (w == walls_per_room / 3) fprintf(f, "T %g %g\n", rand() % 1000 / 1000.0, rand() % 1000 / 1000.0);
+
+		fprintf(f, "W %.2f %g %.3f %.15f\n", rand() % 100 / 100.0, rand() % 20 / 20.0,
+			rand() % 1000 / 1000.0, rand() / (RAND_MAX + 1.0));
+	}
+
+	fclose(f);
+}
+
+/*
+ *	Reads a room the way the game used to.
+ */
+static void fscanf_room(FILE * stream, Room * room, RoomWall * walls) {
+	memset(room, 0, sizeof(*room));
+	room->walls = walls;
+
+	while (!feof(stream)) {
+		char command;
+		float a, b, c, d;
+		int captured = fscanf(stream, "%c %f %f %f %f", &command, &a, &b, &c, &d);
+
+		if (captured == 3 && command == 'J') {
+			room->has_jerry = true;
+			room->jerry_x = a;
+			room->jerry_y = b;
+		}
+		else if (captured == 3 && command == 'T') {
+			room->has_tom = true;
+			room->tom_x = a;
+			room->tom_y = b;
+		}
+		else if (captured == 5 && command == 'W') {
+			RoomWall wall = { a, b, c, d };
+			walls[room->number_of_walls++] = wall;
+		}
+	}
+}
+
+static void load_fscanf(void) {
+	char file_name[FILE_NAME_MAX];
+
+	for (int i = 0; i < number_of_rooms; i++) {
+		room_file_name(file_name, i);
+
+		FILE * stream = fopen(file_name, "r");
+		fscanf_room(stream, &expected[i], wall_store + i * walls_per_room);
+		fclose(stream);
+	}
+}
+
+static void load_mmap(void) {
+	char file_name[FILE_NAME_MAX];
+
+	for (int i = 0; i < number_of_rooms; i++) {
+		room_file_name(file_name, i);
+
+		size_t length;
+		const char * text = map_room_file(file_name, &length);
+		parse_room(text, length, &loaded[i], wall_store + i * walls_per_room, walls_per_room);
+		unmap_room_file(text, length);
+	}
+}
+
+static void build_pack(void) {
+	load_mmap();
+	levelpack_write(pack_name, loaded, number_of_rooms);
+}
+
+static void load_pack(void) {
+	ZdkLevelPack * pack = levelpack_open(pack_name);
+
+	for (int i = 0; i < number_of_rooms; i++) {
+		if (!pack || !levelpack_room(pack, i, &loaded[i])) memset(&loaded[i], 0, sizeof(Room));
+	}
+
+	// Sum the walls, as a game would read them, before the pack is closed.
+	volatile float sum = 0;
+
+	for (int i = 0; i < number_of_rooms; i++) {
+		for (int w = 0; w < loaded[i].number_of_walls; w++) {
+			sum += loaded[i].walls[w].x1 + loaded[i].walls[w].y2;
+		}
+	}
+
+	levelpack_close(pack);
+}
+
+static double best_time(void (*load)(void)) {
+	double best = 1e9;
+
+	for (int r = 0; r < REPEATS; r++) {
+		double start = now();
+		load();
+		double elapsed = now() - start;
+
+		if (elapsed < best) best = elapsed;
+	}
+
+	return best;
+}
+
+/*
+ *	Counts the rooms in loaded which differ from those in expected. Walls
+ *	are compared as stored, so every value must be bit-for-bit equal.
+ */
+static int compare_rooms(const char * name) {
+	int failures = 0;
+
+	for (int i = 0; i < number_of_rooms; i++) {
+		const Room * a = &expected[i];
+		const Room * b = &loaded[i];
+
+		if (a->has_jerry != b->has_jerry || a->has_tom != b->has_tom
+			|| a->jerry_x != b->jerry_x || a->jerry_y != b->jerry_y
+			|| a->tom_x != b->tom_x || a->tom_y != b->tom_y
+			|| a->number_of_walls != b->number_of_walls
+			|| memcmp(a->walls, b->walls, a->number_of_walls * sizeof(RoomWall)) != 0) {
+			fprintf(stderr, "%s: room %d differs\n", name, i);
+			failures++;
+		}
+	}
+
+	return failures;
+}
+
+static void report(const char * method, double elapsed) {
+	printf("{\"method\":\"%s\",\"rooms\":%d,\"walls_per_room\":%d,\"ms\":%.3f,\"us_per_room\":%.2f}\n",
+		method, number_of_rooms, walls_per_room, elapsed * 1e3, elapsed * 1e6 / number_of_rooms);
+}
+
+int main(int argc, char * argv[]) {
+	if (argc > 1) number_of_rooms = atoi(argv[1]);
+	if (argc > 2) walls_per_room = atoi(argv[2]);
+
+	if (number_of_rooms < 1 || walls_per_room < 1 || !mkdtemp(directory)) {
+		fprintf(stderr, "usage: %s [rooms] [walls per room]\n", argv[0]);
+		return 2;
+	}
+
+	snprintf(pack_name, FILE_NAME_MAX, "%s/rooms.pack", directory);
+
+	expected = calloc(number_of_rooms, sizeof(Room));
+	loaded = calloc(number_of_rooms, sizeof(Room));
+	RoomWall * expected_walls = malloc(number_of_rooms * walls_per_room * sizeof(RoomWall));
+	RoomWall * loaded_walls = malloc(number_of_rooms * walls_per_room * sizeof(RoomWall));
+
+	srand(202);
+
+	for (int i = 0; i < number_of_rooms; i++) {
+		write_room(i);
+	}
+
+	int failures = 0;
+
+	wall_store = expected_walls;
+	double fscanf_time = best_time(load_fscanf);
+
+	wall_store = loaded_walls;
+	double mmap_time = best_time(load_mmap);
+	failures += compare_rooms("mmap");
+
+	double build_time = best_time(build_pack);
+
+	double pack_time = best_time(load_pack);
+	ZdkLevelPack * pack = levelpack_open(pack_name);
+
+	for (int i = 0; i < number_of_rooms; i++) {
+		if (!pack || !levelpack_room(pack, i, &loaded[i])) memset(&loaded[i], 0, sizeof(Room));
+	}
+
+	failures += compare_rooms("pack");
+	levelpack_close(pack);
+
+	report("fscanf", fscanf_time);
+	report("mmap", mmap_time);
+	report("build", build_time);
+	report("pack", pack_time);
+
+	char file_name[FILE_NAME_MAX];
+
+	for (int i = 0; i < number_of_rooms; i++) {
+		room_file_name(file_name, i);
+		unlink(file_name);
+	}
+
+	unlink(pack_name);
+	rmdir(directory);
+
+	if (failures) {
+		fprintf(stderr, "%d rooms differ\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
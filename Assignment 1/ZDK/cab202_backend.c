@@ -0,0 +1,559 @@
+/*
+**  cab202_backend.c
+**
+**  Output backends for the ZDK. See cab202_backend.h.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <curses.h>
+#include <sys/ioctl.h>
+#include "cab202_backend.h"
+#include "cab202_graphics.h"
+#include "cab202_timers.h"
+
+#define ABS(x)	 (((x) >= 0) ? (x) : -(x))
+
+const ZdkBackend * zdk_backend = NULL;
+
+// ------------------------------------------------------------------
+//	ANSI encoding.
+// ------------------------------------------------------------------
+
+/*
+**	The SGR parameters which make up a curses attribute.
+*/
+typedef struct SgrState {
+    int fg;
+    int bg;
+    bool bold;
+    bool reverse;
+} SgrState;
+
+static SgrState sgr_state(int attr) {
+    int pair = PAIR_NUMBER(attr);
+    SgrState s;
+
+    // Colour pair 0 is the terminal's default colours.
+    s.fg = pair > 0 ? 30 + (pair - 1) % NUM_COLOURS : 39;
+    s.bg = pair > 0 ? 40 + (pair - 1) / NUM_COLOURS : 49;
+    s.bold = (attr & A_BOLD) != 0;
+    s.reverse = (attr & A_REVERSE) != 0;
+    return s;
+}
+
+/*
+**	Helper function which appends an SGR parameter, with a separator if it
+**	is not the first.
+*/
+static int sgr_param(char * buffer, int len, int param) {
+    return len + sprintf(buffer + len, len > 2 ? ";%d" : "%d", param);
+}
+
+/*
+**	See cab202_backend.h for documentation.
+*/
+int zdk_ansi_attr(char * buffer, int from, int to) {
+    if (from == to) return 0;
+
+    SgrState old = sgr_state(from);
+    SgrState new = sgr_state(to);
+    int len = sprintf(buffer, "\x1b[");
+
+    // Bold and reverse can only be turned off by a reset, after which every
+    // parameter which differs from the default must be sent again.
+    if (from < 0 || (old.bold && !new.bold) || (old.reverse && !new.reverse)) {
+        len = sgr_param(buffer, len, 0);
+        old = sgr_state(0);
+    }
+
+    if (new.fg != old.fg) len = sgr_param(buffer, len, new.fg);
+    if (new.bg != old.bg) len = sgr_param(buffer, len, new.bg);
+    if (new.bold && !old.bold) len = sgr_param(buffer, len, 1);
+    if (new.reverse && !old.reverse) len = sgr_param(buffer, len, 7);
+
+    // The attributes differ only in bits which have no ANSI equivalent.
+    if (len == 2) return 0;
+
+    buffer[len++] = 'm';
+    buffer[len] = 0;
+    return len;
+}
+
+/*
+**	Helper function which formats a CSI sequence with an optional count,
+**	which is omitted if it is 1.
+*/
+static int csi(char * buffer, int n, char command) {
+    return n == 1 ? sprintf(buffer, "\x1b[%c", command) : sprintf(buffer, "\x1b[%d%c", n, command);
+}
+
+/*
+**	Helper function which formats a horizontal movement within a row.
+*/
+static int move_across(char * buffer, int from_x, int x) {
+    if (x == from_x) return 0;
+
+    if (x == 0) return sprintf(buffer, "\r");
+
+    if (x > from_x) return csi(buffer, x - from_x, 'C');
+
+    // Move left, or to an absolute column, whichever is shorter.
+    char absolute[ZDK_ANSI_SEQ_MAX];
+    int len = csi(buffer, from_x - x, 'D');
+    int absolute_len = csi(absolute, x + 1, 'G');
+
+    if (absolute_len < len) {
+        memcpy(buffer, absolute, absolute_len + 1);
+        len = absolute_len;
+    }
+
+    return len;
+}
+
+/*
+**	See cab202_backend.h for documentation.
+*/
+int zdk_ansi_move(char * buffer, int from_y, int from_x, int y, int x) {
+    if (from_y == y && from_x == x) return 0;
+
+    // Absolute position, which is always possible.
+    int len = x == 0
+        ? (y == 0 ? sprintf(buffer, "\x1b[H") : sprintf(buffer, "\x1b[%dH", y + 1))
+        : sprintf(buffer, "\x1b[%d;%dH", y + 1, x + 1);
+
+    if (from_y < 0 || from_x < 0) return len;
+
+    char relative[ZDK_ANSI_SEQ_MAX * 2];
+    int relative_len;
+
+    if (from_y == y) {
+        relative_len = move_across(relative, from_x, x);
+    }
+    else if (y > from_y && y - from_y <= 4 && x <= 4) {
+        // Carriage return and line feeds, then a short step right.
+        relative_len = sprintf(relative, "\r");
+
+        for (int i = from_y; i < y; i++) relative[relative_len++] = '\n';
+
+        relative_len += move_across(relative + relative_len, 0, x);
+    }
+    else {
+        relative_len = csi(relative, ABS(y - from_y), y > from_y ? 'B' : 'A');
+        relative_len += move_across(relative + relative_len, from_x, x);
+    }
+
+    if (relative_len < len) {
+        memcpy(buffer, relative, relative_len);
+        buffer[relative_len] = 0;
+        len = relative_len;
+    }
+
+    return len;
+}
+
+// ------------------------------------------------------------------
+//	Waiting for input.
+// ------------------------------------------------------------------
+
+/*
+**	Helper function which waits for the standard input stream to become
+**	readable, for the terminal backends. poll() counts whole milliseconds,
+**	so it is given the time to the deadline rounded down, and the last
+**	fraction of a millisecond is slept by timer_sleep_until().
+**
+**	If the time hooks or virtual time are in use, a deadline is on their
+**	clock rather than the system's, so the input is checked once and the
+**	rest of the time is left to timer_sleep_until().
+*/
+static bool wait_stdin(int64_t deadline) {
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    bool hooked = zdk_timer_pause || zdk_get_current_time || timer_is_virtual();
+
+    for (;;) {
+        int timeout = -1;
+
+        if (deadline >= 0 && hooked) {
+            timeout = 0;
+        }
+        else if (deadline >= 0) {
+            int64_t left = deadline - get_current_ns();
+            timeout = left > 0 ? (int)(left / NS_PER_MILLISECOND) : 0;
+        }
+
+        int ready = poll(&fd, 1, timeout);
+
+        if (ready > 0) return true;
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready < 0 || deadline < 0) return false;
+
+        if (timeout == 0) {
+            timer_sleep_until(deadline);
+            return false;
+        }
+    }
+}
+
+// ------------------------------------------------------------------
+//	Curses backend.
+// ------------------------------------------------------------------
+
+static bool curses_open(int attr) {
+    // Enter curses mode.
+    initscr();
+    start_color();
+
+    // Set up a colour pair for each terminal colour. Pair numbers match
+    // colour_index() in cab202_graphics.c.
+    for (int fg = 0; fg < NUM_COLOURS; fg++) {
+        for (int bg = 0; bg < NUM_COLOURS; bg++) {
+            init_pair(bg * NUM_COLOURS + fg + 1, fg, bg);
+        }
+    }
+
+    // The default background colour is black.
+    bkgd(attr);
+
+    // Do not echo keypresses.
+    noecho();
+
+    // Turn off the cursor.
+    curs_set(0);
+
+    // Cause getch to return ERR if no key pressed within 0 milliseconds.
+    timeout(0);
+
+    // Enable the keypad.
+    keypad(stdscr, TRUE);
+
+    // Turn on mouse reporting.
+    mousemask(ALL_MOUSE_EVENTS, NULL);
+
+    // Erase any previous content that may be lingering in this screen.
+    clear();
+    return true;
+}
+
+static void curses_close(void) {
+    endwin();
+}
+
+static void curses_get_size(int * width, int * height) {
+    *width = getmaxx(stdscr);
+    *height = getmaxy(stdscr);
+}
+
+static void curses_set_attr(int attr, const char * sgr, int sgr_len) {
+    attrset(attr);
+}
+
+static void curses_move(int y, int x, const char * cup, int cup_len) {
+    move(y, x);
+}
+
+static void curses_write(const char * text, int len) {
+    // A NUL character is written on its own, because curses treats it as
+    // the end of the string.
+    if (len == 1) {
+        addch(text[0]);
+    }
+    else {
+        addnstr(text, len);
+    }
+}
+
+static bool curses_present(void) {
+    return refresh() != ERR;
+}
+
+static int curses_read_char(bool wait) {
+    if (!wait) return getch();
+
+    timeout(-1);
+    int char_code = getch();
+    timeout(0);
+    return char_code;
+}
+
+const ZdkBackend zdk_curses_backend = {
+    "curses",
+    curses_open,
+    curses_close,
+    curses_get_size,
+    curses_set_attr,
+    curses_move,
+    curses_write,
+    curses_present,
+    curses_read_char,
+    wait_stdin,
+};
+
+// ------------------------------------------------------------------
+//	ANSI backend.
+// ------------------------------------------------------------------
+
+// Output accumulated since the last call to ansi_present.
+static char * ansi_out = NULL;
+static size_t ansi_len = 0;
+static size_t ansi_capacity = 0;
+
+// True if output has been lost since the last call to ansi_present.
+static bool ansi_lost = false;
+
+static struct termios ansi_saved_termios;
+static bool ansi_termios_saved = false;
+
+static void ansi_append(const char * text, size_t len) {
+    if (ansi_len + len > ansi_capacity) {
+        size_t capacity = ansi_capacity ? ansi_capacity : 4096;
+
+        while (capacity < ansi_len + len) capacity *= 2;
+
+        char * out = realloc(ansi_out, capacity);
+
+        if (!out) {
+            ansi_lost = true;
+            return;
+        }
+
+        ansi_out = out;
+        ansi_capacity = capacity;
+    }
+
+    memcpy(ansi_out + ansi_len, text, len);
+    ansi_len += len;
+}
+
+static bool ansi_present(void) {
+    size_t done = 0;
+
+    // Output with a gap in it would draw in the wrong places, so none of
+    // it is sent. The caller repaints the whole screen instead.
+    if (ansi_lost) {
+        ansi_len = 0;
+        ansi_lost = false;
+        return false;
+    }
+
+    // Normally a single write; more only if the terminal accepts part of it.
+    while (done < ansi_len) {
+        ssize_t n = write(STDOUT_FILENO, ansi_out + done, ansi_len - done);
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // A non-blocking stdout is full: sleep until the terminal drains
+            // rather than spinning on write().
+            struct pollfd fd = { STDOUT_FILENO, POLLOUT, 0 };
+
+            if (poll(&fd, 1, -1) < 0 && errno != EINTR) break;
+        }
+        else if (n < 0 && errno != EINTR) break;
+
+        if (n > 0) done += n;
+    }
+
+    bool sent = done == ansi_len;
+
+    ansi_len = 0;
+    return sent;
+}
+
+static bool ansi_open(int attr) {
+    if (isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &ansi_saved_termios) == 0) {
+        struct termios raw = ansi_saved_termios;
+
+        // Keys are reported immediately and not echoed. Signals such as
+        // Ctrl-C are still generated.
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 0;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+        ansi_termios_saved = true;
+    }
+
+    // Switch to the alternate screen, hide the cursor, and clear the
+    // screen in the colour of a blank cell.
+    char sgr[ZDK_ANSI_SEQ_MAX];
+    static const char start[] = "\x1b[?1049h\x1b[?25l";
+    static const char clear[] = "\x1b[2J";
+
+    ansi_append(start, sizeof(start) - 1);
+    ansi_append(sgr, zdk_ansi_attr(sgr, -1, attr));
+    ansi_append(clear, sizeof(clear) - 1);
+    ansi_present();
+    return true;
+}
+
+static void ansi_close(void) {
+    static const char finish[] = "\x1b[0m\x1b[?25h\x1b[?1049l";
+
+    ansi_append(finish, sizeof(finish) - 1);
+    ansi_present();
+
+    if (ansi_termios_saved) {
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &ansi_saved_termios);
+        ansi_termios_saved = false;
+    }
+
+    free(ansi_out);
+    ansi_out = NULL;
+    ansi_len = ansi_capacity = 0;
+}
+
+static void ansi_get_size(int * width, int * height) {
+    struct winsize size;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0 && size.ws_row > 0) {
+        *width = size.ws_col;
+        *height = size.ws_row;
+    }
+    else {
+        *width = 80;
+        *height = 24;
+    }
+}
+
+static void ansi_set_attr(int attr, const char * sgr, int sgr_len) {
+    ansi_append(sgr, sgr_len);
+}
+
+static void ansi_move(int y, int x, const char * cup, int cup_len) {
+    ansi_append(cup, cup_len);
+}
+
+static void ansi_write(const char * text, int len) {
+    size_t start = ansi_len;
+
+    ansi_append(text, len);
+
+    // Control characters would move the cursor, so they are shown as
+    // spaces.
+    for (size_t i = start; i < ansi_len; i++) {
+        unsigned char c = ansi_out[i];
+
+        if (c < ' ' || c == 0x7f) ansi_out[i] = ' ';
+    }
+}
+
+/*
+**	Helper function which reads one byte from the standard input stream,
+**	waiting for up to timeout milliseconds (forever if timeout < 0).
+*/
+static int ansi_read_byte(int timeout) {
+    struct pollfd fd = { STDIN_FILENO, POLLIN, 0 };
+    unsigned char c;
+
+    while (poll(&fd, 1, timeout) < 0) {
+        if (errno != EINTR) return ERR;
+    }
+
+    if (!(fd.revents & POLLIN) || read(STDIN_FILENO, &c, 1) != 1) return ERR;
+
+    return c;
+}
+
+static int ansi_read_char(bool wait) {
+    int c = ansi_read_byte(wait ? -1 : 0);
+
+    if (c != 27) return c;
+
+    // Decode the cursor keys. The rest of a sequence arrives with the
+    // escape character, so there is no need to wait long for it.
+    int intro = ansi_read_byte(10);
+
+    if (intro != '[' && intro != 'O') return c;
+
+    switch (ansi_read_byte(10)) {
+    case 'A': return KEY_UP;
+    case 'B': return KEY_DOWN;
+    case 'C': return KEY_RIGHT;
+    case 'D': return KEY_LEFT;
+    case 'H': return KEY_HOME;
+    case 'F': return KEY_END;
+    default: return ERR;
+    }
+}
+
+const ZdkBackend zdk_ansi_backend = {
+    "ansi",
+    ansi_open,
+    ansi_close,
+    ansi_get_size,
+    ansi_set_attr,
+    ansi_move,
+    ansi_write,
+    ansi_present,
+    ansi_read_char,
+    wait_stdin,
+};
+
+// ------------------------------------------------------------------
+//	Null backend.
+// ------------------------------------------------------------------
+
+static bool null_open(int attr) {
+    return true;
+}
+
+static void null_close(void) {}
+
+static void null_get_size(int * width, int * height) {
+    *width = 80;
+    *height = 24;
+}
+
+static void null_set_attr(int attr, const char * sgr, int sgr_len) {}
+
+static void null_move(int y, int x, const char * cup, int cup_len) {}
+
+static void null_write(const char * text, int len) {}
+
+static bool null_present(void) {
+    return true;
+}
+
+static int null_read_char(bool wait) {
+    return ERR;
+}
+
+// No key will ever arrive, so there is nothing to wait for without a deadline.
+static bool null_wait_input(int64_t deadline) {
+    if (deadline >= 0) timer_sleep_until(deadline);
+    return false;
+}
+
+const ZdkBackend zdk_null_backend = {
+    "null",
+    null_open,
+    null_close,
+    null_get_size,
+    null_set_attr,
+    null_move,
+    null_write,
+    null_present,
+    null_read_char,
+    null_wait_input,
+};
+
+/*
+**	See cab202_backend.h for documentation.
+*/
+const ZdkBackend * zdk_find_backend(const char * name) {
+    static const ZdkBackend * backends[] = {
+        &zdk_curses_backend,
+        &zdk_ansi_backend,
+        &zdk_null_backend,
+    };
+
+    for (size_t i = 0; name && i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcmp(name, backends[i]->name) == 0) return backends[i];
+    }
+
+    return NULL;
+}
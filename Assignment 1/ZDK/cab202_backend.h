@@ -0,0 +1,142 @@
+/*
+*    cab202_backend.h
+*
+*    Output backends for the ZDK.
+*
+*    show_screen() works out which cells have changed and sends them, as
+*    spans of uniform colour, to the backend of the default context. The
+*    backend owns the terminal: it sets it up, draws the spans, presents
+*    the finished frame and reads the keyboard. Three backends are
+*    provided:
+*
+*    zdk_curses_backend - Draws through curses, as the ZDK always has. This
+*        is the default.
+*
+*    zdk_ansi_backend - Writes ANSI escape sequences directly to the
+*        standard output stream. The changes in a frame are assembled in
+*        one buffer and sent with a single write() when the frame is
+*        presented. Cursor movements and colour changes are encoded as
+*        compactly as the ANSI sequences allow.
+*
+*    zdk_null_backend - Discards all output and reads no keys. It is used
+*        when zdk_suppress_output is true, and by contexts created with
+*        zdk_create_context(). zdk_render_stats still counts the cells,
+*        spans, colour changes and bytes of every frame, so the null
+*        backend measures the cost of rendering without a terminal.
+*
+*    The byte counter in zdk_render_stats uses the same encoding as the
+*    ANSI backend, so it is exactly the number of bytes that backend writes.
+*
+*    $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#ifndef BACKEND_H_
+#define BACKEND_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+**    A buffer large enough for any sequence produced by zdk_ansi_attr or
+**    zdk_ansi_move.
+*/
+#define ZDK_ANSI_SEQ_MAX (32)
+
+/*
+**    An output backend. Every member must be set.
+**
+**    Members:
+**        name - The name by which the backend is selected (see zdk_backend).
+**
+**        open - Prepares the terminal. attr is the colour of a blank cell,
+**            as stored in Screen.colours. Returns false on failure.
+**
+**        close - Restores the terminal to its original state.
+**
+**        get_size - Gets the size of the terminal window.
+**
+**        set_attr - Selects the colour for subsequent text. sgr holds the
+**            equivalent ANSI sequence, of length sgr_len.
+**
+**        move_cursor - Moves the cursor to (x,y). cup holds the equivalent
+**            ANSI sequence, of length cup_len.
+**
+**        write_text - Writes len characters at the cursor, which advances.
+**
+**        present - Makes everything written since the last call visible.
+**            Returns false if some of it could not be sent, in which case
+**            the terminal no longer matches the last screen shown.
+**
+**        read_char - Gets a key code, or ERR if no key is available. If wait
+**            is true, waits until a key is pressed.
+**
+**        wait_input - Sleeps until a key may be available to read_char, or
+**            until get_current_ns() reaches deadline. A negative deadline
+**            means no time limit. Returns true if input may be available,
+**            false if the deadline passed. The terminal backends wait on
+**            the standard input stream with poll(), so they use no CPU
+**            while they wait.
+*/
+typedef struct ZdkBackend {
+    const char * name;
+    bool (*open)(int attr);
+    void (*close)(void);
+    void (*get_size)(int * width, int * height);
+    void (*set_attr)(int attr, const char * sgr, int sgr_len);
+    void (*move_cursor)(int y, int x, const char * cup, int cup_len);
+    void (*write_text)(const char * text, int len);
+    bool (*present)(void);
+    int (*read_char)(bool wait);
+    bool (*wait_input)(int64_t deadline);
+} ZdkBackend;
+
+extern const ZdkBackend zdk_curses_backend;
+extern const ZdkBackend zdk_ansi_backend;
+extern const ZdkBackend zdk_null_backend;
+
+/**
+ *    The backend which setup_screen() will use for the default context.
+ *    If NULL, the backend named by the ZDK_BACKEND environment variable
+ *    ("curses", "ansi" or "null") is used, or zdk_curses_backend if that
+ *    is not set. Set this before calling setup_screen().
+ */
+extern const ZdkBackend * zdk_backend;
+
+/**
+ *    Finds a backend by name.
+ *
+ *    Output: Returns the address of the backend, or NULL if there is none
+ *        of that name.
+ */
+const ZdkBackend * zdk_find_backend(const char * name);
+
+/**
+ *    Formats the shortest ANSI sequence which changes the colour of
+ *    subsequent text from one curses attribute to another.
+ *
+ *    Input:
+ *        buffer - a buffer of at least ZDK_ANSI_SEQ_MAX characters.
+ *        from - the attribute currently selected, or -1 if unknown.
+ *        to - the attribute to select.
+ *
+ *    Output:
+ *        Returns the length of the sequence, which is 0 if from == to.
+ */
+int zdk_ansi_attr(char * buffer, int from, int to);
+
+/**
+ *    Formats the shortest ANSI sequence which moves the cursor from one
+ *    location to another, all zero-based.
+ *
+ *    Input:
+ *        buffer - a buffer of at least ZDK_ANSI_SEQ_MAX characters.
+ *        from_y, from_x - the current location, or -1 if unknown.
+ *        y, x - the destination.
+ *
+ *    Output:
+ *        Returns the length of the sequence, which is 0 if no movement is
+ *        needed.
+ */
+int zdk_ansi_move(char * buffer, int from_y, int from_x, int y, int x);
+
+#endif /* BACKEND_H_ */
@@ -0,0 +1,577 @@
+/*
+**  cab202_cast.c
+**
+**  Binary screen-cast recording and playback for the ZDK. See
+**  cab202_cast.h for a description of the file format.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cab202_cast.h"
+
+#define CAST_MAGIC "ZDKCAST1"
+#define CAST_MAGIC_LEN (8)
+
+// Unchanged cells shorter than this are folded into the surrounding run,
+// because a new run header costs about as much as the cells themselves.
+#define CAST_RUN_GAP (3)
+
+// Largest width or height accepted from a file, far beyond any terminal.
+// It keeps the cell count of a keyframe well within an int.
+#define CAST_MAX_SIDE (4096)
+
+/*
+**	A growable byte buffer used to assemble each record before it is written.
+*/
+typedef struct Buffer {
+    unsigned char * data;
+    size_t length;
+    size_t capacity;
+} Buffer;
+
+struct ZdkCast {
+    FILE * f;
+    Buffer record;
+    int width;
+    int height;
+    char * pixels;
+    int * colours;
+    int frames_since_key;
+#ifdef ZDK_PACKED_CELLS
+    char * screen_pixels;
+    int * screen_colours;
+    int screen_cells;
+#endif
+};
+
+struct ZdkCastReader {
+    FILE * f;
+    Buffer record;
+    int width;
+    int height;
+    char * pixels;
+    int * colours;
+};
+
+/*
+**	Helper function which ensures a buffer can hold extra more bytes.
+*/
+static bool buffer_reserve(Buffer * b, size_t extra) {
+    if (b->length + extra <= b->capacity) return true;
+
+    size_t capacity = b->capacity ? b->capacity : 256;
+
+    while (capacity < b->length + extra) capacity *= 2;
+
+    unsigned char * data = realloc(b->data, capacity);
+
+    if (!data) return false;
+
+    b->data = data;
+    b->capacity = capacity;
+    return true;
+}
+
+static void put_byte(Buffer * b, unsigned char value) {
+    if (buffer_reserve(b, 1)) b->data[b->length++] = value;
+}
+
+static void put_bytes(Buffer * b, const void * data, size_t n) {
+    if (buffer_reserve(b, n)) {
+        memcpy(b->data + b->length, data, n);
+        b->length += n;
+    }
+}
+
+static void put_varint(Buffer * b, unsigned long value) {
+    while (value >= 0x80) {
+        put_byte(b, (unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+
+    put_byte(b, (unsigned char)value);
+}
+
+static void put_time(Buffer * b, double time) {
+    uint64_t bits;
+    memcpy(&bits, &time, sizeof(bits));
+
+    for (int i = 0; i < 8; i++) {
+        put_byte(b, (unsigned char)(bits >> (8 * i)));
+    }
+}
+
+/*
+**	Helper function which writes a record, consisting of a type byte, the
+**	payload length and the payload assembled in cast->record.
+*/
+static void write_record(ZdkCast * cast, char type) {
+    unsigned char header[16];
+    size_t n = 0;
+    size_t length = cast->record.length;
+
+    header[n++] = type;
+
+    while (length >= 0x80) {
+        header[n++] = (unsigned char)(length | 0x80);
+        length >>= 7;
+    }
+
+    header[n++] = (unsigned char)length;
+
+    fwrite(header, 1, n, cast->f);
+    fwrite(cast->record.data, 1, cast->record.length, cast->f);
+    cast->record.length = 0;
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+ZdkCast * cast_create(const char * file_name) {
+    ZdkCast * cast = calloc(1, sizeof(ZdkCast));
+
+    if (!cast) return NULL;
+
+    cast->f = fopen(file_name, "wb");
+
+    if (!cast->f) {
+        free(cast);
+        return NULL;
+    }
+
+    fwrite(CAST_MAGIC, 1, CAST_MAGIC_LEN, cast->f);
+    return cast;
+}
+
+/*
+**	Helper function which stores a keyframe and makes it the reference for
+**	subsequent deltas.
+*/
+static void write_keyframe(ZdkCast * cast, int width, int height, const char * pixels, const int * colours, double time) {
+    int n = width * height;
+
+    if (width != cast->width || height != cast->height) {
+        free(cast->pixels);
+        free(cast->colours);
+        cast->pixels = malloc(n);
+        cast->colours = malloc(n * sizeof(int));
+
+        if (!cast->pixels || !cast->colours) {
+            cast->width = cast->height = 0;
+            return;
+        }
+
+        cast->width = width;
+        cast->height = height;
+    }
+
+    put_time(&cast->record, time);
+    put_varint(&cast->record, width);
+    put_varint(&cast->record, height);
+
+    for (int i = 0; i < n; ) {
+        int j = i + 1;
+
+        while (j < n && pixels[j] == pixels[i] && colours[j] == colours[i]) j++;
+
+        put_varint(&cast->record, j - i);
+        put_byte(&cast->record, pixels[i]);
+        put_varint(&cast->record, (unsigned)colours[i]);
+        i = j;
+    }
+
+    write_record(cast, 'K');
+
+    memcpy(cast->pixels, pixels, n);
+    memcpy(cast->colours, colours, n * sizeof(int));
+    cast->frames_since_key = 0;
+}
+
+/*
+**	Helper function which stores the runs of cells that differ from the
+**	reference frame, and updates the reference frame.
+*/
+static void write_delta(ZdkCast * cast, const char * pixels, const int * colours, double time) {
+    int n = cast->width * cast->height;
+    char * old_pixels = cast->pixels;
+    int * old_colours = cast->colours;
+    int end = 0;
+
+    put_time(&cast->record, time);
+
+    for (int i = 0; i < n; ) {
+        if (pixels[i] == old_pixels[i] && colours[i] == old_colours[i]) {
+            i++;
+            continue;
+        }
+
+        // Grow a run of one colour, bridging short gaps of unchanged cells.
+        int start = i;
+        int last_changed = i;
+        int colour = colours[i];
+
+        for (i++; i < n && colours[i] == colour; i++) {
+            if (pixels[i] != old_pixels[i] || colour != old_colours[i]) {
+                last_changed = i;
+            }
+            else if (i - last_changed > CAST_RUN_GAP) {
+                break;
+            }
+        }
+
+        int len = last_changed - start + 1;
+
+        put_varint(&cast->record, start - end);
+        put_varint(&cast->record, len);
+        put_varint(&cast->record, (unsigned)colour);
+        put_bytes(&cast->record, pixels + start, len);
+
+        memcpy(old_pixels + start, pixels + start, len);
+        memcpy(old_colours + start, colours + start, len * sizeof(int));
+        end = last_changed + 1;
+        i = end;
+    }
+
+    write_record(cast, 'D');
+    cast->frames_since_key++;
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+void cast_write_frame(ZdkCast * cast, int width, int height, const char * pixels, const int * colours, double time) {
+    if (!cast || width <= 0 || height <= 0) return;
+
+    if (width != cast->width || height != cast->height || cast->frames_since_key + 1 >= CAST_KEYFRAME_INTERVAL) {
+        write_keyframe(cast, width, height, pixels, colours, time);
+    }
+    else {
+        write_delta(cast, pixels, colours, time);
+    }
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+void cast_write_screen(ZdkCast * cast, Screen * screen, double time) {
+    if (!cast || !screen) return;
+
+    int w = screen->width;
+    int h = screen->height;
+
+#ifdef ZDK_PACKED_CELLS
+    // Unpack the cells, because casts store the unpacked representation.
+    if (cast->screen_cells != w * h) {
+        free(cast->screen_pixels);
+        free(cast->screen_colours);
+        cast->screen_pixels = malloc(w * h);
+        cast->screen_colours = malloc(w * h * sizeof(int));
+        cast->screen_cells = w * h;
+
+        if (!cast->screen_pixels || !cast->screen_colours) {
+            cast->screen_cells = 0;
+            return;
+        }
+    }
+
+    for (int i = 0; i < w * h; i++) {
+        cast->screen_pixels[i] = (char)screen->cells[i];
+        cast->screen_colours[i] = zdk_cell_colour(screen->cells[i]);
+    }
+
+    cast_write_frame(cast, w, h, cast->screen_pixels, cast->screen_colours, time);
+#else
+    // The planes of an unpacked screen are each a single row-major block.
+    cast_write_frame(cast, w, h, screen->pixels[0], screen->colours[0], time);
+#endif
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+void cast_write_char(ZdkCast * cast, int char_code, double time) {
+    if (!cast) return;
+
+    put_time(&cast->record, time);
+    put_varint(&cast->record, ((unsigned)char_code << 1) ^ (unsigned)(char_code >> 31));
+    write_record(cast, 'C');
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+void cast_flush(ZdkCast * cast) {
+    if (cast) fflush(cast->f);
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+void cast_close(ZdkCast * cast) {
+    if (!cast) return;
+
+    fclose(cast->f);
+    free(cast->record.data);
+    free(cast->pixels);
+    free(cast->colours);
+#ifdef ZDK_PACKED_CELLS
+    free(cast->screen_pixels);
+    free(cast->screen_colours);
+#endif
+    free(cast);
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+ZdkCastReader * cast_open(const char * file_name) {
+    FILE * f = fopen(file_name, "rb");
+    char magic[CAST_MAGIC_LEN];
+
+    if (!f) return NULL;
+
+    if (fread(magic, 1, CAST_MAGIC_LEN, f) != CAST_MAGIC_LEN || memcmp(magic, CAST_MAGIC, CAST_MAGIC_LEN) != 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    ZdkCastReader * reader = calloc(1, sizeof(ZdkCastReader));
+
+    if (!reader) {
+        fclose(f);
+        return NULL;
+    }
+
+    reader->f = f;
+    return reader;
+}
+
+/*
+**	Cursor used to decode the payload of one record. A read past the end
+**	of the payload sets the error flag and yields zero.
+*/
+typedef struct Cursor {
+    const unsigned char * data;
+    size_t length;
+    size_t pos;
+    bool error;
+} Cursor;
+
+static unsigned char get_byte(Cursor * c) {
+    if (c->pos >= c->length) {
+        c->error = true;
+        return 0;
+    }
+
+    return c->data[c->pos++];
+}
+
+static unsigned long get_varint(Cursor * c) {
+    unsigned long value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        unsigned char byte = get_byte(c);
+        value |= (unsigned long)(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80)) break;
+    }
+
+    return value;
+}
+
+static double get_time(Cursor * c) {
+    uint64_t bits = 0;
+    double time;
+
+    for (int i = 0; i < 8; i++) {
+        bits |= (uint64_t)get_byte(c) << (8 * i);
+    }
+
+    memcpy(&time, &bits, sizeof(time));
+    return time;
+}
+
+/*
+**	Helper function which reads a varint directly from a stream.
+*/
+static bool read_varint(FILE * f, unsigned long * value) {
+    *value = 0;
+
+    for (int shift = 0; shift < 64; shift += 7) {
+        int byte = fgetc(f);
+
+        if (byte == EOF) return false;
+
+        *value |= (unsigned long)(byte & 0x7f) << shift;
+
+        if (!(byte & 0x80)) return true;
+    }
+
+    return false;
+}
+
+/*
+**	Helper function which decodes a keyframe into the reader's frame.
+*/
+static bool read_keyframe(ZdkCastReader * reader, Cursor * c) {
+    unsigned long file_width = get_varint(c);
+    unsigned long file_height = get_varint(c);
+
+    // The sizes come from the file, so they are checked before any
+    // arithmetic is done with them.
+    if (c->error || file_width == 0 || file_height == 0
+        || file_width > CAST_MAX_SIDE || file_height > CAST_MAX_SIDE) return false;
+
+    int width = (int)file_width;
+    int height = (int)file_height;
+    size_t cells = (size_t)width * height;
+
+    if (cells > SIZE_MAX / sizeof(int)) return false;
+
+    if (width != reader->width || height != reader->height) {
+        free(reader->pixels);
+        free(reader->colours);
+        reader->pixels = malloc(cells);
+        reader->colours = malloc(cells * sizeof(int));
+        reader->width = reader->height = 0;
+
+        if (!reader->pixels || !reader->colours) return false;
+
+        reader->width = width;
+        reader->height = height;
+    }
+
+    int n = (int)cells;
+
+    for (int i = 0; i < n; ) {
+        unsigned long count = get_varint(c);
+        char value = get_byte(c);
+        int colour = get_varint(c);
+
+        if (c->error || count == 0 || count > (unsigned long)(n - i)) return false;
+
+        memset(reader->pixels + i, value, count);
+
+        for (unsigned long k = 0; k < count; k++) {
+            reader->colours[i++] = colour;
+        }
+    }
+
+    return true;
+}
+
+/*
+**	Helper function which applies a delta to the reader's frame.
+*/
+static bool read_delta(ZdkCastReader * reader, Cursor * c) {
+    unsigned long n = (unsigned long)reader->width * reader->height;
+    unsigned long pos = 0;
+
+    if (n == 0) return false;
+
+    while (c->pos < c->length) {
+        pos += get_varint(c);
+        unsigned long len = get_varint(c);
+        int colour = get_varint(c);
+
+        if (c->error || len > n || pos > n - len || len > c->length - c->pos) return false;
+
+        memcpy(reader->pixels + pos, c->data + c->pos, len);
+        c->pos += len;
+
+        for (unsigned long k = 0; k < len; k++) {
+            reader->colours[pos++] = colour;
+        }
+    }
+
+    return true;
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+CastEventType cast_read(ZdkCastReader * reader, CastEvent * event) {
+    memset(event, 0, sizeof(*event));
+    event->type = CAST_ERROR;
+
+    int type = fgetc(reader->f);
+    unsigned long length;
+
+    if (type == EOF) {
+        return event->type = CAST_END;
+    }
+
+    if (!read_varint(reader->f, &length)) return event->type;
+
+    reader->record.length = 0;
+
+    if (!buffer_reserve(&reader->record, length)) return event->type;
+
+    if (fread(reader->record.data, 1, length, reader->f) != length) return event->type;
+
+    Cursor c = { reader->record.data, length, 0, false };
+    event->time = get_time(&c);
+
+    if (type == 'C') {
+        unsigned long code = get_varint(&c);
+        event->char_code = (int)(code >> 1) ^ -(int)(code & 1);
+        event->type = c.error ? CAST_ERROR : CAST_CHAR;
+    }
+    else if (type == 'K' || type == 'D') {
+        bool ok = !c.error && (type == 'K' ? read_keyframe(reader, &c) : read_delta(reader, &c));
+
+        if (ok) {
+            event->type = CAST_FRAME;
+            event->width = reader->width;
+            event->height = reader->height;
+            event->pixels = reader->pixels;
+            event->colours = reader->colours;
+        }
+    }
+
+    return event->type;
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+void cast_close_reader(ZdkCastReader * reader) {
+    if (!reader) return;
+
+    fclose(reader->f);
+    free(reader->record.data);
+    free(reader->pixels);
+    free(reader->colours);
+    free(reader);
+}
+
+/*
+**	See cab202_cast.h for documentation.
+*/
+bool cast_to_text(ZdkCastReader * reader, FILE * f) {
+    CastEvent event;
+
+    while (cast_read(reader, &event) != CAST_END) {
+        if (event.type == CAST_ERROR) {
+            return false;
+        }
+        else if (event.type == CAST_CHAR) {
+            fprintf(f, "Char(%d,%f)\n", event.char_code, event.time);
+        }
+        else {
+            fprintf(f, "Frame(%d,%d,%f)\n", event.width, event.height, event.time);
+
+            for (int y = 0; y < event.height; y++) {
+                fwrite(event.pixels + y * event.width, 1, event.width, f);
+                fputc('\n', f);
+            }
+
+            fprintf(f, "EndFrame\n");
+        }
+    }
+
+    return true;
+}
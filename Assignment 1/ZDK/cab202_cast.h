@@ -0,0 +1,181 @@
+/*
+*    cab202_cast.h
+*
+*    Compact binary screen-cast recording and playback for the ZDK.
+*
+*    A cast file records the sequence of screens displayed by a program,
+*    together with the keystrokes it received. The first frame, and every
+*    CAST_KEYFRAME_INTERVAL frames thereafter, is stored as a run-length
+*    encoded keyframe. Other frames are stored as deltas which contain only
+*    the runs of cells that changed since the previous frame. Every record
+*    carries the time at which it was written, as given by get_current_time().
+*
+*    File layout (all integers are unsigned LEB128 varints unless noted):
+*
+*        "ZDKCAST1"                      8-byte magic number.
+*        record*                         Zero or more records.
+*
+*        record:     type (1 byte), payload length, payload.
+*
+*        'K' payload: time (8-byte little-endian double), width, height,
+*                     then (count, char (1 byte), colour) runs covering all
+*                     width * height cells in row-major order. Readers
+*                     reject a width or height over 4096.
+*
+*        'D' payload: time, then (skip, length, colour, char * length) runs.
+*                     skip is the number of unchanged cells between the end
+*                     of the previous run and the start of this one.
+*
+*        'C' payload: time, then the zigzag-encoded key code.
+*
+*    Colours are stored as they appear in Screen.colours of the unpacked
+*    layout, regardless of the layout used by the program.
+*
+*    $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#ifndef CAST_H_
+#define CAST_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include "cab202_graphics.h"
+
+/*
+**    Number of frames between keyframes.
+*/
+#define CAST_KEYFRAME_INTERVAL (250)
+
+/*
+**    A cast being written. The structure is private to cab202_cast.c.
+*/
+typedef struct ZdkCast ZdkCast;
+
+/*
+**    A cast being read. The structure is private to cab202_cast.c.
+*/
+typedef struct ZdkCastReader ZdkCastReader;
+
+/*
+**    Kinds of event returned by cast_read().
+*/
+typedef enum CastEventType {
+    CAST_END,
+    CAST_FRAME,
+    CAST_CHAR,
+    CAST_ERROR,
+} CastEventType;
+
+/*
+**    An event read from a cast.
+**
+**    Members:
+**        type - The kind of event.
+**
+**        time - The time at which the event was recorded.
+**
+**        char_code - For CAST_CHAR events, the key code.
+**
+**        width, height, pixels, colours - For CAST_FRAME events, the
+**            dimensions and content of the reconstructed frame. The cell at
+**            (x,y) is pixels[y * width + x]. These arrays belong to the
+**            reader and remain valid until the next call to cast_read().
+*/
+typedef struct CastEvent {
+    CastEventType type;
+    double time;
+    int char_code;
+    int width;
+    int height;
+    const char * pixels;
+    const int * colours;
+} CastEvent;
+
+/**
+ *    Creates a new cast file, replacing any existing file of that name.
+ *
+ *    Input:
+ *        file_name - The name of the file.
+ *
+ *    Output: Returns the address of a new cast, or NULL if the file could
+ *        not be created.
+ */
+ZdkCast * cast_create(const char * file_name);
+
+/**
+ *    Appends a frame to a cast. The frame is stored as a keyframe if it is
+ *    the first, if its size differs from the previous frame, or if
+ *    CAST_KEYFRAME_INTERVAL frames have passed since the last keyframe.
+ *    Otherwise only the cells which changed are stored.
+ *
+ *    Input:
+ *        cast - The address of a cast.
+ *
+ *        width, height - The dimensions of the frame.
+ *
+ *        pixels, colours - Row-major arrays of width * height characters
+ *            and colours.
+ *
+ *        time - The time stamp of the frame.
+ *
+ *    Output: void.
+ */
+void cast_write_frame(ZdkCast * cast, int width, int height, const char * pixels, const int * colours, double time);
+
+/**
+ *    Appends the contents of a Screen to a cast. See cast_write_frame().
+ */
+void cast_write_screen(ZdkCast * cast, Screen * screen, double time);
+
+/**
+ *    Appends a key event to a cast.
+ */
+void cast_write_char(ZdkCast * cast, int char_code, double time);
+
+/**
+ *    Writes any buffered records of a cast to its file.
+ */
+void cast_flush(ZdkCast * cast);
+
+/**
+ *    Flushes and closes a cast, and releases all resources associated with it.
+ */
+void cast_close(ZdkCast * cast);
+
+/**
+ *    Opens a cast file for reading.
+ *
+ *    Output: Returns the address of a new reader, or NULL if the file could
+ *        not be opened or is not a cast.
+ */
+ZdkCastReader * cast_open(const char * file_name);
+
+/**
+ *    Reads the next event from a cast.
+ *
+ *    Input:
+ *        reader - The address of a reader.
+ *        event - The address of a CastEvent which receives the event.
+ *
+ *    Output: Returns event->type.
+ */
+CastEventType cast_read(ZdkCastReader * reader, CastEvent * event);
+
+/**
+ *    Closes a cast reader and releases all resources associated with it.
+ */
+void cast_close_reader(ZdkCastReader * reader);
+
+/**
+ *    Converts a cast to the text format written by auto_save_screen(), that
+ *    is, a sequence of Frame(...) ... EndFrame and Char(...) records.
+ *
+ *    Input:
+ *        reader - The address of a reader positioned at the start of a cast.
+ *        f - The stream to which the text is written.
+ *
+ *    Output: Returns true if and only if the entire cast was converted.
+ */
+bool cast_to_text(ZdkCastReader * reader, FILE * f);
+
+#endif /* CAST_H_ */
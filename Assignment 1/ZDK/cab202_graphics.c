@@ -18,7 +18,12 @@
 #include <signal.h>
 #include <curses.h>
 #include <assert.h>
+#include <ctype.h>
 #include "cab202_graphics.h"
+#include "cab202_backend.h"
+#include "cab202_cast.h"
+#include "cab202_kernels.h"
+#include "cab202_recorder.h"
 #include "cab202_timers.h"
 
 #define ABS(x)	 (((x) >= 0) ? (x) : -(x))
@@ -27,35 +32,43 @@
 #define SIGN(x)	 (((x) > 0) - ((x) < 0))
 
  // Global variables to support automated testing.
-FILE * zdk_save_stream = NULL;
 FILE * zdk_input_stream = NULL;
-bool zdk_suppress_output = false;
 
 // Private helper functions.
-static void save_screen_(FILE * f);
+static void save_screen_(ZdkContext * ctx, FILE * f);
 static void destroy_screen(Screen * scr);
 static void save_char(int char_code);
+static void clear_spans(RowSpan * spans, int width, int height);
+static void fill_spans(RowSpan * spans, int width, int height);
+static void reset_tags(Screen * scr);
+static void count_tags(Screen * scr);
+static void restore_labels(ZdkContext * ctx);
+static void update_labels(ZdkContext * ctx);
+static void destroy_labels(ZdkContext * ctx);
 
 /*
- *	Screen buffers. The most recent screen displayed by show_screen
- *	remains in zdk_prev_screen until the next call to show_screen. The
- *	data that will appear next time show_screen is called is stored
- *	in zdk_screen.
+ *	The default context, which holds the screen buffers and drawing state
+ *	used by every function that does not take a context. The most recent
+ *	screen displayed by show_screen remains in zdk_prev_screen until the
+ *	next call to show_screen. The data that will appear next time
+ *	show_screen is called is stored in zdk_screen.
  *
  *	Applications can check these objects for example, to see if a
  *	character has changed, or if something else is already present
  *	at a location.
  */
-Screen * zdk_screen = NULL;
-Screen * zdk_prev_screen = NULL;
-
-/*
- * The current foreground and background colour.
- */
-static int foreground = WHITE;
-static int background = BLACK;
-static int colour_flags = 0;
-static int colour_num = 0;
+ZdkContext zdk_default_context = {
+    .backend = &zdk_null_backend,
+    .foreground = WHITE,
+    .background = BLACK,
+    .draw_tag = ZDK_TAG_FREE,
+    .emitted_attr = -1,
+    .cursor_x = -1,
+    .cursor_y = -1,
+};
+
+// Maximum number of unchanged cells that may be bridged within a span.
+#define SPAN_GAP (4)
 
 /*
 **	Helper function which gets the colour number corresponding to a designated
@@ -87,111 +100,171 @@ static int colour_index(int fg, int bg) {
 **		Returns a unique non-zero integer which represents the colour combination.
 */
 
-static void update_colour_num(void) {
-    int pair = COLOR_PAIR(colour_index(foreground, background));
+static void update_colour_num(ZdkContext * ctx) {
+    int pair = COLOR_PAIR(colour_index(ctx->foreground, ctx->background));
 
-    if (colour_flags & BRIGHT) {
+    if (ctx->colour_flags & BRIGHT) {
         pair |= A_BOLD;
     }
 
-    if (colour_flags & INVERSE) {
+    if (ctx->colour_flags & INVERSE) {
         pair |= A_REVERSE;
     }
 
-    colour_num = pair;
+    ctx->colour_num = pair;
 
     // colour_num = colour_index(foreground, background);
+
+#ifdef ZDK_PACKED_CELLS
+    ctx->colour_bits = zdk_pack_cell(0, ctx->colour_num);
+#endif
 }
 
+#ifdef ZDK_PACKED_CELLS
+
+/*
+**	Packed cell layout:
+**
+**		bits 0-7:	character code.
+**		bits 8-13:	colour pair number - 1, that is, bg * NUM_COLOURS + fg.
+**		bit 14:		A_BOLD.
+**		bit 15:		A_REVERSE.
+**
+**	Colour pair 0 (the terminal default, which the ZDK never selects once
+**	colours are set) is stored as white on black.
+*/
+
+#define CELL_PAIR_MASK (0x3f)
+#define CELL_BOLD (0x40)
+#define CELL_REVERSE (0x80)
+
 /*
 **	See graphics.h for documentation.
 */
-void set_background(int colour) {
-    background = colour & (NUM_COLOURS - 1);
-    update_colour_num();
+ZdkCell zdk_pack_cell(char value, int colour) {
+    int pair = PAIR_NUMBER(colour);
+    int bits = (pair > 0 ? pair : colour_index(WHITE, BLACK)) - 1;
+
+    if (colour & A_BOLD) bits |= CELL_BOLD;
+    if (colour & A_REVERSE) bits |= CELL_REVERSE;
+
+    return (ZdkCell)((bits << 8) | (unsigned char)value);
 }
 
 /*
 **	See graphics.h for documentation.
 */
-void set_foreground(int colour) {
-    foreground = colour & (NUM_COLOURS - 1);
-    colour_flags = colour & (TRANSPARENT | INVERSE | BRIGHT);
-    update_colour_num();
+int zdk_cell_colour(ZdkCell cell) {
+    int bits = cell >> 8;
+    int colour = COLOR_PAIR((bits & CELL_PAIR_MASK) + 1);
+
+    if (bits & CELL_BOLD) colour |= A_BOLD;
+    if (bits & CELL_REVERSE) colour |= A_REVERSE;
+
+    return colour;
 }
 
+/*
+**	Helper function which gets the address of the first cell in row y.
+*/
+static inline ZdkCell * cell_row(Screen * scr, int y) {
+    return scr->cells + (size_t)y * scr->width;
+}
+
+#endif
+
 /*
 **	See graphics.h for documentation.
 */
-void set_colours(int foreground_, int background_) {
-    background = background_ & (NUM_COLOURS - 1);
-    foreground = foreground_ & (NUM_COLOURS - 1);
-    colour_flags = foreground_ & (TRANSPARENT | INVERSE | BRIGHT);
-    update_colour_num();
+void zdk_set_background(ZdkContext * ctx, int colour) {
+    ctx->background = colour & (NUM_COLOURS - 1);
+    update_colour_num(ctx);
 }
 
 /*
 **	See graphics.h for documentation.
 */
-void get_colours(int *foreground_, int *background_) {
-    *background_ = background;
-    *foreground_ = foreground | colour_flags;
+void zdk_set_foreground(ZdkContext * ctx, int colour) {
+    ctx->foreground = colour & (NUM_COLOURS - 1);
+    ctx->colour_flags = colour & (TRANSPARENT | INVERSE | BRIGHT);
+    update_colour_num(ctx);
 }
 
 /*
 **	See graphics.h for documentation.
 */
-int get_background(void) {
-    return background;
+void zdk_set_colours(ZdkContext * ctx, int foreground_, int background_) {
+    ctx->background = background_ & (NUM_COLOURS - 1);
+    ctx->foreground = foreground_ & (NUM_COLOURS - 1);
+    ctx->colour_flags = foreground_ & (TRANSPARENT | INVERSE | BRIGHT);
+    update_colour_num(ctx);
 }
 
 /*
 **	See graphics.h for documentation.
 */
-int get_foreground(void) {
-    return foreground | colour_flags;
+void zdk_set_draw_tag(ZdkContext * ctx, int tag) {
+    assert(tag >= 0 && tag < ZDK_NUM_TAGS);
+    ctx->draw_tag = tag;
 }
 
 /*
 **	See graphics.h for documentation.
 */
-void setup_screen(void) {
-    if (!zdk_suppress_output) {
-        // Enter curses mode.
-        initscr();
-        start_color();
-
-        // Set up a colour pair for each terminal colour.
-        // The default background colour is black. 
-        for (int fg = 0; fg < NUM_COLOURS; fg++) {
-            for (int bg = 0; bg < NUM_COLOURS; bg++) {
-                init_pair(colour_index(fg, bg), fg, bg);
-            }
-        }
+int zdk_get_draw_tag(ZdkContext * ctx) {
+    return ctx->draw_tag;
+}
 
-        foreground = COLOR_WHITE;
-        background = COLOR_BLACK;
-        update_colour_num();
-        bkgd(colour_num);
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_get_colours(ZdkContext * ctx, int *foreground_, int *background_) {
+    *background_ = ctx->background;
+    *foreground_ = ctx->foreground | ctx->colour_flags;
+}
 
-        // Do not echo keypresses.
-        noecho();
+/*
+**	See graphics.h for documentation.
+*/
+int zdk_get_background(ZdkContext * ctx) {
+    return ctx->background;
+}
 
-        // Turn off the cursor.
-        curs_set(0);
+/*
+**	See graphics.h for documentation.
+*/
+int zdk_get_foreground(ZdkContext * ctx) {
+    return ctx->foreground | ctx->colour_flags;
+}
 
-        // Cause getch to return ERR if no key pressed within 0 milliseconds.
-        timeout(0);
+/*
+**	See graphics.h for documentation.
+*/
+void setup_screen(void) {
+    ZdkContext * ctx = &zdk_default_context;
 
-        // Enable the keypad.
-        keypad(stdscr, TRUE);
+    if (!ctx->suppress_output) {
+        const ZdkBackend * backend = zdk_backend;
 
-        // Turn on mouse reporting.
-        mousemask(ALL_MOUSE_EVENTS, NULL);
+        if (!backend) backend = zdk_find_backend(getenv("ZDK_BACKEND"));
 
-        // Erase any previous content that may be lingering in this screen.
-        clear();
+        ctx->backend = backend ? backend : &zdk_curses_backend;
+
+        // The default background colour is black.
+        ctx->foreground = COLOR_WHITE;
+        ctx->background = COLOR_BLACK;
+        update_colour_num(ctx);
+
+        if (!ctx->backend->open(ctx->colour_num)) {
+            ctx->backend = &zdk_null_backend;
+        }
     }
+    else {
+        ctx->backend = &zdk_null_backend;
+    }
+
+    // The terminal attribute is unknown until the first span is emitted.
+    ctx->emitted_attr = -1;
 
     // Create buffers
     fit_screen_to_window();
@@ -222,10 +295,9 @@ void ctrl_c_handler(int signal_code) {
 **	See graphics.h for documentation.
 */
 void cleanup_screen(void) {
-    if (!zdk_suppress_output) {
-        // cleanup curses.
-        endwin();
-    }
+    // Restore the terminal.
+    zdk_default_context.backend->close();
+    zdk_default_context.backend = &zdk_null_backend;
 
     // cleanup the drawing buffers.
     destroy_screen(zdk_screen);
@@ -234,96 +306,587 @@ void cleanup_screen(void) {
     destroy_screen(zdk_prev_screen);
     zdk_prev_screen = NULL;
 
-    // Close the screen-cast file, if open.
+    destroy_labels(&zdk_default_context);
+
+    // Write any queued frames, then close the screen-cast file, if open.
+    recorder_stop();
+
     if (zdk_save_stream) {
         fflush(zdk_save_stream);
         fclose(zdk_save_stream);
         zdk_save_stream = NULL;
     }
 
+    cast_close(zdk_cast_stream);
+    zdk_cast_stream = NULL;
+
     // Null the input file (somebody else is responsible for its life cycle).
     if (zdk_save_stream) {
         zdk_input_stream = NULL;
     }
 }
 
+/*
+**	Helper function which widens the dirty and ink spans of row y to include
+**	columns x0 to x1, inclusive.
+**
+**	PRE: 0 <= y < scr->height AND 0 <= x0 <= x1 < scr->width.
+*/
+static inline void mark_cells(Screen * scr, int y, int x0, int x1) {
+    RowSpan * dirty = &scr->dirty[y];
+    RowSpan * ink = &scr->ink[y];
+
+    if (x0 < dirty->min) dirty->min = x0;
+    if (x1 > dirty->max) dirty->max = x1;
+    if (x0 < ink->min) ink->min = x0;
+    if (x1 > ink->max) ink->max = x1;
+}
+
+/*
+**	Helper function which sets the tags of columns x0 to x1, inclusive, of
+**	row y and keeps the row's tag counts up to date.
+**
+**	PRE: 0 <= y < scr->height AND 0 <= x0 <= x1 < scr->width.
+*/
+static inline void tag_cells(Screen * scr, int y, int x0, int x1, int tag) {
+    int * counts = scr->tag_counts + y * ZDK_NUM_TAGS;
+
+    // Nothing changes if the whole row already carries the tag, which is
+    // the usual case when drawing with ZDK_TAG_FREE.
+    if (counts[tag] == scr->width) return;
+
+    uint8_t * row = scr->tags + y * scr->width;
+
+    for (int x = x0; x <= x1; x++) {
+        counts[row[x]]--;
+    }
+
+    memset(row + x0, tag, x1 - x0 + 1);
+    counts[tag] += x1 - x0 + 1;
+}
+
 /*
 **	See graphics.h for documentation.
 */
-void clear_screen(void) {
-    if (zdk_screen != NULL) {
-        int w = zdk_screen->width;
-        int h = zdk_screen->height;
+void zdk_clear_screen(ZdkContext * ctx) {
+    if (ctx->screen != NULL) {
+        int w = ctx->screen->width;
+        int h = ctx->screen->height;
 
-        set_foreground(WHITE);
+        zdk_set_foreground(ctx, WHITE);
 
-        char * scr = zdk_screen->pixels[0];
-        int * colours = zdk_screen->colours[0];
+#ifdef ZDK_PACKED_CELLS
+        zdk_fill16(ctx->screen->cells, ctx->colour_bits | ' ', w * h);
+#endif
+        char * scr = ctx->screen->pixels[0];
+        int * colours = ctx->screen->colours[0];
 
         memset(scr, ' ', w * h);
+        zdk_fill32((uint32_t *)colours, ctx->colour_num, w * h);
 
-        for (int i = 0; i < w*h; i++) {
-            colours[i] = colour_num;
+        // Cells outside the ink span were already blank, so they can only
+        // have changed if the blank colour has changed.
+        if (ctx->colour_num != ctx->screen->fill_colour) {
+            fill_spans(ctx->screen->dirty, w, h);
         }
+        else {
+            for (int y = 0; y < h; y++) {
+                RowSpan * dirty = &ctx->screen->dirty[y];
+                RowSpan * ink = &ctx->screen->ink[y];
+                dirty->min = MIN(dirty->min, ink->min);
+                dirty->max = MAX(dirty->max, ink->max);
+            }
+        }
+
+        clear_spans(ctx->screen->ink, w, h);
+        ctx->screen->fill_colour = ctx->colour_num;
+        reset_tags(ctx->screen);
+        restore_labels(ctx);
     }
 }
 
+/*
+**	A copy of a screen, from which clear_screen_to() starts a frame.
+*/
+struct ZdkBackground {
+    int width;
+    int height;
+    int fill_colour;
+#ifdef ZDK_PACKED_CELLS
+    ZdkCell * cells;
+#endif
+    char * pixels;
+    int * colours;
+    RowSpan * ink;
+    uint8_t * tags;
+    int * tag_counts;
+};
+
 /*
 **	See graphics.h for documentation.
 */
-void show_screen(void) {
+ZdkBackground * zdk_save_background(ZdkContext * ctx) {
+    Screen * scr = ctx->screen;
+
+    if (!scr) return NULL;
+
+    size_t cells = (size_t)scr->width * scr->height;
+    ZdkBackground * background = calloc(1, sizeof(ZdkBackground));
+
+    if (!background) return NULL;
+
+    background->width = scr->width;
+    background->height = scr->height;
+    background->fill_colour = scr->fill_colour;
+#ifdef ZDK_PACKED_CELLS
+    background->cells = malloc(cells * sizeof(ZdkCell));
+#endif
+    background->pixels = malloc(cells);
+    background->colours = malloc(cells * sizeof(int));
+    background->ink = malloc(scr->height * sizeof(RowSpan));
+    background->tags = malloc(cells);
+    background->tag_counts = malloc(scr->height * ZDK_NUM_TAGS * sizeof(int));
+
+    bool allocated = background->pixels && background->colours;
+#ifdef ZDK_PACKED_CELLS
+    allocated = allocated && background->cells;
+#endif
+
+    if (!allocated || !background->ink || !background->tags || !background->tag_counts) {
+        destroy_background(background);
+        return NULL;
+    }
+
+#ifdef ZDK_PACKED_CELLS
+    memcpy(background->cells, scr->cells, cells * sizeof(ZdkCell));
+#endif
+    memcpy(background->pixels, scr->pixels[0], cells);
+    memcpy(background->colours, scr->colours[0], cells * sizeof(int));
+    memcpy(background->ink, scr->ink, scr->height * sizeof(RowSpan));
+    memcpy(background->tags, scr->tags, cells);
+    memcpy(background->tag_counts, scr->tag_counts, scr->height * ZDK_NUM_TAGS * sizeof(int));
+    return background;
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+bool zdk_clear_screen_to(ZdkContext * ctx, const ZdkBackground * background) {
+    Screen * scr = ctx->screen;
+
+    if (!scr || !background || background->width != scr->width || background->height != scr->height) {
+        zdk_clear_screen(ctx);
+        return false;
+    }
+
+    int w = scr->width;
+    int h = scr->height;
+    size_t cells = (size_t)w * h;
+
+    zdk_set_foreground(ctx, WHITE);
+
+#ifdef ZDK_PACKED_CELLS
+    memcpy(scr->cells, background->cells, cells * sizeof(ZdkCell));
+#endif
+    memcpy(scr->pixels[0], background->pixels, cells);
+    memcpy(scr->colours[0], background->colours, cells * sizeof(int));
+
+    // Cells outside both the old ink and the ink of the background were,
+    // and still are, blank.
+    if (background->fill_colour != scr->fill_colour) {
+        fill_spans(scr->dirty, w, h);
+    }
+    else {
+        for (int y = 0; y < h; y++) {
+            RowSpan * dirty = &scr->dirty[y];
+            dirty->min = MIN(dirty->min, MIN(scr->ink[y].min, background->ink[y].min));
+            dirty->max = MAX(dirty->max, MAX(scr->ink[y].max, background->ink[y].max));
+        }
+    }
+
+    memcpy(scr->ink, background->ink, h * sizeof(RowSpan));
+    scr->fill_colour = background->fill_colour;
+    memcpy(scr->tags, background->tags, cells);
+    memcpy(scr->tag_counts, background->tag_counts, h * ZDK_NUM_TAGS * sizeof(int));
+    restore_labels(ctx);
+    return true;
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void destroy_background(ZdkBackground * background) {
+    if (!background) return;
+
+#ifdef ZDK_PACKED_CELLS
+    free(background->cells);
+#endif
+    free(background->pixels);
+    free(background->colours);
+    free(background->ink);
+    free(background->tags);
+    free(background->tag_counts);
+    free(background);
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_invalidate_screen(ZdkContext * ctx) {
+    if (ctx->screen != NULL) {
+#ifdef ZDK_PACKED_CELLS
+        // pixels and colours may have been written directly, so the cells
+        // are packed again from them.
+        Screen * scr = ctx->screen;
+
+        for (int y = 0; y < scr->height; y++) {
+            ZdkCell * row = cell_row(scr, y);
+
+            for (int x = 0; x < scr->width; x++) {
+                row[x] = zdk_pack_cell(scr->pixels[y][x], scr->colours[y][x]);
+            }
+        }
+#endif
+
+        fill_spans(ctx->screen->dirty, ctx->screen->width, ctx->screen->height);
+        fill_spans(ctx->screen->ink, ctx->screen->width, ctx->screen->height);
+    }
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_reset_render_stats(ZdkContext * ctx) {
+    memset(&ctx->render_stats, 0, sizeof(ctx->render_stats));
+}
+
+/*
+**	Span emitter used by show_screen.
+**
+**	Changed cells are sent to the backend in spans of uniform colour, with
+**	one attribute change (skipped if the colour is already current) and one
+**	string write per span. The emitter also counts the bytes which the ANSI
+**	backend writes for the same output, so that the cost of a frame can be
+**	measured with any backend.
+*/
+
+/*
+**	Helper function which selects the attribute for subsequent output,
+**	unless it is already selected.
+*/
+static void emit_attr(ZdkContext * ctx, int attr) {
+    if (attr == ctx->emitted_attr) return;
+
+    char sgr[ZDK_ANSI_SEQ_MAX];
+    int len = zdk_ansi_attr(sgr, ctx->emitted_attr, attr);
+    ctx->emitted_attr = attr;
+    ctx->render_stats.attr_changes++;
+    ctx->render_stats.bytes += len;
+    ctx->backend->set_attr(attr, sgr, len);
+}
+
+/*
+**	Helper function which writes len characters at (x,y) in the current
+**	attribute.
+*/
+static void emit_span(ZdkContext * ctx, int y, int x, const char * text, int len) {
+    if (y != ctx->cursor_y || x != ctx->cursor_x) {
+        char cup[ZDK_ANSI_SEQ_MAX];
+        int cup_len = zdk_ansi_move(cup, ctx->cursor_y, ctx->cursor_x, y, x);
+        ctx->render_stats.bytes += cup_len;
+        ctx->backend->move_cursor(y, x, cup, cup_len);
+    }
+
+    ctx->render_stats.spans++;
+    ctx->render_stats.bytes += len;
+    ctx->backend->write_text(text, len);
+    ctx->cursor_y = y;
+    ctx->cursor_x = x + len;
+
+    // A terminal leaves the cursor in an uncertain place after writing to
+    // the last column.
+    if (ctx->cursor_x >= ctx->screen->width) {
+        ctx->cursor_x = ctx->cursor_y = -1;
+    }
+}
+
+#ifdef ZDK_PACKED_CELLS
+
+/*
+**	Helper function which emits the changed cells in columns x to x_max of
+**	row y, and copies them into ctx->prev_screen.
+**
+**	Output:
+**		Returns true if and only if any cell was emitted.
+*/
+static bool show_row(ZdkContext * ctx, int y, int x, int x_max) {
+    ZdkCell * front = cell_row(ctx->screen, y);
+    ZdkCell * back = cell_row(ctx->prev_screen, y);
+    char text[x_max - x + 1];
+    bool changed = false;
+    int first, last;
+
+    // Narrow the span to the first and last cells which actually differ.
+    if (!zdk_diff16(front + x, back + x, x_max - x + 1, &first, &last)) {
+        return false;
+    }
+
+    x_max = x + last;
+    x += first;
+
+    while (x <= x_max) {
+        if (front[x] == back[x]) {
+            x++;
+            continue;
+        }
+
+        // Grow a span of cells sharing the colour of the first changed
+        // cell. Short runs of unchanged cells are bridged, because
+        // rewriting them is cheaper than moving the cursor.
+        int start = x;
+        int last_changed = x;
+        ZdkCell colour = front[x] & 0xff00;
+        text[0] = (char)front[x];
+        ctx->render_stats.cells_emitted++;
+
+        for (x++; x <= x_max && (front[x] & 0xff00) == colour && (front[x] & 0xff) != 0; x++) {
+            text[x - start] = (char)front[x];
+
+            if (front[x] != back[x]) {
+                last_changed = x;
+                ctx->render_stats.cells_emitted++;
+            }
+            else if (x - last_changed > SPAN_GAP) {
+                break;
+            }
+        }
+
+        int len = last_changed - start + 1;
+
+        // Send changed char data to terminal.
+        emit_attr(ctx, zdk_cell_colour(colour));
+        emit_span(ctx, y, start, text, len);
+
+        // Save new char data in back buffer, and in its compatibility
+        // planes.
+        memcpy(back + start, front + start, len * sizeof(ZdkCell));
+        memcpy(ctx->prev_screen->pixels[y] + start, ctx->screen->pixels[y] + start, len);
+        memcpy(ctx->prev_screen->colours[y] + start, ctx->screen->colours[y] + start, len * sizeof(int));
+        changed = true;
+        x = last_changed + 1;
+    }
+
+    return changed;
+}
+
+#else
+
+/*
+**	Helper function which emits the changed cells in columns x to x_max of
+**	row y, and copies them into ctx->prev_screen.
+**
+**	Output:
+**		Returns true if and only if any cell was emitted.
+*/
+static bool show_row(ZdkContext * ctx, int y, int x, int x_max) {
+    char * front_row = ctx->screen->pixels[y];
+    int * front_colour_row = ctx->screen->colours[y];
+    char * back_row = ctx->prev_screen->pixels[y];
+    int * back_colour_row = ctx->prev_screen->colours[y];
+    bool changed = false;
+    int n = x_max - x + 1;
+    int first = n, last = -1;
+    int first_colour, last_colour;
+
+    // Narrow the span to the first and last cells which actually differ.
+    zdk_diff8((uint8_t *)front_row + x, (uint8_t *)back_row + x, n, &first, &last);
+
+    if (zdk_diff32((uint32_t *)front_colour_row + x, (uint32_t *)back_colour_row + x, n, &first_colour, &last_colour)) {
+        first = MIN(first, first_colour);
+        last = MAX(last, last_colour);
+    }
+
+    if (last < 0) {
+        return false;
+    }
+
+    x_max = x + last;
+    x += first;
+
+    while (x <= x_max) {
+        if (front_row[x] == back_row[x] && front_colour_row[x] == back_colour_row[x]) {
+            x++;
+            continue;
+        }
+
+        // Grow a span of cells sharing the colour of the first changed
+        // cell. Short runs of unchanged cells are bridged, because
+        // rewriting them is cheaper than moving the cursor.
+        int start = x;
+        int last_changed = x;
+        int colour = front_colour_row[x];
+        ctx->render_stats.cells_emitted++;
+
+        for (x++; x <= x_max && front_colour_row[x] == colour && front_row[x] != 0; x++) {
+            if (front_row[x] != back_row[x] || colour != back_colour_row[x]) {
+                last_changed = x;
+                ctx->render_stats.cells_emitted++;
+            }
+            else if (x - last_changed > SPAN_GAP) {
+                break;
+            }
+        }
+
+        int len = last_changed - start + 1;
+
+        // Send changed char data to terminal.
+        emit_attr(ctx, colour);
+        emit_span(ctx, y, start, front_row + start, len);
+
+        // Save new char data in back buffer.
+        memcpy(back_row + start, front_row + start, len);
+        memcpy(back_colour_row + start, front_colour_row + start, len * sizeof(int));
+        changed = true;
+        x = last_changed + 1;
+    }
+
+    return changed;
+}
+
+#endif
+
+/*
+**	Helper function which makes every cell of prev_screen differ from the
+**	corresponding cell of screen, so that show_screen emits the whole
+**	screen. Used after the backend has lost output, when the terminal no
+**	longer matches prev_screen.
+*/
+static void forget_screen(ZdkContext * ctx) {
+    int w = ctx->screen->width;
+    int h = ctx->screen->height;
+
+    for (int y = 0; y < h; y++) {
+#ifdef ZDK_PACKED_CELLS
+        ZdkCell * front = cell_row(ctx->screen, y);
+        ZdkCell * back = cell_row(ctx->prev_screen, y);
+
+        for (int x = 0; x < w; x++) back[x] = ~front[x];
+#else
+        for (int x = 0; x < w; x++) ctx->prev_screen->colours[y][x] = ~ctx->screen->colours[y][x];
+#endif
+    }
+
+    fill_spans(ctx->screen->dirty, w, h);
+    ctx->emitted_attr = -1;
+    ctx->repaint = false;
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_show_screen(ZdkContext * ctx) {
     // Draw parts of the display that are different in the front
     // buffer from the back buffer.
-    char ** back_px = zdk_prev_screen->pixels;
-    char ** front_px = zdk_screen->pixels;
-    int ** back_colour = zdk_prev_screen->colours;
-    int ** front_colour = zdk_screen->colours;
-    int w = zdk_screen->width;
-    int h = zdk_screen->height;
+    int w = ctx->screen->width;
+    int h = ctx->screen->height;
+    RowSpan * dirty = ctx->screen->dirty;
     bool changed = false;
 
-    // Check each character to see if it has changed (either in value or colour)
-    // since the last time the function was called.
+    ctx->render_stats.frames++;
+
+    // Redraw any labels whose values have changed.
+    update_labels(ctx);
+
+    if (ctx->repaint) {
+        forget_screen(ctx);
+    }
+
+    // Check each character in the dirty span of each row to see if it has
+    // changed (either in value or colour) since the last time the function
+    // was called. Cells outside the dirty spans are known to be unchanged.
+    ctx->cursor_x = ctx->cursor_y = -1;
+
     for (int y = 0; y < h; y++) {
-        for (int x = 0; x < w; x++) {
-            if (front_px[y][x] != back_px[y][x] || front_colour[y][x] != back_colour[y][x]) {
-                // Send changed char data to terminal.
-                attrset(front_colour[y][x]);
-                // color_set(COLOR_PAIR(front_colour[y][x]), NULL);
-                mvaddch(y, x, front_px[y][x]);
-
-                // Save new char data in back buffer.
-                back_px[y][x] = front_px[y][x];
-                back_colour[y][x] = front_colour[y][x];
-                changed = true;
-            }
+        if (dirty[y].min > dirty[y].max) continue;
+
+        ctx->render_stats.cells_examined += dirty[y].max - dirty[y].min + 1;
+
+        if (show_row(ctx, y, dirty[y].min, dirty[y].max)) {
+            changed = true;
         }
     }
 
+    clear_spans(dirty, w, h);
+
+    // Give the recorder a chance to queue a frame held back earlier.
+    if (ctx == &zdk_default_context) {
+        recorder_service();
+    }
+
     if (!changed) {
         return;
     }
 
-    // Save a screen shot, if automatic saves are enabled.
-    save_screen_(zdk_save_stream);
+    // Save a screen shot, if automatic saves are enabled. The recorder
+    // thread serves the default context; other contexts write directly.
+    if (ctx == &zdk_default_context) {
+        recorder_write_screen(ctx->screen, get_current_time());
+    }
+    else {
+        save_screen_(ctx, ctx->save_stream);
+        cast_write_screen(ctx->cast_stream, ctx->screen, get_current_time());
+    }
 
-    // Force an update of the curses display.
-    if (!zdk_suppress_output) {
-        refresh();
+    // Make the frame visible. If the backend lost some of it, the next
+    // frame is sent in full.
+    if (!ctx->backend->present()) {
+        ctx->repaint = true;
     }
 }
 
+/*
+**	Helper function which stores a character in the current colour at (x,y)
+**	of ctx->screen, without checking bounds.
+**
+**	PRE: ctx->screen != NULL AND (x,y) lies within ctx->screen.
+*/
+static inline void put_char(ZdkContext * ctx, int x, int y, char value) {
+#ifdef ZDK_PACKED_CELLS
+    cell_row(ctx->screen, y)[x] = ctx->colour_bits | (unsigned char)value;
+#endif
+    ctx->screen->pixels[y][x] = value;
+    ctx->screen->colours[y][x] = ctx->colour_num;
+    mark_cells(ctx->screen, y, x, x);
+    tag_cells(ctx->screen, y, x, x, ctx->draw_tag);
+}
+
+/*
+**	Helper function which stores a character in the current colour in
+**	columns x1 to x2 of row y of ctx->screen, without checking bounds.
+**
+**	PRE: ctx->screen != NULL AND 0 <= x1 <= x2 < width AND 0 <= y < height.
+*/
+static inline void put_span(ZdkContext * ctx, int x1, int x2, int y, char value) {
+    int n = x2 - x1 + 1;
+#ifdef ZDK_PACKED_CELLS
+    zdk_fill16(cell_row(ctx->screen, y) + x1, ctx->colour_bits | (unsigned char)value, n);
+#endif
+    memset(ctx->screen->pixels[y] + x1, value, n);
+    zdk_fill32((uint32_t *)ctx->screen->colours[y] + x1, ctx->colour_num, n);
+    mark_cells(ctx->screen, y, x1, x2);
+    tag_cells(ctx->screen, y, x1, x2, ctx->draw_tag);
+}
+
 /*
 **	See graphics.h for documentation.
 */
-void draw_char(int x, int y, char value) {
-    if (zdk_screen != NULL) {
-        int w = zdk_screen->width;
-        int h = zdk_screen->height;
+void zdk_draw_char(ZdkContext * ctx, int x, int y, char value) {
+    if (ctx->screen != NULL) {
+        int w = ctx->screen->width;
+        int h = ctx->screen->height;
 
         if (x >= 0 && x < w && y >= 0 && y < h) {
-            zdk_screen->pixels[y][x] = value;
-            zdk_screen->colours[y][x] = colour_num;
+            put_char(ctx, x, y, value);
         }
     }
 }
@@ -331,26 +894,60 @@ void draw_char(int x, int y, char value) {
 /*
 **	See graphics.h for documentation.
 */
-void draw_line(int x1, int y1, int x2, int y2, char value) {
-    if (x1 == x2) {
-        // Draw vertical line
-        int y_min = MIN(y1, y2);
-        int y_max = MAX(y1, y2);
+void zdk_draw_hline(ZdkContext * ctx, int x1, int x2, int y, char value) {
+    if (ctx->screen == NULL || y < 0 || y >= ctx->screen->height) return;
 
-        for (int i = y_min; i <= y_max; i++) {
-            draw_char(x1, i, value);
-        }
+    int x_min = MAX(MIN(x1, x2), 0);
+    int x_max = MIN(MAX(x1, x2), ctx->screen->width - 1);
+
+    if (x_min <= x_max) {
+        put_span(ctx, x_min, x_max, y, value);
     }
-    else if (y1 == y2) {
-        // Draw horizontal line
-        int x_min = MIN(x1, x2);
-        int x_max = MAX(x1, x2);
+}
 
-        for (int i = x_min; i <= x_max; i++) {
-            draw_char(i, y1, value);
-        }
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_draw_vline(ZdkContext * ctx, int x, int y1, int y2, char value) {
+    if (ctx->screen == NULL || x < 0 || x >= ctx->screen->width) return;
+
+    int y_min = MAX(MIN(y1, y2), 0);
+    int y_max = MIN(MAX(y1, y2), ctx->screen->height - 1);
+
+    for (int y = y_min; y <= y_max; y++) {
+        put_char(ctx, x, y, value);
     }
-    else {
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_fill_rect(ZdkContext * ctx, int left, int top, int width, int height, char value) {
+    if (ctx->screen == NULL || width <= 0 || height <= 0) return;
+
+    int x_min = MAX(left, 0);
+    int x_max = MIN(left + width - 1, ctx->screen->width - 1);
+    int y_min = MAX(top, 0);
+    int y_max = MIN(top + height - 1, ctx->screen->height - 1);
+
+    if (x_min > x_max) return;
+
+    for (int y = y_min; y <= y_max; y++) {
+        put_span(ctx, x_min, x_max, y, value);
+    }
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_draw_line(ZdkContext * ctx, int x1, int y1, int x2, int y2, char value) {
+    if (x1 == x2) {
+        zdk_draw_vline(ctx, x1, y1, y2, value);
+    }
+    else if (y1 == y2) {
+        zdk_draw_hline(ctx, x1, x2, y1, value);
+    }
+    else if (ctx->screen != NULL) {
         // Inserted to ensure that lines are always drawn in the same direction, regardless of
         // the order the endpoints are presented.
         if (x1 > x2) {
@@ -362,23 +959,39 @@ void draw_line(int x1, int y1, int x2, int y2, char value) {
             y2 = t;
         }
 
-        // Use the Bresenham algorithm to render the line.
-        // TODO: Convert to an integer-only implementation such as
-        // https://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
+        // Step the error term in float, exactly as the original draw_line
+        // did, so that every line covers the same cells as before. Where a
+        // line passes half-way between two rows, the choice of row depends
+        // on the rounding of the accumulated error, so the columns left of
+        // the screen are stepped through too, without drawing.
+        int w = ctx->screen->width;
+        int h = ctx->screen->height;
         float dx = x2 - x1;
         float dy = y2 - y1;
         float err = 0.0;
         float derr = ABS(dy / dx);
+        int step_y = SIGN(y2 - y1);
+
+        for (int x = x1, y = y1; x <= x2 && x < w; x++) {
+            bool visible = x >= 0;
+
+            if (visible && y >= 0 && y < h) {
+                put_char(ctx, x, y, value);
+            }
 
-        for (int x = x1, y = y1; (dx > 0) ? x <= x2 : x >= x2; (dx > 0) ? x++ : x--) {
-            draw_char(x, y, value);
             err += derr;
-            while (err >= 0.5 && ((dy > 0) ? y <= y2 : y >= y2)) {
-                draw_char(x, y, value);
-                y += (dy > 0) - (dy < 0);
 
+            while (err >= 0.5 && ((step_y > 0) ? y <= y2 : y >= y2)) {
+                if (visible && y >= 0 && y < h) {
+                    put_char(ctx, x, y, value);
+                }
+
+                y += step_y;
                 err -= 1.0;
             }
+
+            // Stop early once the line has left the screen vertically.
+            if ((step_y > 0 && y >= h) || (step_y < 0 && y < 0)) break;
         }
     }
 }
@@ -386,92 +999,601 @@ void draw_line(int x1, int y1, int x2, int y2, char value) {
 /*
 **	See graphics.h for documentation.
 */
-char scrape_char(int x, int y) {
+char zdk_scrape_char(ZdkContext * ctx, int x, int y) {
     if (x < 0 || y < 0 ||
-        x >= zdk_prev_screen->width ||
-        y >= zdk_prev_screen->height
+        x >= ctx->prev_screen->width ||
+        y >= ctx->prev_screen->height
         ) {
         return -1;
     }
     else {
-        return zdk_prev_screen->pixels[y][x];
+        return ZDK_PIXEL(ctx->prev_screen, x, y);
+    }
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_set_tag(ZdkContext * ctx, int x, int y, int tag) {
+    assert(tag >= 0 && tag < ZDK_NUM_TAGS);
+
+    if (ctx->screen && x >= 0 && x < ctx->screen->width && y >= 0 && y < ctx->screen->height) {
+        tag_cells(ctx->screen, y, x, x, tag);
+    }
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+int zdk_get_tag(ZdkContext * ctx, int x, int y) {
+    if (!ctx->screen || x < 0 || x >= ctx->screen->width || y < 0 || y >= ctx->screen->height) {
+        return ZDK_TAG_WALL;
+    }
+
+    return ctx->screen->tags[y * ctx->screen->width + x];
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+bool zdk_row_has_tag(ZdkContext * ctx, int y, int x1, int x2, int tag) {
+    if (!ctx->screen || y < 0 || y >= ctx->screen->height || tag < 0 || tag >= ZDK_NUM_TAGS) {
+        return false;
+    }
+
+    int w = ctx->screen->width;
+    int count = ctx->screen->tag_counts[y * ZDK_NUM_TAGS + tag];
+    int x_min = MAX(0, MIN(x1, x2));
+    int x_max = MIN(w - 1, MAX(x1, x2));
+
+    if (count == 0 || x_min > x_max) return false;
+
+    if (count == w || (x_min == 0 && x_max == w - 1)) return true;
+
+    return memchr(ctx->screen->tags + y * w + x_min, tag, x_max - x_min + 1) != NULL;
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+bool zdk_rect_has_tag(ZdkContext * ctx, int left, int top, int width, int height, int tag) {
+    if (width < 1) return false;
+
+    for (int y = top; y < top + height; y++) {
+        if (zdk_row_has_tag(ctx, y, left, left + width - 1, tag)) return true;
+    }
+
+    return false;
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+int zdk_count_row_tag(ZdkContext * ctx, int y, int tag) {
+    if (!ctx->screen || y < 0 || y >= ctx->screen->height || tag < 0 || tag >= ZDK_NUM_TAGS) {
+        return 0;
+    }
+
+    return ctx->screen->tag_counts[y * ZDK_NUM_TAGS + tag];
+}
+
+/*
+**	Helper function which marks every cell of a screen ZDK_TAG_FREE.
+*/
+static void reset_tags(Screen * scr) {
+    memset(scr->tags, ZDK_TAG_FREE, (size_t)scr->width * scr->height);
+    memset(scr->tag_counts, 0, scr->height * ZDK_NUM_TAGS * sizeof(int));
+
+    for (int y = 0; y < scr->height; y++) {
+        scr->tag_counts[y * ZDK_NUM_TAGS + ZDK_TAG_FREE] = scr->width;
+    }
+}
+
+/*
+**	Helper function which recomputes the tag counts of a screen.
+*/
+static void count_tags(Screen * scr) {
+    memset(scr->tag_counts, 0, scr->height * ZDK_NUM_TAGS * sizeof(int));
+
+    for (int y = 0; y < scr->height; y++) {
+        for (int x = 0; x < scr->width; x++) {
+            scr->tag_counts[y * ZDK_NUM_TAGS + scr->tags[y * scr->width + x]]++;
+        }
+    }
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_draw_solid_line(ZdkContext * ctx, int x1, int y1, int x2, int y2, int colour) {
+    int fg = zdk_get_foreground(ctx);
+    int bg = zdk_get_background(ctx);
+    zdk_set_foreground(ctx, colour | INVERSE);
+    zdk_set_background(ctx, colour);
+    zdk_draw_line(ctx, x1, y1, x2, y2, ' ');
+    zdk_set_foreground(ctx, fg);
+    zdk_set_background(ctx, bg);
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_draw_string(ZdkContext * ctx, int x, int y, char * text) {
+    for (int i = 0; text[i]; i++) {
+        zdk_draw_char(ctx, x + i, y, text[i]);
+    }
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_draw_int(ZdkContext * ctx, int x, int y, int value) {
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), "%d", value);
+    zdk_draw_string(ctx, x, y, buffer);
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_draw_double(ZdkContext * ctx, int x, int y, double value) {
+    char buffer[100];
+    snprintf(buffer, sizeof(buffer), "%g", value);
+    zdk_draw_string(ctx, x, y, buffer);
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_draw_formatted(ZdkContext * ctx, int x, int y, const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    char buffer[1000];
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    zdk_draw_string(ctx, x, y, buffer);
+}
+
+// ------------------------------------------------------------------
+//	Retained text labels.
+// ------------------------------------------------------------------
+
+typedef enum LabelSlotType {
+    SLOT_INT,
+    SLOT_CHAR,
+    SLOT_STRING,
+} LabelSlotType;
+
+/*
+**	A bound variable, and the value it held when the label was last
+**	formatted.
+*/
+typedef struct LabelSlot {
+    LabelSlotType type;
+    const void * source;
+    int value;
+    char text[ZDK_LABEL_MAX + 1];
+} LabelSlot;
+
+struct ZdkLabel {
+    ZdkContext * ctx;
+    ZdkLabel * next;
+    int x;
+    int y;
+    int colour_num;
+#ifdef ZDK_PACKED_CELLS
+    ZdkCell colour_bits;
+#endif
+    int tag;
+    char * format;
+    int num_slots;
+    LabelSlot slots[ZDK_LABEL_SLOTS];
+    char text[ZDK_LABEL_MAX + 1];
+    int len;
+    int drawn_len;
+    bool stale;
+};
+
+/*
+**	Helper function which formats the text of a label from the values held
+**	in its slots. Conversions are formatted one at a time, each by a call
+**	to snprintf with a format containing only that conversion.
+*/
+static void format_label(ZdkLabel * label) {
+    const char * f = label->format;
+    char * out = label->text;
+    int len = 0;
+    int slot = 0;
+
+    while (*f && len < ZDK_LABEL_MAX) {
+        if (f[0] != '%' || f[1] == '%') {
+            out[len++] = *f;
+            f += f[0] == '%' ? 2 : 1;
+            continue;
+        }
+
+        // Find the end of the conversion specification. Length modifiers
+        // are skipped so that the whole conversion is replaced by '?'.
+        const char * end = f + 1;
+        bool modified = false;
+
+        while (*end && strchr("-+ #0123456789.hlLjzt", *end)) {
+            if (isalpha((unsigned char)*end)) modified = true;
+            end++;
+        }
+
+        char spec[32];
+        int spec_len = (int)(end - f) + 1;
+        char conversion = *end;
+        LabelSlot * s = slot < label->num_slots ? &label->slots[slot] : NULL;
+        int n = 0;
+
+        slot++;
+        f = *end ? end + 1 : end;
+
+        if (conversion == 0 || modified || spec_len >= (int)sizeof(spec) || !s) {
+            out[len++] = '?';
+            continue;
+        }
+
+        memcpy(spec, end + 1 - spec_len, spec_len);
+        spec[spec_len] = 0;
+
+        if (conversion == 's' && s->type == SLOT_STRING) {
+            n = snprintf(out + len, ZDK_LABEL_MAX + 1 - len, spec, s->text);
+        }
+        else if (strchr("diuxXoc", conversion) && s->type != SLOT_STRING) {
+            n = snprintf(out + len, ZDK_LABEL_MAX + 1 - len, spec, s->value);
+        }
+        else {
+            out[len] = '?';
+            n = 1;
+        }
+
+        len = MIN(len + MAX(n, 0), ZDK_LABEL_MAX);
+    }
+
+    out[len] = 0;
+    label->len = len;
+}
+
+/*
+**	Helper function which copies the value of each bound variable into its
+**	slot. Returns true if any value has changed.
+*/
+static bool poll_label(ZdkLabel * label) {
+    bool changed = false;
+
+    for (int i = 0; i < label->num_slots; i++) {
+        LabelSlot * s = &label->slots[i];
+        int value;
+
+        switch (s->type) {
+        case SLOT_INT:
+        case SLOT_CHAR:
+            value = s->type == SLOT_INT ? *(const int *)s->source : *(const char *)s->source;
+
+            if (value != s->value) {
+                s->value = value;
+                changed = true;
+            }
+            break;
+
+        case SLOT_STRING:
+            if (strncmp(s->text, s->source, ZDK_LABEL_MAX) != 0) {
+                strncpy(s->text, s->source, ZDK_LABEL_MAX);
+                changed = true;
+            }
+            break;
+        }
     }
+
+    return changed;
+}
+
+/*
+**	Helper function which writes the text of a label into ctx->screen. If
+**	redraw is true, cells left over from longer text previously drawn are
+**	blanked, and the cells are added to the dirty span of the row so that
+**	show_screen examines them. Otherwise the text is assumed to match the
+**	frame last shown, as it does after clear_screen.
+*/
+static void put_label(ZdkLabel * label, bool redraw) {
+    Screen * scr = label->ctx->screen;
+
+    if (!scr || label->y < 0 || label->y >= scr->height) return;
+
+    int extent = redraw ? MAX(label->len, label->drawn_len) : label->len;
+    int x0 = MAX(label->x, 0);
+    int x1 = MIN(label->x + extent, scr->width) - 1;
+    int y = label->y;
+
+    if (redraw) label->drawn_len = label->len;
+
+    if (x0 > x1) return;
+
+    for (int x = x0; x <= x1; x++) {
+        int i = x - label->x;
+        bool text = i < label->len;
+#ifdef ZDK_PACKED_CELLS
+        cell_row(scr, y)[x] = text
+            ? label->colour_bits | (unsigned char)label->text[i]
+            : zdk_pack_cell(' ', scr->fill_colour);
+#endif
+        scr->pixels[y][x] = text ? label->text[i] : ' ';
+        scr->colours[y][x] = text ? label->colour_num : scr->fill_colour;
+    }
+
+    if (redraw) {
+        RowSpan * dirty = &scr->dirty[y];
+        dirty->min = MIN(dirty->min, x0);
+        dirty->max = MAX(dirty->max, x1);
+    }
+
+    int text_x1 = MIN(x1, label->x + label->len - 1);
+
+    if (x0 <= text_x1) tag_cells(scr, y, x0, text_x1, label->tag);
+}
+
+/*
+**	Helper function which restores every label of a context after its
+**	screen has been cleared.
+*/
+static void restore_labels(ZdkContext * ctx) {
+    for (ZdkLabel * label = ctx->labels; label; label = label->next) {
+        put_label(label, false);
+    }
+}
+
+/*
+**	Helper function which formats and redraws each label of a context
+**	whose bound values have changed since it was last drawn.
+*/
+static void update_labels(ZdkContext * ctx) {
+    for (ZdkLabel * label = ctx->labels; label; label = label->next) {
+        if (poll_label(label) || label->stale) {
+            format_label(label);
+            put_label(label, true);
+            label->stale = false;
+        }
+    }
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+ZdkLabel * zdk_create_label(ZdkContext * ctx, int x, int y, const char * format) {
+    if (!ctx->screen || !format) return NULL;
+
+    ZdkLabel * label = calloc(1, sizeof(ZdkLabel));
+
+    if (!label) return NULL;
+
+    label->format = strdup(format);
+
+    if (!label->format) {
+        free(label);
+        return NULL;
+    }
+
+    label->ctx = ctx;
+    label->x = x;
+    label->y = y;
+    label->colour_num = ctx->colour_num;
+#ifdef ZDK_PACKED_CELLS
+    label->colour_bits = ctx->colour_bits;
+#endif
+    label->tag = ctx->draw_tag;
+    label->stale = true;
+
+    // Append, so that later labels are drawn over earlier ones.
+    ZdkLabel ** link = &ctx->labels;
+
+    while (*link) link = &(*link)->next;
+
+    *link = label;
+    return label;
+}
+
+/*
+**	Helper function which adds a slot to a label.
+*/
+static bool bind_label(ZdkLabel * label, LabelSlotType type, const void * source) {
+    if (!label || !source || label->num_slots >= ZDK_LABEL_SLOTS) return false;
+
+    LabelSlot * s = &label->slots[label->num_slots++];
+    s->type = type;
+    s->source = source;
+    label->stale = true;
+    return true;
 }
 
 /*
 **	See graphics.h for documentation.
 */
-void draw_solid_line(int x1, int y1, int x2, int y2, int colour) {
-    int fg = get_foreground();
-    int bg = get_background();
-    set_foreground(colour | INVERSE);
-    set_background(colour);
-    draw_line(x1, y1, x2, y2, ' ');
-    set_foreground(fg);
-    set_background(bg);
+bool bind_label_int(ZdkLabel * label, const int * value) {
+    return bind_label(label, SLOT_INT, value);
 }
 
 /*
 **	See graphics.h for documentation.
 */
-void draw_string(int x, int y, char * text) {
-    for (int i = 0; text[i]; i++) {
-        draw_char(x + i, y, text[i]);
-    }
+bool bind_label_char(ZdkLabel * label, const char * value) {
+    return bind_label(label, SLOT_CHAR, value);
 }
 
 /*
 **	See graphics.h for documentation.
 */
-void draw_int(int x, int y, int value) {
-    char buffer[100];
-    snprintf(buffer, sizeof(buffer), "%d", value);
-    draw_string(x, y, buffer);
+bool bind_label_string(ZdkLabel * label, const char * value) {
+    return bind_label(label, SLOT_STRING, value);
 }
 
 /*
 **	See graphics.h for documentation.
 */
-void draw_double(int x, int y, double value) {
-    char buffer[100];
-    snprintf(buffer, sizeof(buffer), "%g", value);
-    draw_string(x, y, buffer);
+void destroy_label(ZdkLabel * label) {
+    if (!label) return;
+
+    ZdkContext * ctx = label->ctx;
+
+    for (ZdkLabel ** link = &ctx->labels; *link; link = &(*link)->next) {
+        if (*link == label) {
+            *link = label->next;
+            break;
+        }
+    }
+
+    // Blank the cells occupied by the label.
+    label->len = 0;
+    put_label(label, true);
+
+    free(label->format);
+    free(label);
 }
 
 /*
-**	See graphics.h for documentation.
+**	Helper function which releases every label of a context.
 */
-void draw_formatted(int x, int y, const char * format, ...) {
-    va_list args;
-    va_start(args, format);
-    char buffer[1000];
-    vsnprintf(buffer, sizeof(buffer), format, args);
-    draw_string(x, y, buffer);
+static void destroy_labels(ZdkContext * ctx) {
+    while (ctx->labels) {
+        ZdkLabel * next = ctx->labels->next;
+        free(ctx->labels->format);
+        free(ctx->labels);
+        ctx->labels = next;
+    }
 }
 
 /* static */ MEVENT mouse_event;
 
 /*
-**	See graphics.h for documentation.
+**	Keys read by wait_key_event() and not yet taken, oldest first. Mouse
+**	state must be fetched from curses when KEY_MOUSE is read, so it is
+**	queued with the key.
 */
-int get_char() {
-    int current_char;
+typedef struct QueuedKey {
+    ZdkKeyEvent event;
+    MEVENT mouse;
+} QueuedKey;
+
+static QueuedKey key_queue[ZDK_KEY_QUEUE];
+static int key_head = 0;
+static int key_count = 0;
 
+/*
+**	Helper function which reads a key from the input source.
+*/
+static int read_key(bool wait) {
     if (zdk_input_stream) {
-        current_char = fgetc(zdk_input_stream);
+        return fgetc(zdk_input_stream);
     }
     else {
-        current_char = getch();
+        return zdk_default_context.backend->read_char(wait);
     }
+}
 
-    save_char(current_char);
+/*
+**	Helper function which records a key as it is handed to the caller.
+*/
+static int take_key(int char_code) {
+    save_char(char_code);
 
-    if (current_char == KEY_MOUSE) {
+    if (char_code == KEY_MOUSE) {
         memset(&mouse_event, 0, sizeof(mouse_event));
         getmouse(&mouse_event);
     }
 
-    return current_char;
+    return char_code;
+}
+
+/*
+**	Helper function which moves every key available, without waiting, into
+**	the key queue. A replayed input stream is read one key at a time.
+**	Returns the number of keys queued.
+*/
+static int fill_key_queue(void) {
+    int added = 0;
+
+    while (key_count < ZDK_KEY_QUEUE) {
+        int char_code = read_key(false);
+
+        if (char_code == ERR) break;
+
+        QueuedKey * slot = &key_queue[(key_head + key_count) % ZDK_KEY_QUEUE];
+        slot->event.key = char_code;
+        slot->event.time = get_current_ns();
+        memset(&slot->mouse, 0, sizeof(slot->mouse));
+
+        if (char_code == KEY_MOUSE) {
+            getmouse(&slot->mouse);
+        }
+
+        key_count++;
+        added++;
+
+        if (zdk_input_stream) break;
+    }
+
+    return added;
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+int wait_key_event(int64_t deadline) {
+    fill_key_queue();
+
+    while (key_count == 0) {
+        if (deadline >= 0 && get_current_ns() >= deadline) break;
+
+        if (zdk_input_stream || !zdk_default_context.backend->wait_input(deadline)) {
+            if (deadline >= 0) timer_sleep_until(deadline);
+            break;
+        }
+
+        // Input that yields no key, such as the end of the stream, would
+        // wake poll() again at once, so sleep out the deadline instead.
+        if (fill_key_queue() == 0) {
+            if (deadline >= 0) timer_sleep_until(deadline);
+            break;
+        }
+    }
+
+    return key_count;
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+bool next_key_event(ZdkKeyEvent * event) {
+    if (key_count == 0) return false;
+
+    QueuedKey * slot = &key_queue[key_head];
+
+    *event = slot->event;
+    key_head = (key_head + 1) % ZDK_KEY_QUEUE;
+    key_count--;
+
+    save_char(event->key);
+
+    if (event->key == KEY_MOUSE) {
+        mouse_event = slot->mouse;
+    }
+
+    return true;
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+int get_char() {
+    ZdkKeyEvent event;
+
+    if (next_key_event(&event)) {
+        return event.key;
+    }
+
+    return take_key(read_key(false));
 }
 
 /*
@@ -499,25 +1621,13 @@ unsigned long get_mouse_buttons() {
 **	See graphics.h for documentation.
 */
 int wait_char() {
-    int current_char;
+    ZdkKeyEvent event;
 
-    if (zdk_input_stream) {
-        current_char = fgetc(zdk_input_stream);
-    }
-    else {
-        timeout(-1);
-        current_char = getch();
-        timeout(0);
-    }
-
-    save_char(current_char);
-
-    if (current_char == KEY_MOUSE) {
-        memset(&mouse_event, 0, sizeof(mouse_event));
-        getmouse(&mouse_event);
+    if (next_key_event(&event)) {
+        return event.key;
     }
 
-    return current_char;
+    return take_key(read_key(true));
 }
 
 /*
@@ -531,43 +1641,41 @@ void get_screen_size(int * width, int * height) {
 /*
 **	See graphics.h for documentation.
 */
-int screen_width(void) {
-    return zdk_screen->width;
+int zdk_screen_width(ZdkContext * ctx) {
+    return ctx->screen->width;
 }
 
 /*
 **	See graphics.h for documentation.
 */
-int screen_height(void) {
-    return zdk_screen->height;
+int zdk_screen_height(ZdkContext * ctx) {
+    return ctx->screen->height;
 }
 
 /*
 **	See graphics.h for documentation.
 */
-void save_screen(const char * file_name) {
+void zdk_save_screen(ZdkContext * ctx, const char * file_name) {
     FILE * f = fopen(file_name, "a");
-    save_screen_(f);
+    save_screen_(ctx, f);
     fclose(f);
 }
 
 /*
 **	See graphics.h for documentation.
 */
-void save_screen_(FILE * f) {
+static void save_screen_(ZdkContext * ctx, FILE * f) {
     if (f == NULL) return;
 
-    if (zdk_screen) {
-        int width = zdk_screen->width;
-        int height = zdk_screen->height;
+    if (ctx->screen) {
+        int width = ctx->screen->width;
+        int height = ctx->screen->height;
 
         fprintf(f, "Frame(%d,%d,%f)\n", width, height, get_current_time());
 
         for (int y = 0; y < height; y++) {
-            char * row = zdk_screen->pixels[y];
-
             for (int x = 0; x < width; x++) {
-                fputc(row[x], f);
+                fputc(ZDK_PIXEL(ctx->screen, x, y), f);
             }
 
             fputc('\n', f);
@@ -581,8 +1689,8 @@ void save_screen_(FILE * f) {
  *	Saves the current character to an automatically named local file.
  */
 void save_char(int char_code) {
-    if (zdk_save_stream && char_code != ERR) {
-        fprintf(zdk_save_stream, "Char(%d,%f)\n", char_code, get_current_time());
+    if (char_code != ERR) {
+        recorder_write_char(char_code, get_current_time());
     }
 }
 
@@ -592,11 +1700,11 @@ void save_char(int char_code) {
  *	Subsequent calls to screen_width() and screen_height() will
  *	return the supplied values of width and height.
  */
-void override_screen_size(int width, int height) {
-    void update_buffer(Screen ** buffer, int width, int height, char character, char colour_num);
+void zdk_override_screen_size(ZdkContext * ctx, int width, int height) {
+    void update_buffer(Screen ** buffer, int width, int height, char character, int colour_num);
 
-    update_buffer(&zdk_screen, width, height, ' ', colour_num);
-    update_buffer(&zdk_prev_screen, width, height, ' ', colour_num);
+    update_buffer(&ctx->screen, width, height, ' ', ctx->colour_num);
+    update_buffer(&ctx->prev_screen, width, height, ' ', ctx->colour_num);
 }
 
 // Private helper function to allocate sccreen buffer.
@@ -609,7 +1717,7 @@ static void ** allocate_screen_buffer(int width, int height, char data, size_t e
  *		AND height &gt; 0.
  */
 
-void update_buffer(Screen ** screen, int width, int height, char character, char colour_num) {
+void update_buffer(Screen ** screen, int width, int height, char character, int colour_num) {
     assert(width > 0);
     assert(height > 0);
 
@@ -633,6 +1741,21 @@ void update_buffer(Screen ** screen, int width, int height, char character, char
     new_screen->width = width;
     new_screen->height = height;
 
+#ifdef ZDK_PACKED_CELLS
+    new_screen->cells = malloc((size_t)width * height * sizeof(ZdkCell));
+
+    if (!new_screen->cells) {
+        destroy_screen(new_screen);
+        return;
+    }
+
+    ZdkCell blank = zdk_pack_cell(character, colour_num);
+
+    for (int i = 0; i < width * height; i++) {
+        new_screen->cells[i] = blank;
+    }
+#endif
+
     new_screen->pixels = (char**)allocate_screen_buffer(width, height, character, sizeof(char));
 
     if (!new_screen->pixels) {
@@ -647,8 +1770,30 @@ void update_buffer(Screen ** screen, int width, int height, char character, char
         return;
     }
 
+#ifdef ZDK_PACKED_CELLS
+    // The planes mirror the cells exactly, colours included.
+    zdk_fill32((uint32_t *)new_screen->colours[0], colour_num, width * height);
+#endif
+
+    new_screen->dirty = calloc(height, sizeof(RowSpan));
+    new_screen->ink = calloc(height, sizeof(RowSpan));
+    new_screen->tags = calloc((size_t)width * height, sizeof(uint8_t));
+    new_screen->tag_counts = calloc(height * ZDK_NUM_TAGS, sizeof(int));
+
+    if (!new_screen->dirty || !new_screen->ink || !new_screen->tags || !new_screen->tag_counts) {
+        destroy_screen(new_screen);
+        return;
+    }
+
+    // A new buffer has unknown relationship to the display, so every cell
+    // must be examined by the next call to show_screen.
+    fill_spans(new_screen->dirty, width, height);
+    fill_spans(new_screen->ink, width, height);
+    new_screen->fill_colour = colour_num;
+
     void copy_screen(Screen * old_scr, Screen * new_scr);
 
+    reset_tags(new_screen);
     copy_screen(old_screen, new_screen);
 
     destroy_screen(old_screen);
@@ -720,9 +1865,15 @@ void copy_screen(Screen * src, Screen * dest) {
     int clip_height = MIN(src->height, dest->height);
 
     for (int y = 0; y < clip_height; y++) {
+#ifdef ZDK_PACKED_CELLS
+        memcpy(cell_row(dest, y), cell_row(src, y), clip_width * sizeof(ZdkCell));
+#endif
         memcpy(dest->pixels[y], src->pixels[y], clip_width);
         memcpy(dest->colours[y], src->colours[y], clip_width * sizeof(int));
+        memcpy(dest->tags + y * dest->width, src->tags + y * src->width, clip_width);
     }
+
+    count_tags(dest);
 }
 
 /*
@@ -734,11 +1885,38 @@ void copy_screen(Screen * src, Screen * dest) {
 **	respectively.
 */
 void fit_screen_to_window(void) {
-    if (zdk_suppress_output) {
-        override_screen_size(80, 24);
+    int width, height;
+    zdk_default_context.backend->get_size(&width, &height);
+    override_screen_size(width, height);
+}
+
+/**
+ *	Sets every span in an array of row spans to the empty span.
+ *
+ *	Parameters:
+ *		spans - an array of height row spans.
+ *		width, height - the dimensions of the screen which owns the spans.
+ */
+
+static void clear_spans(RowSpan * spans, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        spans[y].min = width;
+        spans[y].max = -1;
     }
-    else {
-        override_screen_size(getmaxx(stdscr), getmaxy(stdscr));
+}
+
+/**
+ *	Sets every span in an array of row spans to cover the full row.
+ *
+ *	Parameters:
+ *		spans - an array of height row spans.
+ *		width, height - the dimensions of the screen which owns the spans.
+ */
+
+static void fill_spans(RowSpan * spans, int width, int height) {
+    for (int y = 0; y < height; y++) {
+        spans[y].min = 0;
+        spans[y].max = width - 1;
     }
 }
 
@@ -753,6 +1931,9 @@ void fit_screen_to_window(void) {
 
 void destroy_screen(Screen * scr) {
     if (scr) {
+#ifdef ZDK_PACKED_CELLS
+        free(scr->cells);
+#endif
         if (scr->pixels) {
             if (scr->pixels[0]) {
                 free(scr->pixels[0]);
@@ -769,34 +1950,249 @@ void destroy_screen(Screen * scr) {
             free(scr->colours);
         }
 
+        free(scr->dirty);
+        free(scr->ink);
+        free(scr->tags);
+        free(scr->tag_counts);
         free(scr);
     }
 }
 
+/*
+**	Helper function which finds the first unused file name of the form
+**	zdk_screen.N.extension.
+*/
+static void next_save_file_name(char * file_name, const char * extension) {
+    // A somewhat arbitrary upper limit on the number of save files.
+    for (int i = 1; i < 1000000; i++) {
+        sprintf(file_name, "zdk_screen.%d.%s", i, extension);
+        FILE * existing_file = fopen(file_name, "r");
+
+        if (existing_file) {
+            // File exists; leave it alone.
+            fclose(existing_file);
+        }
+        else {
+            // File does not exist; use this name.
+            break;
+        }
+    }
+}
+
 void auto_save_screen(bool save_if_true) {
     if (save_if_true && !zdk_save_stream) {
         char file_name[100];
-
-        // A somewhat arbitrary upper limit on the number of save files.
-        for (int i = 1; i < 1000000; i++) {
-            sprintf(file_name, "zdk_screen.%d.txt", i);
-            FILE * existing_file = fopen(file_name, "r");
-
-            if (existing_file) {
-                // File exists; leave it alone.
-                fclose(existing_file);
-            }
-            else {
-                // File does not exist; use this name.
-                break;
-            }
-        }
-
+        next_save_file_name(file_name, "txt");
         zdk_save_stream = fopen(file_name, "w");
     }
     else if (zdk_save_stream && !save_if_true) {
+        recorder_flush();
         fflush(zdk_save_stream);
         fclose(zdk_save_stream);
         zdk_save_stream = NULL;
     }
 }
+
+void auto_save_cast(bool save_if_true) {
+    if (save_if_true && !zdk_cast_stream) {
+        char file_name[100];
+        next_save_file_name(file_name, "cast");
+        zdk_cast_stream = cast_create(file_name);
+    }
+    else if (zdk_cast_stream && !save_if_true) {
+        recorder_flush();
+        cast_close(zdk_cast_stream);
+        zdk_cast_stream = NULL;
+    }
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+ZdkContext * zdk_create_context(int width, int height) {
+    void update_buffer(Screen ** buffer, int width, int height, char character, int colour_num);
+
+    ZdkContext * ctx = calloc(1, sizeof(ZdkContext));
+
+    if (!ctx) return NULL;
+
+    // A context other than the default never drives the terminal.
+    ctx->suppress_output = true;
+    ctx->backend = &zdk_null_backend;
+    ctx->draw_tag = ZDK_TAG_FREE;
+    ctx->emitted_attr = -1;
+    ctx->cursor_x = ctx->cursor_y = -1;
+    zdk_set_colours(ctx, WHITE, BLACK);
+
+    update_buffer(&ctx->screen, width, height, ' ', ctx->colour_num);
+    update_buffer(&ctx->prev_screen, width, height, ' ', ctx->colour_num);
+
+    if (!ctx->screen || !ctx->prev_screen) {
+        zdk_destroy_context(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+/*
+**	See graphics.h for documentation.
+*/
+void zdk_destroy_context(ZdkContext * ctx) {
+    if (ctx == NULL || ctx == &zdk_default_context) return;
+
+    destroy_labels(ctx);
+    destroy_screen(ctx->screen);
+    destroy_screen(ctx->prev_screen);
+    free(ctx);
+}
+
+// ------------------------------------------------------------------
+//	Functions which operate on the default context.
+//	See graphics.h for documentation.
+// ------------------------------------------------------------------
+
+void set_background(int colour) {
+    zdk_set_background(&zdk_default_context, colour);
+}
+
+void set_foreground(int colour) {
+    zdk_set_foreground(&zdk_default_context, colour);
+}
+
+void set_colours(int foreground, int background) {
+    zdk_set_colours(&zdk_default_context, foreground, background);
+}
+
+void get_colours(int * foreground, int * background) {
+    zdk_get_colours(&zdk_default_context, foreground, background);
+}
+
+int get_background(void) {
+    return zdk_get_background(&zdk_default_context);
+}
+
+int get_foreground(void) {
+    return zdk_get_foreground(&zdk_default_context);
+}
+
+void set_draw_tag(int tag) {
+    zdk_set_draw_tag(&zdk_default_context, tag);
+}
+
+int get_draw_tag(void) {
+    return zdk_get_draw_tag(&zdk_default_context);
+}
+
+void clear_screen(void) {
+    zdk_clear_screen(&zdk_default_context);
+}
+
+ZdkBackground * save_background(void) {
+    return zdk_save_background(&zdk_default_context);
+}
+
+bool clear_screen_to(const ZdkBackground * background) {
+    return zdk_clear_screen_to(&zdk_default_context, background);
+}
+
+void show_screen(void) {
+    zdk_show_screen(&zdk_default_context);
+}
+
+void invalidate_screen(void) {
+    zdk_invalidate_screen(&zdk_default_context);
+}
+
+void reset_render_stats(void) {
+    zdk_reset_render_stats(&zdk_default_context);
+}
+
+void draw_char(int x, int y, char value) {
+    zdk_draw_char(&zdk_default_context, x, y, value);
+}
+
+void draw_hline(int x1, int x2, int y, char value) {
+    zdk_draw_hline(&zdk_default_context, x1, x2, y, value);
+}
+
+void draw_vline(int x, int y1, int y2, char value) {
+    zdk_draw_vline(&zdk_default_context, x, y1, y2, value);
+}
+
+void fill_rect(int left, int top, int width, int height, char value) {
+    zdk_fill_rect(&zdk_default_context, left, top, width, height, value);
+}
+
+void draw_line(int x1, int y1, int x2, int y2, char value) {
+    zdk_draw_line(&zdk_default_context, x1, y1, x2, y2, value);
+}
+
+void draw_solid_line(int x1, int y1, int x2, int y2, int colour) {
+    zdk_draw_solid_line(&zdk_default_context, x1, y1, x2, y2, colour);
+}
+
+void draw_string(int x, int y, char * text) {
+    zdk_draw_string(&zdk_default_context, x, y, text);
+}
+
+void draw_int(int x, int y, int value) {
+    zdk_draw_int(&zdk_default_context, x, y, value);
+}
+
+void draw_double(int x, int y, double value) {
+    zdk_draw_double(&zdk_default_context, x, y, value);
+}
+
+void draw_formatted(int x, int y, const char * format, ...) {
+    va_list args;
+    va_start(args, format);
+    char buffer[1000];
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    draw_string(x, y, buffer);
+}
+
+char scrape_char(int x, int y) {
+    return zdk_scrape_char(&zdk_default_context, x, y);
+}
+
+void set_tag(int x, int y, int tag) {
+    zdk_set_tag(&zdk_default_context, x, y, tag);
+}
+
+int get_tag(int x, int y) {
+    return zdk_get_tag(&zdk_default_context, x, y);
+}
+
+bool row_has_tag(int y, int x1, int x2, int tag) {
+    return zdk_row_has_tag(&zdk_default_context, y, x1, x2, tag);
+}
+
+bool rect_has_tag(int left, int top, int width, int height, int tag) {
+    return zdk_rect_has_tag(&zdk_default_context, left, top, width, height, tag);
+}
+
+int count_row_tag(int y, int tag) {
+    return zdk_count_row_tag(&zdk_default_context, y, tag);
+}
+
+ZdkLabel * create_label(int x, int y, const char * format) {
+    return zdk_create_label(&zdk_default_context, x, y, format);
+}
+
+int screen_width(void) {
+    return zdk_screen_width(&zdk_default_context);
+}
+
+int screen_height(void) {
+    return zdk_screen_height(&zdk_default_context);
+}
+
+void save_screen(const char * file_name) {
+    zdk_save_screen(&zdk_default_context, file_name);
+}
+
+void override_screen_size(int width, int height) {
+    zdk_override_screen_size(&zdk_default_context, width, height);
+}
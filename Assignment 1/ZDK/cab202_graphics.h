@@ -19,6 +19,27 @@
 #include <stdio.h>
 #include <stdint.h>
 
+/*
+ *  RowSpan records an inclusive range of columns, [min, max], in one row
+ *  of a Screen. The span is empty if min > max.
+ */
+typedef struct RowSpan {
+    int min;
+    int max;
+} RowSpan;
+
+/*
+ *  Occupancy tags. Each cell of a Screen carries a tag which records what
+ *  occupies it, independently of the character displayed there. Tags are
+ *  written by the drawing functions (see set_draw_tag) or by set_tag, and
+ *  are reset to ZDK_TAG_FREE by clear_screen.
+ */
+#define ZDK_TAG_FREE    (0)
+#define ZDK_TAG_WALL    (1)
+#define ZDK_TAG_ENTITY  (2)
+#define ZDK_TAG_OTHER   (3)
+#define ZDK_NUM_TAGS    (4)
+
 /*
  *  Screen structure contains the off-screen drawing area in which each
  *  frame of the view is constructed before being flushed to the display.
@@ -45,26 +66,203 @@
  *              colour data of the display. To access the colour at
  *              location (x,y) of Screen * s, use:
  *                               s->colours[y][x]
+ *
+ *      dirty - An array of height RowSpan records. dirty[y] covers every
+ *              column of row y which may have changed since the last call
+ *              to show_screen(). Cells outside the span are guaranteed to
+ *              match the corresponding cells of zdk_prev_screen.
+ *
+ *      ink - An array of height RowSpan records. ink[y] covers every column
+ *              of row y which has been drawn since the last clear_screen().
+ *              Cells outside the span hold a space in fill_colour.
+ *
+ *      fill_colour - The colour applied by the most recent clear_screen().
+ *
+ *      tags - A width * height array of occupancy tags in row-major order.
+ *              The tag at location (x,y) of Screen * s is:
+ *                               s->tags[y * s->width + x]
+ *
+ *      tag_counts - An array of height * ZDK_NUM_TAGS counters. The number
+ *              of cells in row y which carry tag t is:
+ *                               s->tag_counts[y * ZDK_NUM_TAGS + t]
+ *
+ *  Notes:
+ *      The drawing functions maintain dirty and ink automatically. If you
+ *      write to pixels or colours directly, call invalidate_screen()
+ *      before the next call to show_screen().
+ *
+ *  Packed cells:
+ *      If ZDK_PACKED_CELLS is defined when the ZDK and the program using it
+ *      are compiled, the screen is held in a single contiguous array of
+ *      16-bit cells, which show_screen() compares and copies:
+ *
+ *      cells - A width * height array of ZdkCell in row-major order. The
+ *              low byte of each cell holds the character, and the high byte
+ *              holds the colour pair and modifiers. The cell at location
+ *              (x,y) of Screen * s is:
+ *                               s->cells[y * s->width + x]
+ *
+ *      A packed row occupies 2 * width consecutive bytes, so rows may be
+ *      compared with memcmp and copied with memcpy. Use ZDK_PIXEL(s,x,y)
+ *      and ZDK_COLOUR(s,x,y) to read a screen in either layout.
+ *
+ *      For programs written for the unpacked layout, pixels and colours
+ *      are kept as well, and every drawing function updates them along
+ *      with cells, so s->pixels[y][x] and s->colours[y][x] still work.
+ *      After writing to them directly, call invalidate_screen(), which
+ *      packs cells again from them.
  */
+#ifdef ZDK_PACKED_CELLS
+typedef uint16_t ZdkCell;
+#endif
+
 typedef struct Screen {
     int width;
     int height;
+#ifdef ZDK_PACKED_CELLS
+    ZdkCell * cells;
+#endif
     char ** pixels;
     int ** colours;
+    RowSpan * dirty;
+    RowSpan * ink;
+    int fill_colour;
+    uint8_t * tags;
+    int * tag_counts;
 } Screen;
 
+#ifdef ZDK_PACKED_CELLS
+
+/**
+ *    Packs a character and a colour (as stored in Screen.colours by the
+ *    unpacked layout) into a cell.
+ */
+ZdkCell zdk_pack_cell(char value, int colour);
+
+/**
+ *    Gets the colour, as it would be stored in Screen.colours by the
+ *    unpacked layout, from a packed cell.
+ */
+int zdk_cell_colour(ZdkCell cell);
+
+#define ZDK_CELL(s,x,y)   ((s)->cells[(y) * (s)->width + (x)])
+#define ZDK_PIXEL(s,x,y)  ((char)(ZDK_CELL(s,x,y) & 0xff))
+#define ZDK_COLOUR(s,x,y) (zdk_cell_colour(ZDK_CELL(s,x,y)))
+
+#else
+
+#define ZDK_PIXEL(s,x,y)  ((s)->pixels[(y)][(x)])
+#define ZDK_COLOUR(s,x,y) ((s)->colours[(y)][(x)])
+
+#endif
+
+/*
+ *  ZdkRenderStats accumulates counters which describe the work done by
+ *  show_screen().
+ *
+ *  Members:
+ *      frames - The number of calls to show_screen().
+ *
+ *      cells_examined - The number of cells compared against zdk_prev_screen.
+ *              Only cells inside the dirty span of each row are examined.
+ *
+ *      cells_emitted - The number of cells which differed and were
+ *              therefore sent to the display.
+ *
+ *      spans - The number of string writes sent to the display. Each span
+ *              is a run of cells in one row which share a colour.
+ *
+ *      attr_changes - The number of colour attribute changes sent to the
+ *              display. Redundant changes are not sent, and not counted.
+ *
+ *      bytes - The number of bytes the ANSI backend writes for the same
+ *              output: cursor movements, colour changes and characters.
+ *              This is maintained whichever backend is in use, so it may be
+ *              used to measure rendering cost without a terminal.
+ */
+typedef struct ZdkRenderStats {
+    unsigned long frames;
+    unsigned long cells_examined;
+    unsigned long cells_emitted;
+    unsigned long spans;
+    unsigned long attr_changes;
+    unsigned long bytes;
+} ZdkRenderStats;
+
+/*
+ *  ZdkContext holds all of the state used to draw and display screens:
+ *  the screen buffers, the current colours, the recording streams and the
+ *  render counters. Functions with the zdk_ prefix which take a context
+ *  operate on that context alone, so several contexts may be drawn and
+ *  shown concurrently, each by one thread at a time.
+ *
+ *  The functions without a context operate on zdk_default_context, which
+ *  is the only context connected to the terminal. The names zdk_screen,
+ *  zdk_prev_screen, zdk_save_stream, zdk_cast_stream, zdk_suppress_output
+ *  and zdk_render_stats refer to members of the default context.
+ *
+ *  Members:
+ *      screen, prev_screen - The screen under construction, and a copy of
+ *              the screen most recently shown.
+ *
+ *      save_stream, cast_stream - Recording streams. See zdk_save_stream
+ *              and zdk_cast_stream.
+ *
+ *      suppress_output - If true, nothing is sent to the terminal. Always
+ *              true for contexts created by zdk_create_context().
+ *
+ *      backend - The output backend which receives the changes found by
+ *              show_screen(). See cab202_backend.h.
+ *
+ *      render_stats - Counters updated by show_screen().
+ *
+ *      The remaining members are private to the ZDK.
+ */
+typedef struct ZdkContext {
+    Screen * screen;
+    Screen * prev_screen;
+    FILE * save_stream;
+    struct ZdkCast * cast_stream;
+    bool suppress_output;
+    const struct ZdkBackend * backend;
+    ZdkRenderStats render_stats;
+    int foreground;
+    int background;
+    int colour_flags;
+    int colour_num;
+    int draw_tag;
+#ifdef ZDK_PACKED_CELLS
+    ZdkCell colour_bits;
+#endif
+    int emitted_attr;
+    int cursor_x;
+    int cursor_y;
+    bool repaint;
+    struct ZdkLabel * labels;
+} ZdkContext;
+
+/**
+ *    The context used by the functions which do not take a context.
+ */
+extern ZdkContext zdk_default_context;
+
+/**
+ *    Counters updated by show_screen(). Reset them with reset_render_stats().
+ */
+#define zdk_render_stats (zdk_default_context.render_stats)
+
 /**
  *    The active screen to which data is added by drawing commands.
  *    The contents of this screen will be rendered into the display
  *    when show_screen() is called.
  */
-Screen * zdk_screen;
+#define zdk_screen (zdk_default_context.screen)
 
 /**
  *    A backing screen which contains a copy data previously displayed by
  *    show_screen().
  */
-Screen * zdk_prev_screen;
+#define zdk_prev_screen (zdk_default_context.prev_screen)
 
 /**
  *    Set up the terminal display for curses-based graphics:
@@ -72,6 +270,10 @@ Screen * zdk_prev_screen;
  *    .    Keystrokes are reported immediately rather than waiting for Enter.
  *    .    Mouse interactions are turned on.
  *    .    The numeric keypad and arrow keys are enabled.
+ *
+ *    The terminal is driven by curses unless another backend is selected
+ *    with zdk_backend or the ZDK_BACKEND environment variable. See
+ *    cab202_backend.h.
  */
 void setup_screen(void);
 
@@ -87,15 +289,36 @@ void setup_screen(void);
 void clear_screen(void);
 
 /**
- *    Transfers the contents of the zdk_screen buffer to the curses display
- *    window. The operation is optimised to the extent that only characters which
+ *    Transfers the contents of the zdk_screen buffer to the display, through
+ *    the backend selected by setup_screen(). The operation is optimised to the extent that only characters which
  *    have changed since the last call to show_screen are emitted.
  *
  *    The display is double-buffered, so after this, the contents of the
  *    zdk_screen are copied to the zdk_prev_screen.
+ *
+ *    Only the dirty span of each row is compared, so the cost of this
+ *    function is proportional to the area drawn since the previous frame
+ *    rather than to the area of the screen.
  */
 void show_screen(void);
 
+/**
+ *    Marks every cell of zdk_screen as dirty, so that the next call to
+ *    show_screen() compares the entire screen against zdk_prev_screen.
+ *
+ *    Notes:
+ *    .    Call this after modifying zdk_screen->pixels or zdk_screen->colours
+ *        directly, rather than through the drawing functions.
+ *    .    In the packed layout, this also packs zdk_screen->cells again from
+ *        pixels and colours.
+ */
+void invalidate_screen(void);
+
+/**
+ *    Sets all counters in zdk_render_stats to zero.
+ */
+void reset_render_stats(void);
+
 /**
  *    Draws the specified symbol at the prescribed (x,y) location in the terminal
  *    window. The rendered character is added to the zdk_screen buffer, but
@@ -235,6 +458,54 @@ void draw_formatted(int x, int y, const char * format, ...);
  */
 void draw_line(int x1, int y1, int x2, int y2, char value);
 
+/**
+ *    Draws a horizontal line segment from (x1,y) to (x2,y) using the specified
+ *    character. The segment is clipped to the screen and written as a single
+ *    span, so this is faster than drawing the same cells one at a time.
+ *
+ *    Input:
+ *        x1, x2 - The horizontal offsets of the endpoints, in either order.
+ *
+ *        y - The vertical offset of the line.
+ *
+ *        value - The symbol that is to be used to construct the line segment.
+ *
+ *    Output: void.
+ */
+void draw_hline(int x1, int x2, int y, char value);
+
+/**
+ *    Draws a vertical line segment from (x,y1) to (x,y2) using the specified
+ *    character. The segment is clipped to the screen before drawing.
+ *
+ *    Input:
+ *        x - The horizontal offset of the line.
+ *
+ *        y1, y2 - The vertical offsets of the endpoints, in either order.
+ *
+ *        value - The symbol that is to be used to construct the line segment.
+ *
+ *    Output: void.
+ */
+void draw_vline(int x, int y1, int y2, char value);
+
+/**
+ *    Fills a rectangle with the specified character, in the current
+ *    (foreground,background) colour pair. The rectangle is clipped to the
+ *    screen, and each row is written as a single span.
+ *
+ *    Input:
+ *        left, top - The offset coordinates of the top-left corner.
+ *
+ *        width, height - The size of the rectangle. Nothing is drawn if
+ *            either is less than 1.
+ *
+ *        value - The symbol with which the rectangle is to be filled.
+ *
+ *    Output: void.
+ */
+void fill_rect(int left, int top, int width, int height, char value);
+
 /*
 **    Draws the specified symbol at the prescribed (x,y) location in the terminal
 **    window. The rendered character is added to the zdk_screen buffer, but
@@ -365,6 +636,8 @@ int wait_char(void);
  *
  *    Notes:    (Advanced) If the zdk_input_stream is non-null, that stream will be used as a
  *            source rather than the standard input stream.
+ *
+ *            Keys already queued by wait_key_event() are returned first.
  */
 
 int get_char(void);
@@ -404,6 +677,56 @@ int get_mouse_y();
 */
 unsigned long get_mouse_buttons();
 
+/*
+**    A key press read by wait_key_event().
+**
+**    Members:
+**        key - The key code, as returned by get_char().
+**        time - The value of get_current_ns() when the key was read.
+*/
+typedef struct ZdkKeyEvent {
+    int key;
+    int64_t time;
+} ZdkKeyEvent;
+
+/*
+**    The capacity of the key queue. While the queue is full, further keys
+**    are left unread in the terminal.
+*/
+#define ZDK_KEY_QUEUE (64)
+
+/**
+ *    Sleeps until a key is pressed or get_current_ns() reaches a deadline,
+ *    whichever comes first. Every key available is read into a queue of
+ *    time-stamped events, from which next_key_event() takes them.
+ *
+ *    The wait is made by the backend (see cab202_backend.h). The terminal
+ *    backends block in poll() on the standard input stream, so a program
+ *    which waits here uses no CPU until there is work to do, and reacts to
+ *    a key as soon as it arrives.
+ *
+ *    Input:
+ *        deadline - The time, on the get_current_ns() clock, at which to
+ *            give up. A negative deadline means wait until a key is pressed.
+ *
+ *    Output: Returns the number of events in the queue.
+ *
+ *    Notes: If zdk_input_stream is non-null, one character is read from it
+ *           and the deadline is slept through only if it has run out.
+ */
+int wait_key_event(int64_t deadline);
+
+/**
+ *    Removes the oldest event from the key queue. The event is recorded
+ *    and the mouse state updated as if it had been returned by get_char().
+ *
+ *    Input:
+ *        event - The address of a variable to receive the event.
+ *
+ *    Output: Returns false if the queue was empty.
+ */
+bool next_key_event(ZdkKeyEvent * event);
+
 /*
 **    Saves a screen shot to a file having the designated name. Upon
 **    successful execution, the contents of designated file has been
@@ -438,6 +761,24 @@ void save_screen(const char * file_name);
 */
 void auto_save_screen(bool save_if_true);
 
+/*
+**    Automatically append each displayed screen, and each key event, to a
+**    compact binary screen-cast if this is non-zero.
+**
+**    Input:
+**        save_if_true - a boolean value which becomes the new save-cast state.
+**
+**    Notes:
+**        (1)    Whenever the save-cast state switches from false to true, a new file
+**            with a name of the form "zdk_screen.N.cast" is created. Only the
+**            cells which change are stored for most frames, so recording is
+**            much cheaper than with auto_save_screen. See cab202_cast.h.
+**
+**        (2) Use "zdk_cast totext" to convert the file to the format written by
+**            auto_save_screen, or "zdk_cast play" to replay it.
+*/
+void auto_save_cast(bool save_if_true);
+
 /**
  *    Reallocates zdk_screen and zdk_prev_screen buffers to the designated
  *    dimensions.
@@ -635,6 +976,199 @@ void get_colours(int *foreground, int *background);
 */
 char scrape_char(int x, int y);
 
+// ------------------------------------------------------------------
+//    Occupancy layer.
+// ------------------------------------------------------------------
+
+/**
+ *    Sets the occupancy tag written by subsequent drawing operations. This
+ *    affects draw_char, the line and rectangle functions, and the string
+ *    and number functions, in the same way as set_colours.
+ *
+ *    Input:
+ *        tag - A value between 0 and (ZDK_NUM_TAGS-1), inclusive. The
+ *            initial tag is ZDK_TAG_FREE.
+ *
+ *    Output: void.
+ */
+void set_draw_tag(int tag);
+
+/**
+ *    Gets the occupancy tag written by drawing operations.
+ */
+int get_draw_tag(void);
+
+/**
+ *    Sets the occupancy tag of a single cell of the current frame without
+ *    drawing anything. Cells outside the screen are ignored.
+ */
+void set_tag(int x, int y, int tag);
+
+/**
+ *    Gets the occupancy tag of a cell of the current frame, that is, the
+ *    frame being assembled in zdk_screen rather than the one last shown.
+ *
+ *    Input:
+ *        x, y - The location of the cell.
+ *
+ *    Output: Returns the tag of the cell, or ZDK_TAG_WALL if (x,y) lies
+ *        outside the screen.
+ */
+int get_tag(int x, int y);
+
+/**
+ *    Determines whether any cell in part of a row of the current frame
+ *    carries a designated tag. The range is clipped to the screen. Rows
+ *    in which no cell carries the tag are rejected in constant time.
+ *
+ *    Input:
+ *        y - The row.
+ *        x1, x2 - The first and last columns, in either order.
+ *        tag - The tag to look for.
+ *
+ *    Output: Returns true if and only if at least one cell carries tag.
+ */
+bool row_has_tag(int y, int x1, int x2, int tag);
+
+/**
+ *    Determines whether any cell in a rectangle of the current frame
+ *    carries a designated tag. See row_has_tag. Nothing is found if width
+ *    or height is less than 1.
+ *
+ *    Input:
+ *        left, top - The offset coordinates of the top-left corner.
+ *        width, height - The size of the rectangle.
+ *        tag - The tag to look for.
+ *
+ *    Output: Returns true if and only if at least one cell carries tag.
+ */
+bool rect_has_tag(int left, int top, int width, int height, int tag);
+
+/**
+ *    Counts the cells of a row of the current frame which carry a
+ *    designated tag, in constant time.
+ *
+ *    Output: Returns the count, or 0 if y lies outside the screen.
+ */
+int count_row_tag(int y, int tag);
+
+// ------------------------------------------------------------------
+//    Retained text labels.
+// ------------------------------------------------------------------
+
+/*
+ *  A label is a line of text which the ZDK keeps on the screen, such as a
+ *  score or a clock. The label is registered once, with a position and a
+ *  printf-style format. Each conversion in the format is bound, in order,
+ *  to a variable owned by the application. show_screen() compares each
+ *  bound variable against the value last formatted, and the label is
+ *  formatted and redrawn only when one of them has changed.
+ *
+ *  The text of a label survives clear_screen(): it is copied back into the
+ *  cleared screen without being formatted again. Because the copy matches
+ *  the frame already displayed, the cells of an unchanged label are not
+ *  examined by show_screen().
+ *
+ *  Labels are drawn beneath anything drawn after clear_screen(), but a
+ *  label which changes is redrawn on top. Text beyond the right edge of
+ *  the screen is clipped.
+ */
+typedef struct ZdkLabel ZdkLabel;
+
+/**
+ *    The maximum number of characters in the text of a label.
+ */
+#define ZDK_LABEL_MAX (100)
+
+/**
+ *    The maximum number of variables which may be bound to a label.
+ */
+#define ZDK_LABEL_SLOTS (4)
+
+/**
+ *    Creates a label in the current colours and draw tag.
+ *
+ *    Input:
+ *        x, y - The location of the first character of the label.
+ *        format - A printf-style format, which is copied. Each conversion
+ *            must be bound with one of the bind_label functions: %d, %i,
+ *            %u, %x, %X, %o and %c to an int or char, and %s to a string.
+ *            Flags, field width and precision are allowed, but not '*'.
+ *
+ *    Output: Returns the address of a new label, or NULL if memory could
+ *        not be allocated or the screen has not been set up.
+ *
+ *    Notes:
+ *        A conversion which is unbound, or bound to a variable of the wrong
+ *        kind, is shown as '?'.
+ */
+ZdkLabel * create_label(int x, int y, const char * format);
+
+/**
+ *    Binds the next conversion of a label to an int variable. The variable
+ *    must outlive the label.
+ *
+ *    Output: Returns false if label is NULL or every slot is already bound.
+ */
+bool bind_label_int(ZdkLabel * label, const int * value);
+
+/**
+ *    Binds the next conversion of a label to a char variable.
+ */
+bool bind_label_char(ZdkLabel * label, const char * value);
+
+/**
+ *    Binds the next conversion of a label to a string. The label is redrawn
+ *    when the contents of the string change, so value should be the address
+ *    of a character array which the application updates in place.
+ */
+bool bind_label_string(ZdkLabel * label, const char * value);
+
+/**
+ *    Removes a label from the screen and releases it. Does nothing if label
+ *    is NULL.
+ */
+void destroy_label(ZdkLabel * label);
+
+// ------------------------------------------------------------------
+//    Pre-drawn backgrounds.
+// ------------------------------------------------------------------
+
+/*
+ *  A background is a copy of zdk_screen, with its colours and tags, taken
+ *  after drawing the parts of a scene which stay the same from frame to
+ *  frame, such as the walls of a level. clear_screen_to() then starts each
+ *  frame from the background with a few block copies, rather than
+ *  clearing the screen and drawing the scene again.
+ */
+typedef struct ZdkBackground ZdkBackground;
+
+/**
+ *    Copies the contents of zdk_screen into a new background.
+ *
+ *    Output: Returns the address of the background, or NULL if memory could
+ *        not be allocated or the screen has not been set up.
+ */
+ZdkBackground * save_background(void);
+
+/**
+ *    Behaves like clear_screen(), but fills zdk_screen with a copy of a
+ *    background rather than with blanks. The draw tags of the background
+ *    are restored with it, and labels are copied back on top as they are
+ *    by clear_screen().
+ *
+ *    Output: Returns true if the background was used. If background is
+ *        NULL, or was saved from a screen of a different size, calls
+ *        clear_screen() instead and returns false, so the caller can draw
+ *        the scene and save a new background.
+ */
+bool clear_screen_to(const ZdkBackground * background);
+
+/**
+ *    Releases a background. Does nothing if background is NULL.
+ */
+void destroy_background(ZdkBackground * background);
+
 // ------------------------------------------------------------------
 //    Advanced facilities to support automated testing.
 // ------------------------------------------------------------------
@@ -652,8 +1186,16 @@ char scrape_char(int x, int y);
  *        this object.
  *    (2)    If you specify an exotic stream such as a memory stream you will
  *        probably have to disable curses functionality.
+ *    (3)    Records are written by a background thread (see cab202_recorder.h).
+ *        Call recorder_flush() before reading or closing the stream.
  */
-FILE * zdk_save_stream;
+#define zdk_save_stream (zdk_default_context.save_stream)
+
+/**
+ *    Binary screen-cast which, if not NULL, receives a copy of all key events
+ *    and displayed screens. Use auto_save_cast to manage this object.
+ */
+#define zdk_cast_stream (zdk_default_context.cast_stream)
 
 /**
  *    Override standard input stream.
@@ -665,19 +1207,20 @@ FILE * zdk_save_stream;
  *    redirection to pipe input from a text file. You may find it
  *    easier to use that rather than attempting to work with this interface.
  */
-FILE * zdk_input_stream;
+extern FILE * zdk_input_stream;
 
 /**
  *    Override: disable all curses functionality
  *
  *    A flag which, if true, blocks curses functionality. Useful mainly in a unit test scenario.
+ *    setup_screen() then selects zdk_null_backend (see cab202_backend.h).
  *
  *
  *    If you _do_ decide to play with this, the safest path is to set it true
  *    before calling setup_screen(), and don't change it back to false
  *    until after calling cleanup_screen() at the end of the program run.
  */
-bool zdk_suppress_output;
+#define zdk_suppress_output (zdk_default_context.suppress_output)
 
 /**
  *    Disable ncurses and restore the terminal to its normal operational state.
@@ -694,4 +1237,80 @@ bool zdk_suppress_output;
  */
 void cleanup_screen(void);
 
+// ------------------------------------------------------------------
+//    Re-entrant contexts.
+// ------------------------------------------------------------------
+
+/**
+ *    Creates a headless context with screens of the designated size. The
+ *    context never sends output to the terminal, but otherwise behaves like
+ *    the default context: frames may be drawn, shown (updating
+ *    render_stats and prev_screen) and recorded.
+ *
+ *    Input:
+ *        width, height - The dimensions of the screens, both at least 1.
+ *
+ *    Output: Returns the address of a new context, or NULL if memory could
+ *        not be allocated.
+ *
+ *    Notes:
+ *        Frames shown by a context other than the default are written to
+ *        its save_stream and cast_stream on the calling thread, rather than
+ *        by the recorder thread.
+ */
+ZdkContext * zdk_create_context(int width, int height);
+
+/**
+ *    Releases a context created by zdk_create_context(). The recording
+ *    streams are not closed. Does nothing if ctx is NULL or the default
+ *    context.
+ */
+void zdk_destroy_context(ZdkContext * ctx);
+
+/*
+**    Each of the following behaves exactly like the function of the same
+**    name without the zdk_ prefix, but operates on ctx rather than on
+**    zdk_default_context.
+*/
+void zdk_clear_screen(ZdkContext * ctx);
+ZdkBackground * zdk_save_background(ZdkContext * ctx);
+bool zdk_clear_screen_to(ZdkContext * ctx, const ZdkBackground * background);
+void zdk_show_screen(ZdkContext * ctx);
+void zdk_invalidate_screen(ZdkContext * ctx);
+void zdk_reset_render_stats(ZdkContext * ctx);
+
+void zdk_set_background(ZdkContext * ctx, int colour);
+void zdk_set_foreground(ZdkContext * ctx, int colour);
+void zdk_set_colours(ZdkContext * ctx, int foreground, int background);
+void zdk_get_colours(ZdkContext * ctx, int * foreground, int * background);
+int zdk_get_background(ZdkContext * ctx);
+int zdk_get_foreground(ZdkContext * ctx);
+
+void zdk_draw_char(ZdkContext * ctx, int x, int y, char value);
+void zdk_draw_string(ZdkContext * ctx, int x, int y, char * text);
+void zdk_draw_int(ZdkContext * ctx, int x, int y, int value);
+void zdk_draw_double(ZdkContext * ctx, int x, int y, double value);
+void zdk_draw_formatted(ZdkContext * ctx, int x, int y, const char * format, ...);
+void zdk_draw_line(ZdkContext * ctx, int x1, int y1, int x2, int y2, char value);
+void zdk_draw_hline(ZdkContext * ctx, int x1, int x2, int y, char value);
+void zdk_draw_vline(ZdkContext * ctx, int x, int y1, int y2, char value);
+void zdk_fill_rect(ZdkContext * ctx, int left, int top, int width, int height, char value);
+void zdk_draw_solid_line(ZdkContext * ctx, int x1, int y1, int x2, int y2, int colour);
+
+int zdk_screen_width(ZdkContext * ctx);
+int zdk_screen_height(ZdkContext * ctx);
+void zdk_override_screen_size(ZdkContext * ctx, int width, int height);
+void zdk_save_screen(ZdkContext * ctx, const char * file_name);
+char zdk_scrape_char(ZdkContext * ctx, int x, int y);
+
+void zdk_set_draw_tag(ZdkContext * ctx, int tag);
+int zdk_get_draw_tag(ZdkContext * ctx);
+void zdk_set_tag(ZdkContext * ctx, int x, int y, int tag);
+int zdk_get_tag(ZdkContext * ctx, int x, int y);
+bool zdk_row_has_tag(ZdkContext * ctx, int y, int x1, int x2, int tag);
+bool zdk_rect_has_tag(ZdkContext * ctx, int left, int top, int width, int height, int tag);
+int zdk_count_row_tag(ZdkContext * ctx, int y, int tag);
+
+ZdkLabel * zdk_create_label(ZdkContext * ctx, int x, int y, const char * format);
+
 #endif /* GRAPHICS_H_ */
@@ -0,0 +1,422 @@
+/*
+**  cab202_kernels.c
+**
+**  Bulk fill, compare and particle kernels with run-time dispatch.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include "cab202_kernels.h"
+#include <math.h>
+#include <stddef.h>
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define ZDK_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+/*
+ *	A set of kernel implementations. The diff kernel works on bytes; the
+ *	element-sized wrappers convert byte positions to element positions.
+ */
+typedef struct {
+	void( *fill16 )( uint16_t * dest, uint16_t value, size_t count );
+	void( *fill32 )( uint32_t * dest, uint32_t value, size_t count );
+	bool( *diff )( const uint8_t * a, const uint8_t * b, size_t n, size_t * first, size_t * last );
+	void( *advance )( float * x, float * y, float * dx, float * dy, const float * aim_x, const float * aim_y, float speed, size_t count );
+} kernel_table_t;
+
+// ---------------------------------------------------------------------------
+//	Portable scalar kernels.
+// ---------------------------------------------------------------------------
+
+static void fill16_scalar( uint16_t * dest, uint16_t value, size_t count ) {
+	for ( size_t i = 0; i < count; i++ ) {
+		dest[i] = value;
+	}
+}
+
+static void fill32_scalar( uint32_t * dest, uint32_t value, size_t count ) {
+	for ( size_t i = 0; i < count; i++ ) {
+		dest[i] = value;
+	}
+}
+
+static bool diff_scalar( const uint8_t * a, const uint8_t * b, size_t n, size_t * first, size_t * last ) {
+	size_t i = 0;
+
+	while ( i < n && a[i] == b[i] ) i++;
+
+	if ( i == n ) return false;
+
+	size_t j = n - 1;
+
+	while ( a[j] == b[j] ) j--;
+
+	*first = i;
+	*last = j;
+	return true;
+}
+
+/*
+ *	The vector kernels below perform the same operations in the same order,
+ *	so every level gives bit-for-bit the same positions.
+ */
+static void advance_scalar( float * x, float * y, float * dx, float * dy, const float * aim_x, const float * aim_y, float speed, size_t count ) {
+	for ( size_t i = 0; i < count; i++ ) {
+		float t1 = aim_x[i] - x[i];
+		float t2 = aim_y[i] - y[i];
+		float d2 = t1 * t1 + t2 * t2;
+
+		if ( d2 > 0 ) {
+			float s = speed / sqrtf( d2 );
+			dx[i] = t1 * s;
+			dy[i] = t2 * s;
+		}
+
+		x[i] += dx[i];
+		y[i] += dy[i];
+	}
+}
+
+static const kernel_table_t scalar_kernels = {
+	fill16_scalar, fill32_scalar, diff_scalar, advance_scalar
+};
+
+#ifdef ZDK_X86_KERNELS
+
+// ---------------------------------------------------------------------------
+//	SSE2 kernels: 16 bytes per step.
+// ---------------------------------------------------------------------------
+
+__attribute__(( target( "sse2" ) ))
+static void fill16_sse2( uint16_t * dest, uint16_t value, size_t count ) {
+	__m128i v = _mm_set1_epi16( (short) value );
+	size_t i = 0;
+
+	for ( ; i + 8 <= count; i += 8 ) {
+		_mm_storeu_si128( (__m128i *)( dest + i ), v );
+	}
+
+	for ( ; i < count; i++ ) {
+		dest[i] = value;
+	}
+}
+
+__attribute__(( target( "sse2" ) ))
+static void fill32_sse2( uint32_t * dest, uint32_t value, size_t count ) {
+	__m128i v = _mm_set1_epi32( (int) value );
+	size_t i = 0;
+
+	for ( ; i + 4 <= count; i += 4 ) {
+		_mm_storeu_si128( (__m128i *)( dest + i ), v );
+	}
+
+	for ( ; i < count; i++ ) {
+		dest[i] = value;
+	}
+}
+
+__attribute__(( target( "sse2" ) ))
+static unsigned diff_mask_sse2( const uint8_t * a, const uint8_t * b ) {
+	__m128i x = _mm_loadu_si128( (const __m128i *) a );
+	__m128i y = _mm_loadu_si128( (const __m128i *) b );
+	return ~(unsigned) _mm_movemask_epi8( _mm_cmpeq_epi8( x, y ) ) & 0xffff;
+}
+
+__attribute__(( target( "sse2" ) ))
+static bool diff_sse2( const uint8_t * a, const uint8_t * b, size_t n, size_t * first, size_t * last ) {
+	size_t i = 0;
+	unsigned mask = 0;
+
+	// Forward scan for the first difference.
+	for ( ; i + 16 <= n; i += 16 ) {
+		if ( ( mask = diff_mask_sse2( a + i, b + i ) ) ) break;
+	}
+
+	if ( mask ) {
+		i += __builtin_ctz( mask );
+	}
+	else {
+		while ( i < n && a[i] == b[i] ) i++;
+		if ( i == n ) return false;
+	}
+
+	// Backward scan for the last difference, which is at or after i.
+	size_t j = n;
+
+	while ( j - i >= 16 ) {
+		j -= 16;
+
+		if ( ( mask = diff_mask_sse2( a + j, b + j ) ) ) {
+			*first = i;
+			*last = j + 31 - __builtin_clz( mask );
+			return true;
+		}
+	}
+
+	do { j--; } while ( a[j] == b[j] );
+
+	*first = i;
+	*last = j;
+	return true;
+}
+
+__attribute__(( target( "sse2" ) ))
+static void advance_sse2( float * x, float * y, float * dx, float * dy, const float * aim_x, const float * aim_y, float speed, size_t count ) {
+	__m128 v_speed = _mm_set1_ps( speed );
+	__m128 zero = _mm_setzero_ps();
+	size_t i = 0;
+
+	for ( ; i + 4 <= count; i += 4 ) {
+		__m128 px = _mm_loadu_ps( x + i );
+		__m128 py = _mm_loadu_ps( y + i );
+		__m128 t1 = _mm_sub_ps( _mm_loadu_ps( aim_x + i ), px );
+		__m128 t2 = _mm_sub_ps( _mm_loadu_ps( aim_y + i ), py );
+		__m128 d2 = _mm_add_ps( _mm_mul_ps( t1, t1 ), _mm_mul_ps( t2, t2 ) );
+
+		// Lanes already at their aim (d2 == 0) keep their velocity.
+		__m128 steer = _mm_cmpgt_ps( d2, zero );
+		__m128 s = _mm_div_ps( v_speed, _mm_sqrt_ps( d2 ) );
+		__m128 vx = _mm_or_ps( _mm_and_ps( steer, _mm_mul_ps( t1, s ) ), _mm_andnot_ps( steer, _mm_loadu_ps( dx + i ) ) );
+		__m128 vy = _mm_or_ps( _mm_and_ps( steer, _mm_mul_ps( t2, s ) ), _mm_andnot_ps( steer, _mm_loadu_ps( dy + i ) ) );
+
+		_mm_storeu_ps( dx + i, vx );
+		_mm_storeu_ps( dy + i, vy );
+		_mm_storeu_ps( x + i, _mm_add_ps( px, vx ) );
+		_mm_storeu_ps( y + i, _mm_add_ps( py, vy ) );
+	}
+
+	advance_scalar( x + i, y + i, dx + i, dy + i, aim_x + i, aim_y + i, speed, count - i );
+}
+
+static const kernel_table_t sse2_kernels = {
+	fill16_sse2, fill32_sse2, diff_sse2, advance_sse2
+};
+
+// ---------------------------------------------------------------------------
+//	AVX2 kernels: 32 bytes per step.
+// ---------------------------------------------------------------------------
+
+__attribute__(( target( "avx2" ) ))
+static void fill16_avx2( uint16_t * dest, uint16_t value, size_t count ) {
+	__m256i v = _mm256_set1_epi16( (short) value );
+	size_t i = 0;
+
+	for ( ; i + 16 <= count; i += 16 ) {
+		_mm256_storeu_si256( (__m256i *)( dest + i ), v );
+	}
+
+	for ( ; i < count; i++ ) {
+		dest[i] = value;
+	}
+}
+
+__attribute__(( target( "avx2" ) ))
+static void fill32_avx2( uint32_t * dest, uint32_t value, size_t count ) {
+	__m256i v = _mm256_set1_epi32( (int) value );
+	size_t i = 0;
+
+	for ( ; i + 8 <= count; i += 8 ) {
+		_mm256_storeu_si256( (__m256i *)( dest + i ), v );
+	}
+
+	for ( ; i < count; i++ ) {
+		dest[i] = value;
+	}
+}
+
+__attribute__(( target( "avx2" ) ))
+static unsigned diff_mask_avx2( const uint8_t * a, const uint8_t * b ) {
+	__m256i x = _mm256_loadu_si256( (const __m256i *) a );
+	__m256i y = _mm256_loadu_si256( (const __m256i *) b );
+	return ~(unsigned) _mm256_movemask_epi8( _mm256_cmpeq_epi8( x, y ) );
+}
+
+__attribute__(( target( "avx2" ) ))
+static bool diff_avx2( const uint8_t * a, const uint8_t * b, size_t n, size_t * first, size_t * last ) {
+	size_t i = 0;
+	unsigned mask = 0;
+
+	// Forward scan for the first difference.
+	for ( ; i + 32 <= n; i += 32 ) {
+		if ( ( mask = diff_mask_avx2( a + i, b + i ) ) ) break;
+	}
+
+	if ( mask ) {
+		i += __builtin_ctz( mask );
+	}
+	else {
+		while ( i < n && a[i] == b[i] ) i++;
+		if ( i == n ) return false;
+	}
+
+	// Backward scan for the last difference, which is at or after i.
+	size_t j = n;
+
+	while ( j - i >= 32 ) {
+		j -= 32;
+
+		if ( ( mask = diff_mask_avx2( a + j, b + j ) ) ) {
+			*first = i;
+			*last = j + 31 - __builtin_clz( mask );
+			return true;
+		}
+	}
+
+	do { j--; } while ( a[j] == b[j] );
+
+	*first = i;
+	*last = j;
+	return true;
+}
+
+__attribute__(( target( "avx2" ) ))
+static void advance_avx2( float * x, float * y, float * dx, float * dy, const float * aim_x, const float * aim_y, float speed, size_t count ) {
+	__m256 v_speed = _mm256_set1_ps( speed );
+	__m256 zero = _mm256_setzero_ps();
+	size_t i = 0;
+
+	for ( ; i + 8 <= count; i += 8 ) {
+		__m256 px = _mm256_loadu_ps( x + i );
+		__m256 py = _mm256_loadu_ps( y + i );
+		__m256 t1 = _mm256_sub_ps( _mm256_loadu_ps( aim_x + i ), px );
+		__m256 t2 = _mm256_sub_ps( _mm256_loadu_ps( aim_y + i ), py );
+		__m256 d2 = _mm256_add_ps( _mm256_mul_ps( t1, t1 ), _mm256_mul_ps( t2, t2 ) );
+
+		__m256 steer = _mm256_cmp_ps( d2, zero, _CMP_GT_OQ );
+		__m256 s = _mm256_div_ps( v_speed, _mm256_sqrt_ps( d2 ) );
+		__m256 vx = _mm256_blendv_ps( _mm256_loadu_ps( dx + i ), _mm256_mul_ps( t1, s ), steer );
+		__m256 vy = _mm256_blendv_ps( _mm256_loadu_ps( dy + i ), _mm256_mul_ps( t2, s ), steer );
+
+		_mm256_storeu_ps( dx + i, vx );
+		_mm256_storeu_ps( dy + i, vy );
+		_mm256_storeu_ps( x + i, _mm256_add_ps( px, vx ) );
+		_mm256_storeu_ps( y + i, _mm256_add_ps( py, vy ) );
+	}
+
+	advance_sse2( x + i, y + i, dx + i, dy + i, aim_x + i, aim_y + i, speed, count - i );
+}
+
+static const kernel_table_t avx2_kernels = {
+	fill16_avx2, fill32_avx2, diff_avx2, advance_avx2
+};
+
+#endif
+
+// ---------------------------------------------------------------------------
+//	Dispatch.
+// ---------------------------------------------------------------------------
+
+static const kernel_table_t * kernels = NULL;
+static ZdkKernelLevel kernel_level = ZDK_KERNELS_SCALAR;
+
+static const kernel_table_t * get_kernels( void ) {
+	// Contexts on several threads may race to make the first selection.
+	// Every racer stores the same table, so an atomic load suffices.
+	const kernel_table_t * table = __atomic_load_n( &kernels, __ATOMIC_ACQUIRE );
+
+	if ( !table ) {
+		zdk_select_kernels( ZDK_KERNELS_AVX2 );
+		table = __atomic_load_n( &kernels, __ATOMIC_ACQUIRE );
+	}
+
+	return table;
+}
+
+// ---------------------------------------------------------------------------
+
+ZdkKernelLevel zdk_select_kernels( ZdkKernelLevel level ) {
+	const kernel_table_t * table = &scalar_kernels;
+	ZdkKernelLevel selected = ZDK_KERNELS_SCALAR;
+
+#ifdef ZDK_X86_KERNELS
+	__builtin_cpu_init();
+
+	if ( level >= ZDK_KERNELS_AVX2 && __builtin_cpu_supports( "avx2" ) ) {
+		table = &avx2_kernels;
+		selected = ZDK_KERNELS_AVX2;
+	}
+	else if ( level >= ZDK_KERNELS_SSE2 && __builtin_cpu_supports( "sse2" ) ) {
+		table = &sse2_kernels;
+		selected = ZDK_KERNELS_SSE2;
+	}
+#else
+	(void) level;
+#endif
+
+	__atomic_store_n( &kernel_level, selected, __ATOMIC_RELAXED );
+	__atomic_store_n( &kernels, table, __ATOMIC_RELEASE );
+	return selected;
+}
+
+// ---------------------------------------------------------------------------
+
+ZdkKernelLevel zdk_kernel_level( void ) {
+	get_kernels();
+	return __atomic_load_n( &kernel_level, __ATOMIC_RELAXED );
+}
+
+// ---------------------------------------------------------------------------
+
+const char * zdk_kernel_level_name( ZdkKernelLevel level ) {
+	switch ( level ) {
+	case ZDK_KERNELS_AVX2: return "avx2";
+	case ZDK_KERNELS_SSE2: return "sse2";
+	default: return "scalar";
+	}
+}
+
+// ---------------------------------------------------------------------------
+
+void zdk_fill16( uint16_t * dest, uint16_t value, int count ) {
+	if ( count > 0 ) get_kernels()->fill16( dest, value, count );
+}
+
+// ---------------------------------------------------------------------------
+
+void zdk_fill32( uint32_t * dest, uint32_t value, int count ) {
+	if ( count > 0 ) get_kernels()->fill32( dest, value, count );
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Helper which runs the byte-wise diff kernel over count elements of the
+ *	designated size, and converts the result to element positions.
+ */
+static bool diff_elements( const void * a, const void * b, int count, size_t size, int * first, int * last ) {
+	size_t first_byte, last_byte;
+
+	if ( count <= 0 || !get_kernels()->diff( a, b, count * size, &first_byte, &last_byte ) ) {
+		return false;
+	}
+
+	*first = first_byte / size;
+	*last = last_byte / size;
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+
+bool zdk_diff8( const uint8_t * a, const uint8_t * b, int count, int * first, int * last ) {
+	return diff_elements( a, b, count, sizeof( uint8_t ), first, last );
+}
+
+// ---------------------------------------------------------------------------
+
+bool zdk_diff16( const uint16_t * a, const uint16_t * b, int count, int * first, int * last ) {
+	return diff_elements( a, b, count, sizeof( uint16_t ), first, last );
+}
+
+// ---------------------------------------------------------------------------
+
+bool zdk_diff32( const uint32_t * a, const uint32_t * b, int count, int * first, int * last ) {
+	return diff_elements( a, b, count, sizeof( uint32_t ), first, last );
+}
+
+// ---------------------------------------------------------------------------
+void zdk_advance( float * x, float * y, float * dx, float * dy, const float * aim_x, const float * aim_y, float speed, int count ) {
+	if ( count > 0 ) get_kernels()->advance( x, y, dx, dy, aim_x, aim_y, speed, count );
+}
+// ---------------------------------------------------------------------------
@@ -0,0 +1,125 @@
+/*
+*   cab202_kernels.h
+*
+*   Bulk fill and compare kernels used by the ZDK to clear and diff
+*   screen buffers, and the particle kernel which moves the particles of
+*   cab202_particles.h. Each kernel has a portable scalar implementation and,
+*   on x86 processors, SSE2 and AVX2 implementations. The fastest
+*   implementation supported by the processor is selected at run time.
+*
+*   $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#ifndef __KERNELS_H__
+#define __KERNELS_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ *	Kernel implementation levels, in order of preference.
+ */
+typedef enum ZdkKernelLevel {
+	ZDK_KERNELS_SCALAR,
+	ZDK_KERNELS_SSE2,
+	ZDK_KERNELS_AVX2,
+} ZdkKernelLevel;
+
+/**
+ *	zdk_fill16:
+ *
+ *	Stores a 16-bit value into each element of an array.
+ *
+ *	Input:
+ *	-	dest: the address of the first element.
+ *	-	value: the value to store.
+ *	-	count: the number of elements to fill.
+ *
+ *	Output: void.
+ */
+void zdk_fill16( uint16_t * dest, uint16_t value, int count );
+
+/**
+ *	zdk_fill32:
+ *
+ *	Stores a 32-bit value into each element of an array.
+ *
+ *	Input:
+ *	-	dest: the address of the first element.
+ *	-	value: the value to store.
+ *	-	count: the number of elements to fill.
+ *
+ *	Output: void.
+ */
+void zdk_fill32( uint32_t * dest, uint32_t value, int count );
+
+/**
+ *	zdk_diff8, zdk_diff16, zdk_diff32:
+ *
+ *	Compares two arrays of 8, 16 or 32-bit elements, and finds the first and
+ *	last positions at which they differ.
+ *
+ *	Input:
+ *	-	a, b: the addresses of the arrays to compare.
+ *	-	count: the number of elements to compare.
+ *	-	first, last: the addresses of variables which receive the index of
+ *		the first and last differing element. They are not modified if
+ *		the arrays are equal.
+ *
+ *	Output:
+ *		Returns true if and only if at least one element differs.
+ */
+bool zdk_diff8( const uint8_t * a, const uint8_t * b, int count, int * first, int * last );
+bool zdk_diff16( const uint16_t * a, const uint16_t * b, int count, int * first, int * last );
+bool zdk_diff32( const uint32_t * a, const uint32_t * b, int count, int * first, int * last );
+
+/**
+ *	zdk_advance:
+ *
+ *	Steers each particle towards its aim point at a fixed speed, then moves
+ *	it one step. A particle already at its aim point keeps its velocity.
+ *
+ *	Input:
+ *	-	x, y: the positions, updated in place.
+ *	-	dx, dy: the velocities, updated in place.
+ *	-	aim_x, aim_y: the points the particles head for.
+ *	-	speed: the distance each particle moves per step once steered.
+ *	-	count: the number of particles.
+ *
+ *	Output: void.
+ */
+void zdk_advance( float * x, float * y, float * dx, float * dy, const float * aim_x, const float * aim_y, float speed, int count );
+
+/**
+ *	zdk_select_kernels:
+ *
+ *	Selects the implementation used by subsequent kernel calls. This is
+ *	normally done automatically; it is provided so that benchmarks can
+ *	compare implementations.
+ *
+ *	Input:
+ *	-	level: the preferred implementation level.
+ *
+ *	Output:
+ *		Returns the level actually selected, which is the preferred level
+ *		or, if the processor does not support it, the best lower level.
+ */
+ZdkKernelLevel zdk_select_kernels( ZdkKernelLevel level );
+
+/**
+ *	zdk_kernel_level:
+ *
+ *	Output:
+ *		Returns the implementation level currently in use.
+ */
+ZdkKernelLevel zdk_kernel_level( void );
+
+/**
+ *	zdk_kernel_level_name:
+ *
+ *	Output:
+ *		Returns a short printable name for an implementation level.
+ */
+const char * zdk_kernel_level_name( ZdkKernelLevel level );
+
+#endif
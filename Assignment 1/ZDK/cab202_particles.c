@@ -0,0 +1,157 @@
+/*
+**  cab202_particles.c
+**
+**  Particles stored as a structure of arrays. See cab202_particles.h.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <stdlib.h>
+#include "cab202_kernels.h"
+#include "cab202_particles.h"
+
+// Capacities are kept a multiple of this, the widest vector of floats.
+#define PARTICLE_BLOCK (8)
+
+/*
+**	Helper function which resizes one of the arrays of a set. The array is
+**	unchanged if it cannot be resized.
+*/
+static bool resize_array(float ** array, int capacity) {
+    float * resized = realloc(*array, capacity * sizeof(float));
+
+    if (!resized) return false;
+
+    *array = resized;
+    return true;
+}
+
+/*
+**	Helper function which makes room for at least capacity particles.
+**	The capacity of the set only changes once every array has grown.
+*/
+static bool reserve(ZdkParticles * particles, int capacity) {
+    if (capacity <= particles->capacity) return true;
+
+    capacity = (capacity + PARTICLE_BLOCK - 1) / PARTICLE_BLOCK * PARTICLE_BLOCK;
+
+    bool ok = resize_array(&particles->x, capacity)
+        && resize_array(&particles->y, capacity)
+        && resize_array(&particles->dx, capacity)
+        && resize_array(&particles->dy, capacity)
+        && resize_array(&particles->aim_x, capacity)
+        && resize_array(&particles->aim_y, capacity);
+
+    if (ok) particles->capacity = capacity;
+
+    return ok;
+}
+
+/*
+**	See cab202_particles.h for documentation.
+*/
+bool particles_init(ZdkParticles * particles, int capacity) {
+    ZdkParticles empty = { 0 };
+
+    *particles = empty;
+
+    if (reserve(particles, capacity > 0 ? capacity : PARTICLE_BLOCK)) return true;
+
+    particles_destroy(particles);
+    return false;
+}
+
+/*
+**	See cab202_particles.h for documentation.
+*/
+void particles_destroy(ZdkParticles * particles) {
+    free(particles->x);
+    free(particles->y);
+    free(particles->dx);
+    free(particles->dy);
+    free(particles->aim_x);
+    free(particles->aim_y);
+
+    ZdkParticles empty = { 0 };
+
+    *particles = empty;
+}
+
+/*
+**	See cab202_particles.h for documentation.
+*/
+int particles_add(ZdkParticles * particles, float x, float y) {
+    int i = particles->count;
+
+    if (i == particles->capacity && !reserve(particles, 2 * particles->capacity + PARTICLE_BLOCK)) return -1;
+
+    particles->x[i] = x;
+    particles->y[i] = y;
+    particles->dx[i] = 0;
+    particles->dy[i] = 0;
+    particles->aim_x[i] = x;
+    particles->aim_y[i] = y;
+    particles->count++;
+    return i;
+}
+
+/*
+**	See cab202_particles.h for documentation.
+*/
+void particles_clear(ZdkParticles * particles) {
+    particles->count = 0;
+}
+
+/*
+**	See cab202_particles.h for documentation.
+*/
+void particles_advance(ZdkParticles * particles, float speed) {
+    zdk_advance(particles->x, particles->y, particles->dx, particles->dy,
+        particles->aim_x, particles->aim_y, speed, particles->count);
+}
+
+/*
+**	See cab202_particles.h for documentation.
+*/
+void particles_cells(const ZdkParticles * particles, int width, int height, int * cells) {
+    // A position rounds to 0..width - 1 if and only if it is in (-0.5, width - 0.5).
+    // Comparing before converting keeps positions too large for an int off the screen.
+    float max_x = width - 0.5f;
+    float max_y = height - 0.5f;
+
+    for (int i = 0; i < particles->count; i++) {
+        float x = particles->x[i];
+        float y = particles->y[i];
+        bool on_screen = x > -0.5f && x < max_x && y > -0.5f && y < max_y;
+
+        // Added in double, which is exact, so halves round away from zero as roundf() does.
+        cells[i] = on_screen ? (int)(y + 0.5) * width + (int)(x + 0.5) : -1;
+    }
+}
+
+/*
+**	See cab202_particles.h for documentation.
+*/
+int particles_compact(ZdkParticles * particles, const bool * keep) {
+    int kept = 0;
+
+    for (int i = 0; i < particles->count; i++) {
+        if (!keep[i]) continue;
+
+        if (kept != i) {
+            particles->x[kept] = particles->x[i];
+            particles->y[kept] = particles->y[i];
+            particles->dx[kept] = particles->dx[i];
+            particles->dy[kept] = particles->dy[i];
+            particles->aim_x[kept] = particles->aim_x[i];
+            particles->aim_y[kept] = particles->aim_y[i];
+        }
+
+        kept++;
+    }
+
+    int removed = particles->count - kept;
+
+    particles->count = kept;
+    return removed;
+}
@@ -0,0 +1,117 @@
+/*
+*    cab202_particles.h
+*
+*    Particles stored as a structure of arrays, for games with thousands of
+*    projectiles.
+*
+*    Each member of a particle (x, y, dx, ...) has an array of its own, and
+*    the live particles are always the first count elements of every array,
+*    with no gaps. A step of the simulation is then one pass over each
+*    array, which zdk_advance() (see cab202_kernels.h) runs 4 or 8
+*    particles at a time.
+*
+*    A frame is usually:
+*
+*        1. Set aim_x and aim_y of each particle to the point it should
+*           head for.
+*        2. particles_advance() to steer and move them all.
+*        3. particles_cells() to find the screen cell of each, then check
+*           the cells against the walls and entities in one batch.
+*        4. particles_compact() to remove the particles that hit something.
+*
+*    Particles move when others are removed, so they are identified by
+*    index only until the next particles_compact() or particles_clear().
+*
+*    $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#ifndef PARTICLES_H_
+#define PARTICLES_H_
+
+#include <stdbool.h>
+
+/*
+**    A set of particles.
+**
+**    Members:
+**        count - The number of live particles, which are elements 0 to
+**            count - 1 of each array.
+**
+**        capacity - The length of each array. It grows as particles are
+**            added.
+**
+**        x, y - The positions of the particles.
+**
+**        dx, dy - The velocities of the particles.
+**
+**        aim_x, aim_y - The points the particles steer towards.
+*/
+typedef struct ZdkParticles {
+    int count;
+    int capacity;
+    float * x, * y;
+    float * dx, * dy;
+    float * aim_x, * aim_y;
+} ZdkParticles;
+
+/**
+ *    Sets up an empty set of particles.
+ *
+ *    Input:
+ *        particles - The address of the set.
+ *        capacity - The number of particles to make room for at first.
+ *
+ *    Output: Returns false if the arrays could not be allocated.
+ */
+bool particles_init(ZdkParticles * particles, int capacity);
+
+/**
+ *    Releases the arrays of a set of particles.
+ */
+void particles_destroy(ZdkParticles * particles);
+
+/**
+ *    Adds a stationary particle, aimed at its own position.
+ *
+ *    Output: Returns the index of the new particle, or -1 if there was no
+ *        room and the arrays could not be grown.
+ */
+int particles_add(ZdkParticles * particles, float x, float y);
+
+/**
+ *    Removes every particle.
+ */
+void particles_clear(ZdkParticles * particles);
+
+/**
+ *    Steers every particle towards its aim point and moves it one step, as
+ *    zdk_advance() does.
+ */
+void particles_advance(ZdkParticles * particles, float speed);
+
+/**
+ *    Finds the screen cell of every particle, rounding its position to the
+ *    nearest whole number as draw_char() would.
+ *
+ *    Input:
+ *        particles - The address of the set.
+ *        width, height - The size of the screen.
+ *        cells - An array of at least count elements, which receives
+ *            y * width + x for each particle, or -1 if it is off the
+ *            screen.
+ */
+void particles_cells(const ZdkParticles * particles, int width, int height, int * cells);
+
+/**
+ *    Removes the particles which are not marked to be kept, in one pass.
+ *    The particles which remain keep their order.
+ *
+ *    Input:
+ *        particles - The address of the set.
+ *        keep - An array of count flags, one per particle.
+ *
+ *    Output: Returns the number of particles removed.
+ */
+int particles_compact(ZdkParticles * particles, const bool * keep);
+
+#endif /* PARTICLES_H_ */
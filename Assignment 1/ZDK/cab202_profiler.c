@@ -0,0 +1,196 @@
+/*
+**  cab202_profiler.c
+**
+**  Lightweight instrumentation for named scopes. See cab202_profiler.h.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "cab202_graphics.h"
+#include "cab202_profiler.h"
+#include "cab202_timers.h"
+
+bool zdk_profile_enabled = true;
+
+/*
+**	A registered scope. start is the time of the open profile_begin().
+*/
+struct ZdkProfileScope {
+    char * name;
+    int64_t start;
+    unsigned long count;
+    int64_t total;
+    int64_t max;
+    unsigned long buckets[ZDK_PROFILE_BUCKETS];
+};
+
+static ZdkProfileScope scopes[ZDK_PROFILE_SCOPES];
+static int scope_count = 0;
+
+/*
+**	Helper function which finds the bucket of a duration. Durations below
+**	ZDK_PROFILE_SUB_BUCKETS have a bucket each. Above that, the bucket is
+**	chosen by the position of the leading bit and the two bits after it.
+*/
+static int bucket_of(int64_t ns) {
+    if (ns < ZDK_PROFILE_SUB_BUCKETS) return ns < 0 ? 0 : (int)ns;
+
+    int msb = 63 - __builtin_clzll((unsigned long long)ns);
+    int sub = (int)(ns >> (msb - 2)) & (ZDK_PROFILE_SUB_BUCKETS - 1);
+    int bucket = (msb - 1) * ZDK_PROFILE_SUB_BUCKETS + sub;
+
+    return bucket < ZDK_PROFILE_BUCKETS ? bucket : ZDK_PROFILE_BUCKETS - 1;
+}
+
+/*
+**	Helper function which returns the smallest duration in the bucket after
+**	the given one, which bounds the durations in that bucket.
+*/
+static int64_t bucket_limit(int bucket) {
+    bucket++;
+
+    if (bucket < ZDK_PROFILE_SUB_BUCKETS) return bucket;
+
+    int msb = bucket / ZDK_PROFILE_SUB_BUCKETS + 1;
+    int sub = bucket % ZDK_PROFILE_SUB_BUCKETS;
+
+    return (int64_t)(ZDK_PROFILE_SUB_BUCKETS + sub) << (msb - 2);
+}
+
+/*
+**	See cab202_profiler.h for documentation.
+*/
+ZdkProfileScope * profile_scope(const char * name) {
+    for (int i = 0; i < scope_count; i++) {
+        if (strcmp(scopes[i].name, name) == 0) return &scopes[i];
+    }
+
+    if (scope_count >= ZDK_PROFILE_SCOPES) return NULL;
+
+    ZdkProfileScope * scope = &scopes[scope_count++];
+    scope->name = strdup(name);
+    return scope;
+}
+
+/*
+**	See cab202_profiler.h for documentation.
+*/
+void profile_begin(ZdkProfileScope * scope) {
+    if (scope && zdk_profile_enabled) {
+        scope->start = get_system_ns();
+    }
+}
+
+/*
+**	See cab202_profiler.h for documentation.
+*/
+void profile_end(ZdkProfileScope * scope) {
+    if (scope && zdk_profile_enabled) {
+        profile_record(scope, get_system_ns() - scope->start);
+    }
+}
+
+/*
+**	See cab202_profiler.h for documentation.
+*/
+void profile_record(ZdkProfileScope * scope, int64_t ns) {
+    if (!scope || !zdk_profile_enabled) return;
+
+    scope->count++;
+    scope->total += ns;
+    scope->buckets[bucket_of(ns)]++;
+
+    if (ns > scope->max) scope->max = ns;
+}
+
+/*
+**	Helper function which finds the duration below which a fraction of the
+**	samples of a scope fall.
+*/
+static int64_t percentile(const ZdkProfileScope * scope, double fraction) {
+    unsigned long rank = (unsigned long)(fraction * scope->count + 0.999999);
+    unsigned long seen = 0;
+
+    if (rank < 1) rank = 1;
+
+    for (int i = 0; i < ZDK_PROFILE_BUCKETS; i++) {
+        seen += scope->buckets[i];
+
+        if (seen >= rank) {
+            int64_t limit = bucket_limit(i);
+            return limit < scope->max ? limit : scope->max;
+        }
+    }
+
+    return scope->max;
+}
+
+/*
+**	See cab202_profiler.h for documentation.
+*/
+bool profile_stats(const ZdkProfileScope * scope, ZdkProfileStats * stats) {
+    memset(stats, 0, sizeof(*stats));
+
+    if (!scope || scope->count == 0) return false;
+
+    stats->count = scope->count;
+    stats->mean = scope->total / (int64_t)scope->count;
+    stats->p50 = percentile(scope, 0.50);
+    stats->p95 = percentile(scope, 0.95);
+    stats->p99 = percentile(scope, 0.99);
+    stats->max = scope->max;
+    return true;
+}
+
+/*
+**	See cab202_profiler.h for documentation.
+*/
+void profile_reset(void) {
+    for (int i = 0; i < scope_count; i++) {
+        scopes[i].count = 0;
+        scopes[i].total = 0;
+        scopes[i].max = 0;
+        memset(scopes[i].buckets, 0, sizeof(scopes[i].buckets));
+    }
+}
+
+/*
+**	See cab202_profiler.h for documentation.
+*/
+void profile_dump(FILE * stream) {
+    fprintf(stream, "%-16s %10s %10s %10s %10s %10s %10s\n",
+        "scope (us)", "count", "mean", "p50", "p95", "p99", "max");
+
+    for (int i = 0; i < scope_count; i++) {
+        ZdkProfileStats stats;
+
+        if (!profile_stats(&scopes[i], &stats)) continue;
+
+        fprintf(stream, "%-16s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            scopes[i].name, stats.count, stats.mean / 1e3, stats.p50 / 1e3,
+            stats.p95 / 1e3, stats.p99 / 1e3, stats.max / 1e3);
+    }
+}
+
+/*
+**	See cab202_profiler.h for documentation.
+*/
+void draw_profile(int y) {
+    char buffer[1000];
+    int len = 0;
+
+    buffer[0] = 0;
+
+    for (int i = 0; i < scope_count && len < (int)sizeof(buffer) - 1; i++) {
+        ZdkProfileStats stats;
+
+        if (!profile_stats(&scopes[i], &stats)) continue;
+
+        len += snprintf(buffer + len, sizeof(buffer) - len, "%s%s %.1f/%.1f",
+            len > 0 ? "  " : "", scopes[i].name, stats.p50 / 1e3, stats.p99 / 1e3);
+    }
+
+    draw_string(0, y, buffer);
+}
@@ -0,0 +1,121 @@
+/*
+*    cab202_profiler.h
+*
+*    Lightweight instrumentation for named scopes.
+*
+*    A scope is a named stretch of code, such as one phase of a game loop.
+*    Each time it runs between profile_begin() and profile_end(), its
+*    duration is added to a fixed-bucket histogram, from which percentiles
+*    are read without storing individual samples. Recording a sample reads
+*    the clock once at each end and increments one counter, so profiling
+*    is cheap enough to leave on in finished programs.
+*
+*    Durations are measured with get_system_ns(), so they are real even
+*    under virtual time (see timer_set_virtual).
+*
+*    The histogram buckets are log-linear: every power of two is split
+*    into ZDK_PROFILE_SUB_BUCKETS equal parts, so a percentile is reported
+*    to within 25% of the true value over the whole range from 1 ns to
+*    more than half an hour.
+*
+*    $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+**    The greatest number of scopes which can be registered.
+*/
+#define ZDK_PROFILE_SCOPES (32)
+
+/*
+**    The layout of the histogram buckets.
+*/
+#define ZDK_PROFILE_SUB_BUCKETS (4)
+#define ZDK_PROFILE_BUCKETS (160)
+
+/*
+**    A named scope. Obtain one with profile_scope().
+*/
+typedef struct ZdkProfileScope ZdkProfileScope;
+
+/*
+**    A summary of the samples of a scope. Times are in nanoseconds.
+*/
+typedef struct ZdkProfileStats {
+    unsigned long count;
+    int64_t mean;
+    int64_t p50;
+    int64_t p95;
+    int64_t p99;
+    int64_t max;
+} ZdkProfileStats;
+
+/**
+ *    Recording is skipped while this is false. It is true by default.
+ */
+extern bool zdk_profile_enabled;
+
+/**
+ *    Gets the scope of the given name, registering it if it is new. Look a
+ *    scope up once and keep the address, rather than calling this on every
+ *    frame.
+ *
+ *    Input:
+ *        name - The name of the scope, which is copied.
+ *
+ *    Output: Returns the address of the scope, or NULL if
+ *        ZDK_PROFILE_SCOPES scopes are already registered. The other
+ *        functions accept NULL and ignore it.
+ */
+ZdkProfileScope * profile_scope(const char * name);
+
+/**
+ *    Marks the start of a run of a scope. Scopes may be nested, but a scope
+ *    must not be begun again before it ends.
+ */
+void profile_begin(ZdkProfileScope * scope);
+
+/**
+ *    Marks the end of a run of a scope and adds its duration to the
+ *    histogram.
+ */
+void profile_end(ZdkProfileScope * scope);
+
+/**
+ *    Adds a duration, measured by the caller, to the histogram of a scope.
+ */
+void profile_record(ZdkProfileScope * scope, int64_t ns);
+
+/**
+ *    Summarises the samples of a scope. The percentiles are the upper
+ *    bounds of the buckets in which they fall, limited to the maximum.
+ *
+ *    Output: Returns false if the scope has no samples.
+ */
+bool profile_stats(const ZdkProfileScope * scope, ZdkProfileStats * stats);
+
+/**
+ *    Discards the samples of every scope, keeping the scopes registered.
+ */
+void profile_reset(void);
+
+/**
+ *    Writes a table of every scope which has samples to an output stream,
+ *    with times in microseconds.
+ */
+void profile_dump(FILE * stream);
+
+/**
+ *    Draws a one-line summary of every scope which has samples on row y
+ *    of zdk_screen, in the form "name p50/p99" with times in
+ *    microseconds. Text beyond the right edge of the screen is clipped.
+ */
+void draw_profile(int y);
+
+#endif /* PROFILER_H_ */
@@ -0,0 +1,409 @@
+/*
+**  cab202_recorder.c
+**
+**  Background writer for ZDK screen recordings. See cab202_recorder.h.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cab202_cast.h"
+#include "cab202_recorder.h"
+
+ZdkRecordPolicy zdk_record_policy = ZDK_RECORD_COALESCE;
+
+typedef enum RecordType {
+    RECORD_FRAME,
+    RECORD_CHAR,
+    RECORD_FLUSH,
+    RECORD_STOP,
+} RecordType;
+
+/*
+**	A slot in the ring. The destination streams are captured when the
+**	record is queued, so the writer never reads zdk_save_stream or
+**	zdk_cast_stream. The frame buffers belong to the slot and are reused.
+*/
+typedef struct Record {
+    RecordType type;
+    double time;
+    FILE * text;
+    ZdkCast * cast;
+    int char_code;
+    int width;
+    int height;
+    int capacity;
+    char * pixels;
+    int * colours;
+#ifdef ZDK_PACKED_CELLS
+    ZdkCell * cells;
+#endif
+} Record;
+
+static Record ring[ZDK_RECORDER_SLOTS];
+
+// Next slot to be filled (producer only) and next to be written (writer only).
+static unsigned head = 0;
+static unsigned tail = 0;
+
+// items counts records waiting to be written; spaces counts free slots.
+static sem_t items;
+static sem_t spaces;
+static sem_t flushed;
+
+static pthread_t writer;
+static bool running = false;
+
+// Frame held aside under ZDK_RECORD_COALESCE, and whether it is valid.
+static Record held;
+static bool holding = false;
+
+// Used to write synchronously if the writer thread cannot be started.
+static Record direct;
+
+static ZdkRecorderStats stats = { 0 };
+
+/*
+**	Helper function which waits on a semaphore, retrying if interrupted.
+*/
+static void wait_sem(sem_t * sem) {
+    while (sem_wait(sem) != 0 && errno == EINTR) {}
+}
+
+/*
+**	Helper function which ensures a record can hold cells cells.
+*/
+static bool reserve_cells(Record * r, int cells) {
+    if (r->capacity >= cells) return true;
+
+    char * pixels = realloc(r->pixels, cells);
+    if (pixels) r->pixels = pixels;
+
+    int * colours = realloc(r->colours, cells * sizeof(int));
+    if (colours) r->colours = colours;
+
+#ifdef ZDK_PACKED_CELLS
+    ZdkCell * packed = realloc(r->cells, cells * sizeof(ZdkCell));
+    if (packed) r->cells = packed;
+
+    if (!packed) return false;
+#endif
+
+    if (!pixels || !colours) return false;
+
+    r->capacity = cells;
+    return true;
+}
+
+static void release_record(Record * r) {
+    free(r->pixels);
+    free(r->colours);
+#ifdef ZDK_PACKED_CELLS
+    free(r->cells);
+#endif
+    memset(r, 0, sizeof(*r));
+}
+
+/*
+**	Helper function which copies a screen into a record. Only the raw
+**	cells are copied here; any unpacking is left to the writer.
+*/
+static bool fill_frame(Record * r, Screen * screen, double time) {
+    int n = screen->width * screen->height;
+
+    if (!reserve_cells(r, n)) return false;
+
+    r->type = RECORD_FRAME;
+    r->time = time;
+    r->text = zdk_save_stream;
+    r->cast = zdk_cast_stream;
+    r->width = screen->width;
+    r->height = screen->height;
+
+#ifdef ZDK_PACKED_CELLS
+    memcpy(r->cells, screen->cells, n * sizeof(ZdkCell));
+#else
+    // The planes of an unpacked screen are each a single row-major block.
+    memcpy(r->pixels, screen->pixels[0], n);
+
+    if (r->cast) {
+        memcpy(r->colours, screen->colours[0], n * sizeof(int));
+    }
+#endif
+
+    return true;
+}
+
+/*
+**	Helper function which writes a record to its destination streams. This
+**	runs on the writer thread, or on the caller's thread if the writer
+**	could not be started.
+*/
+static void write_record(Record * r) {
+    switch (r->type) {
+    case RECORD_FRAME:
+#ifdef ZDK_PACKED_CELLS
+        for (int i = 0; i < r->width * r->height; i++) {
+            r->pixels[i] = (char)r->cells[i];
+            r->colours[i] = zdk_cell_colour(r->cells[i]);
+        }
+#endif
+
+        if (r->text) {
+            fprintf(r->text, "Frame(%d,%d,%f)\n", r->width, r->height, r->time);
+
+            for (int y = 0; y < r->height; y++) {
+                fwrite(r->pixels + y * r->width, 1, r->width, r->text);
+                fputc('\n', r->text);
+            }
+
+            fprintf(r->text, "EndFrame\n");
+        }
+
+        cast_write_frame(r->cast, r->width, r->height, r->pixels, r->colours, r->time);
+        __atomic_fetch_add(&stats.written, 1, __ATOMIC_RELAXED);
+        break;
+
+    case RECORD_CHAR:
+        if (r->text) {
+            fprintf(r->text, "Char(%d,%f)\n", r->char_code, r->time);
+        }
+
+        cast_write_char(r->cast, r->char_code, r->time);
+        break;
+
+    case RECORD_FLUSH:
+        if (r->text) fflush(r->text);
+        cast_flush(r->cast);
+        sem_post(&flushed);
+        break;
+
+    case RECORD_STOP:
+        break;
+    }
+}
+
+static void * writer_main(void * arg) {
+    (void)arg;
+
+    for (;;) {
+        wait_sem(&items);
+
+        Record * r = &ring[tail % ZDK_RECORDER_SLOTS];
+        RecordType type = r->type;
+
+        write_record(r);
+        tail++;
+        sem_post(&spaces);
+
+        if (type == RECORD_STOP) break;
+    }
+
+    return NULL;
+}
+
+/*
+**	Helper function which starts the writer thread if it is not running.
+**	Returns false if the thread could not be started.
+*/
+static bool start(void) {
+    if (running) return true;
+
+    head = tail = 0;
+    sem_init(&items, 0, 0);
+    sem_init(&spaces, 0, ZDK_RECORDER_SLOTS);
+    sem_init(&flushed, 0, 0);
+
+    // The writer must not handle signals such as Ctrl-C, because the
+    // handler exits the program, and cleanup_screen joins the writer.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    running = pthread_create(&writer, NULL, writer_main, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (!running) {
+        sem_destroy(&items);
+        sem_destroy(&spaces);
+        sem_destroy(&flushed);
+    }
+
+    return running;
+}
+
+/*
+**	Helper function which obtains the next free slot. If none is free,
+**	returns NULL or, if wait is true, waits for the writer.
+*/
+static Record * acquire(bool wait) {
+    if (sem_trywait(&spaces) != 0) {
+        if (!wait) return NULL;
+
+        stats.blocked++;
+        wait_sem(&spaces);
+    }
+
+    return &ring[head % ZDK_RECORDER_SLOTS];
+}
+
+/*
+**	Helper function which hands the slot obtained by acquire to the writer.
+*/
+static void publish(void) {
+    head++;
+    sem_post(&items);
+
+    int depth;
+
+    if (sem_getvalue(&items, &depth) == 0 && depth > stats.max_depth) {
+        stats.max_depth = depth;
+    }
+}
+
+/*
+**	Helper function which moves the held frame into the ring. The buffers
+**	are exchanged rather than copied.
+*/
+static bool queue_held(bool wait) {
+    if (!holding) return true;
+
+    Record * slot = acquire(wait);
+
+    if (!slot) return false;
+
+    Record spare = *slot;
+    *slot = held;
+    held = spare;
+    holding = false;
+    publish();
+    stats.queued++;
+    return true;
+}
+
+/*
+**	See cab202_recorder.h for documentation.
+*/
+void recorder_write_screen(Screen * screen, double time) {
+    if (!screen || (!zdk_save_stream && !zdk_cast_stream)) return;
+
+    if (!start()) {
+        if (fill_frame(&direct, screen, time)) write_record(&direct);
+        return;
+    }
+
+    // A held frame must be queued first, to keep frames in order.
+    queue_held(false);
+
+    Record * slot = holding ? NULL : acquire(zdk_record_policy == ZDK_RECORD_BLOCK);
+
+    if (slot) {
+        if (fill_frame(slot, screen, time)) {
+            publish();
+            stats.queued++;
+        }
+        else {
+            // Return the slot unused.
+            sem_post(&spaces);
+        }
+    }
+    else if (zdk_record_policy == ZDK_RECORD_COALESCE) {
+        if (holding) stats.coalesced++;
+        holding = fill_frame(&held, screen, time);
+    }
+    else {
+        stats.dropped++;
+    }
+}
+
+/*
+**	See cab202_recorder.h for documentation.
+*/
+void recorder_write_char(int char_code, double time) {
+    if (!zdk_save_stream && !zdk_cast_stream) return;
+
+    Record * r = &direct;
+
+    if (start()) {
+        queue_held(true);
+        r = acquire(true);
+    }
+
+    r->type = RECORD_CHAR;
+    r->time = time;
+    r->text = zdk_save_stream;
+    r->cast = zdk_cast_stream;
+    r->char_code = char_code;
+
+    if (running) {
+        publish();
+    }
+    else {
+        write_record(r);
+    }
+}
+
+/*
+**	See cab202_recorder.h for documentation.
+*/
+void recorder_service(void) {
+    if (running) queue_held(false);
+}
+
+/*
+**	See cab202_recorder.h for documentation.
+*/
+void recorder_flush(void) {
+    if (!running) {
+        if (zdk_save_stream) fflush(zdk_save_stream);
+        cast_flush(zdk_cast_stream);
+        return;
+    }
+
+    queue_held(true);
+
+    Record * r = acquire(true);
+    r->type = RECORD_FLUSH;
+    r->text = zdk_save_stream;
+    r->cast = zdk_cast_stream;
+    publish();
+
+    wait_sem(&flushed);
+}
+
+/*
+**	See cab202_recorder.h for documentation.
+*/
+void recorder_stop(void) {
+    if (!running) return;
+
+    recorder_flush();
+
+    acquire(true)->type = RECORD_STOP;
+    publish();
+    pthread_join(writer, NULL);
+    running = false;
+
+    sem_destroy(&items);
+    sem_destroy(&spaces);
+    sem_destroy(&flushed);
+
+    for (int i = 0; i < ZDK_RECORDER_SLOTS; i++) {
+        release_record(&ring[i]);
+    }
+
+    release_record(&held);
+    release_record(&direct);
+}
+
+/*
+**	See cab202_recorder.h for documentation.
+*/
+void recorder_get_stats(ZdkRecorderStats * s) {
+    *s = stats;
+    s->written = __atomic_load_n(&stats.written, __ATOMIC_RELAXED);
+}
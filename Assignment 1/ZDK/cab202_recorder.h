@@ -0,0 +1,125 @@
+/*
+*    cab202_recorder.h
+*
+*    Background writer for ZDK screen recordings.
+*
+*    The recorder serves the default context (see ZdkContext). When
+*    zdk_save_stream or zdk_cast_stream is set, show_screen() and the
+*    keyboard functions do not write to them directly. Instead they copy
+*    each frame, or key event, into a slot of a bounded ring buffer, and a
+*    dedicated writer thread formats and writes the records. The render
+*    loop therefore never waits for stdio or disk I/O unless the ring is
+*    full and zdk_record_policy is ZDK_RECORD_BLOCK.
+*
+*    The ring has a single producer (the thread which calls show_screen)
+*    and a single consumer (the writer thread). Slots are handed between
+*    them by a pair of counting semaphores, so neither side takes a lock.
+*
+*    $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#ifndef RECORDER_H_
+#define RECORDER_H_
+
+#include <stdbool.h>
+#include "cab202_graphics.h"
+
+/*
+**    Number of slots in the ring buffer.
+*/
+#define ZDK_RECORDER_SLOTS (64)
+
+/*
+**    Action taken when a frame is recorded while every slot of the ring is
+**    waiting to be written.
+**
+**    ZDK_RECORD_BLOCK - Wait for the writer to free a slot. No frame is
+**        lost, but a slow disk stalls the caller of show_screen().
+**
+**    ZDK_RECORD_DROP - Discard the new frame.
+**
+**    ZDK_RECORD_COALESCE - Hold the new frame aside, replacing any frame
+**        already held, and queue it as soon as a slot becomes free. Frames
+**        are lost only while the writer is behind, and the most recent
+**        frame is always written eventually.
+**
+**    Key events are never discarded: a key event waits for a free slot
+**    under every policy.
+*/
+typedef enum ZdkRecordPolicy {
+    ZDK_RECORD_BLOCK,
+    ZDK_RECORD_DROP,
+    ZDK_RECORD_COALESCE,
+} ZdkRecordPolicy;
+
+/*
+**    The policy applied when the ring is full. The default is
+**    ZDK_RECORD_COALESCE, so recording never delays the render loop.
+*/
+extern ZdkRecordPolicy zdk_record_policy;
+
+/*
+**    Recorder counters. All are totals since the recorder started.
+**
+**    Members:
+**        queued - Frames placed in the ring.
+**        written - Frames written by the writer thread.
+**        dropped - Frames discarded under ZDK_RECORD_DROP.
+**        coalesced - Held frames replaced by a newer frame under
+**            ZDK_RECORD_COALESCE.
+**        blocked - Frames and key events which had to wait for a free slot.
+**        max_depth - The largest number of records waiting in the ring.
+*/
+typedef struct ZdkRecorderStats {
+    unsigned long queued;
+    unsigned long written;
+    unsigned long dropped;
+    unsigned long coalesced;
+    unsigned long blocked;
+    int max_depth;
+} ZdkRecorderStats;
+
+/**
+ *    Queues a copy of a screen for writing to zdk_save_stream and/or
+ *    zdk_cast_stream. Does nothing if both are NULL. The writer thread is
+ *    started if necessary.
+ *
+ *    Input:
+ *        screen - The address of the screen to record.
+ *        time - The time stamp of the frame.
+ *
+ *    Output: void.
+ */
+void recorder_write_screen(Screen * screen, double time);
+
+/**
+ *    Queues a key event for writing to zdk_save_stream and/or
+ *    zdk_cast_stream. Does nothing if both are NULL.
+ */
+void recorder_write_char(int char_code, double time);
+
+/**
+ *    Queues a held frame (see ZDK_RECORD_COALESCE) if a slot is free,
+ *    without waiting. show_screen() calls this on every frame.
+ */
+void recorder_service(void);
+
+/**
+ *    Waits until every record queued so far has been written and the
+ *    destination streams have been flushed. Call this before closing or
+ *    reading zdk_save_stream or zdk_cast_stream.
+ */
+void recorder_flush(void);
+
+/**
+ *    Flushes the recorder and stops the writer thread. The recorder
+ *    restarts automatically if another record is queued.
+ */
+void recorder_stop(void);
+
+/**
+ *    Copies the recorder counters into *stats.
+ */
+void recorder_get_stats(ZdkRecorderStats * stats);
+
+#endif /* RECORDER_H_ */
@@ -0,0 +1,375 @@
+/*
+**  cab202_rooms.c
+**
+**  Room files and binary level packs. See cab202_rooms.h for a
+**  description of both formats.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cab202_rooms.h"
+
+#define PACK_MAGIC "ZDKLVLP1"
+#define PACK_MAGIC_LEN (8)
+#define PACK_BYTE_ORDER (0x01020304)
+
+#define PACK_HAS_JERRY (1)
+#define PACK_HAS_TOM (2)
+
+#define FNV_OFFSET (14695981039346656037ULL)
+#define FNV_PRIME (1099511628211ULL)
+
+// Digits beyond FAST_DIGITS are not kept in the mantissa. A number is only
+// converted without strtof() if its mantissa and power of ten are both exact
+// in a float, so that one division or multiplication rounds it correctly.
+#define FAST_DIGITS (15)
+#define FAST_MANTISSA (1 << 24)
+#define FAST_EXPONENT (10)
+
+typedef struct PackHeader {
+    char magic[PACK_MAGIC_LEN];
+    uint32_t byte_order;
+    uint32_t number_of_rooms;
+    uint32_t number_of_walls;
+    uint32_t reserved;
+    uint64_t checksum;
+} PackHeader;
+
+typedef struct PackRoom {
+    float jerry_x, jerry_y;
+    float tom_x, tom_y;
+    uint32_t flags;
+    uint32_t first_wall;
+    uint32_t number_of_walls;
+    uint32_t reserved;
+} PackRoom;
+
+struct ZdkLevelPack {
+    const char * data;
+    size_t length;
+    const PackHeader * header;
+    const PackRoom * rooms;
+    const RoomWall * walls;
+};
+
+static const float powers_of_ten[FAST_EXPONENT + 1] = {
+    1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+};
+
+/*
+**	See cab202_rooms.h for documentation.
+*/
+const char * map_room_file(const char * file_name, size_t * length) {
+    int fd = open(file_name, O_RDONLY);
+    struct stat info;
+
+    if (fd < 0) return NULL;
+
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    *length = (size_t)info.st_size;
+
+    // An empty file cannot be mapped, but it is a valid (empty) room.
+    if (*length == 0) {
+        close(fd);
+        return "";
+    }
+
+    void * text = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (text == MAP_FAILED) return NULL;
+
+    return text;
+}
+
+/*
+**	See cab202_rooms.h for documentation.
+*/
+void unmap_room_file(const char * text, size_t length) {
+    if (text && length > 0) munmap((void *)text, length);
+}
+
+static bool is_space(char ch) {
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+
+static bool is_digit(char ch) {
+    return ch >= '0' && ch <= '9';
+}
+
+/*
+**	Helper function which reads a decimal number, as fscanf("%f") would,
+**	from the text between p and end. Numbers whose digits and power of ten
+**	are exact in a float are scaled with one correctly rounded division or
+**	multiplication; others are copied out for strtof().
+**	Returns the address after the number, or NULL if there is none.
+*/
+static const char * parse_number(const char * p, const char * end, float * value) {
+    const char * start = p;
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool negative = false;
+    bool any = false;
+
+    if (p < end && (*p == '+' || *p == '-')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    for (; p < end && is_digit(*p); p++) {
+        any = true;
+        if (mantissa > 0 || *p != '0') digits++;
+        if (digits <= FAST_DIGITS) mantissa = mantissa * 10 + (*p - '0');
+        else exponent++;
+    }
+
+    if (p < end && *p == '.') {
+        for (p++; p < end && is_digit(*p); p++) {
+            any = true;
+            if (mantissa > 0 || *p != '0') digits++;
+            if (digits <= FAST_DIGITS) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+        }
+    }
+
+    if (!any) return NULL;
+
+    if (p + 1 < end && (*p == 'e' || *p == 'E')) {
+        const char * q = p + 1;
+        bool negative_exponent = false;
+        int e = 0;
+
+        if (q < end && (*q == '+' || *q == '-')) {
+            negative_exponent = *q == '-';
+            q++;
+        }
+
+        if (q < end && is_digit(*q)) {
+            for (; q < end && is_digit(*q); q++) {
+                if (e < 10000) e = e * 10 + (*q - '0');
+            }
+
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    if (digits <= FAST_DIGITS && mantissa < FAST_MANTISSA && exponent >= -FAST_EXPONENT && exponent <= FAST_EXPONENT) {
+        float x = (float)mantissa;
+
+        x = exponent < 0 ? x / powers_of_ten[-exponent] : x * powers_of_ten[exponent];
+        *value = negative ? -x : x;
+    }
+    else {
+        char buffer[64];
+        size_t n = (size_t)(p - start);
+
+        if (n >= sizeof(buffer)) n = sizeof(buffer) - 1;
+
+        memcpy(buffer, start, n);
+        buffer[n] = 0;
+        *value = strtof(buffer, NULL);
+    }
+
+    return p;
+}
+
+/*
+**	See cab202_rooms.h for documentation.
+*/
+int parse_room(const char * text, size_t length, Room * room, RoomWall * walls, int max_walls) {
+    const char * p = text;
+    const char * end = text + length;
+    int number_of_walls = 0;
+
+    memset(room, 0, sizeof(*room));
+    room->walls = walls;
+
+    for (;;) {
+        while (p < end && is_space(*p)) p++;
+
+        if (p >= end) break;
+
+        char command = *p++;
+        float values[4];
+        int count = 0;
+
+        while (count < 4) {
+            while (p < end && is_space(*p)) p++;
+
+            const char * next = parse_number(p, end, &values[count]);
+
+            if (!next) break;
+
+            p = next;
+            count++;
+        }
+
+        if (count == 2 && command == 'J') {
+            room->has_jerry = true;
+            room->jerry_x = values[0];
+            room->jerry_y = values[1];
+        }
+        else if (count == 2 && command == 'T') {
+            room->has_tom = true;
+            room->tom_x = values[0];
+            room->tom_y = values[1];
+        }
+        else if (count == 4 && command == 'W') {
+            if (number_of_walls < max_walls) {
+                RoomWall * wall = &walls[number_of_walls];
+                wall->x1 = values[0];
+                wall->y1 = values[1];
+                wall->x2 = values[2];
+                wall->y2 = values[3];
+            }
+
+            number_of_walls++;
+        }
+    }
+
+    room->number_of_walls = number_of_walls < max_walls ? number_of_walls : max_walls;
+    return number_of_walls;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void * data, size_t n) {
+    const unsigned char * bytes = data;
+
+    for (size_t i = 0; i < n; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/*
+**	See cab202_rooms.h for documentation.
+*/
+bool levelpack_write(const char * file_name, const Room * rooms, int number_of_rooms) {
+    FILE * f = fopen(file_name, "wb");
+
+    if (!f) return false;
+
+    PackHeader header = { PACK_MAGIC, PACK_BYTE_ORDER, (uint32_t)number_of_rooms, 0, 0, FNV_OFFSET };
+
+    // The header is written again at the end, with the totals and checksum.
+    fwrite(&header, sizeof(header), 1, f);
+
+    for (int i = 0; i < number_of_rooms; i++) {
+        const Room * room = &rooms[i];
+        PackRoom record = {
+            room->jerry_x, room->jerry_y, room->tom_x, room->tom_y,
+            (room->has_jerry ? PACK_HAS_JERRY : 0) | (room->has_tom ? PACK_HAS_TOM : 0),
+            header.number_of_walls, (uint32_t)room->number_of_walls, 0,
+        };
+
+        fwrite(&record, sizeof(record), 1, f);
+        header.checksum = fnv1a(header.checksum, &record, sizeof(record));
+        header.number_of_walls += record.number_of_walls;
+    }
+
+    for (int i = 0; i < number_of_rooms; i++) {
+        size_t n = rooms[i].number_of_walls * sizeof(RoomWall);
+
+        fwrite(rooms[i].walls, 1, n, f);
+        header.checksum = fnv1a(header.checksum, rooms[i].walls, n);
+    }
+
+    rewind(f);
+    fwrite(&header, sizeof(header), 1, f);
+
+    bool ok = !ferror(f);
+
+    return fclose(f) == 0 && ok;
+}
+
+/*
+**	See cab202_rooms.h for documentation.
+*/
+ZdkLevelPack * levelpack_open(const char * file_name) {
+    size_t length;
+    const char * data = map_room_file(file_name, &length);
+
+    if (!data) return NULL;
+
+    const PackHeader * header = (const PackHeader *)data;
+    bool ok = length >= sizeof(PackHeader)
+        && memcmp(header->magic, PACK_MAGIC, PACK_MAGIC_LEN) == 0
+        && header->byte_order == PACK_BYTE_ORDER
+        && length == sizeof(PackHeader)
+            + (uint64_t)header->number_of_rooms * sizeof(PackRoom)
+            + (uint64_t)header->number_of_walls * sizeof(RoomWall)
+        && header->number_of_rooms <= INT32_MAX
+        && fnv1a(FNV_OFFSET, data + sizeof(PackHeader), length - sizeof(PackHeader)) == header->checksum;
+
+    const PackRoom * rooms = (const PackRoom *)(data + sizeof(PackHeader));
+
+    for (uint32_t i = 0; ok && i < header->number_of_rooms; i++) {
+        ok = (uint64_t)rooms[i].first_wall + rooms[i].number_of_walls <= header->number_of_walls;
+    }
+
+    ZdkLevelPack * pack = ok ? malloc(sizeof(ZdkLevelPack)) : NULL;
+
+    if (!pack) {
+        unmap_room_file(data, length);
+        return NULL;
+    }
+
+    pack->data = data;
+    pack->length = length;
+    pack->header = header;
+    pack->rooms = rooms;
+    pack->walls = (const RoomWall *)(rooms + header->number_of_rooms);
+    return pack;
+}
+
+/*
+**	See cab202_rooms.h for documentation.
+*/
+int levelpack_rooms(const ZdkLevelPack * pack) {
+    return (int)pack->header->number_of_rooms;
+}
+
+/*
+**	See cab202_rooms.h for documentation.
+*/
+bool levelpack_room(const ZdkLevelPack * pack, int index, Room * room) {
+    if (index < 0 || index >= levelpack_rooms(pack)) return false;
+
+    const PackRoom * record = &pack->rooms[index];
+
+    room->has_jerry = (record->flags & PACK_HAS_JERRY) != 0;
+    room->has_tom = (record->flags & PACK_HAS_TOM) != 0;
+    room->jerry_x = record->jerry_x;
+    room->jerry_y = record->jerry_y;
+    room->tom_x = record->tom_x;
+    room->tom_y = record->tom_y;
+    room->number_of_walls = (int)record->number_of_walls;
+    room->walls = pack->walls + record->first_wall;
+    return true;
+}
+
+/*
+**	See cab202_rooms.h for documentation.
+*/
+void levelpack_close(ZdkLevelPack * pack) {
+    if (!pack) return;
+
+    unmap_room_file(pack->data, pack->length);
+    free(pack);
+}
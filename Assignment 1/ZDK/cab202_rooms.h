@@ -0,0 +1,167 @@
+/*
+*    cab202_rooms.h
+*
+*    Room files and binary level packs.
+*
+*    A room file is a text file of commands, one per line:
+*
+*        J x y               The starting position of Jerry.
+*        T x y               The starting position of Tom.
+*        W x1 y1 x2 y2       A wall from (x1,y1) to (x2,y2).
+*
+*    Coordinates are fractions of the width and height of the playing
+*    area, so a room fits any screen. Commands with the wrong number of
+*    values are ignored, and when J or T appears more than once the last
+*    one counts.
+*
+*    parse_room() reads a whole room in one pass over text in memory,
+*    usually a file mapped with map_room_file(). It allocates nothing and
+*    reads exactly the values fscanf("%c %f %f %f %f") would.
+*
+*    A level pack holds many rooms, compiled in advance with
+*    levelpack_write() (see zdk_levelpack.c). Its coordinates are the same
+*    fractions, stored as floats, so a pack is also resolution-independent.
+*    levelpack_open() maps the pack and checks it, after which the rooms are
+*    read in place without parsing or copying.
+*
+*    Pack layout (all integers are unsigned and in host byte order):
+*
+*        "ZDKLVLP1"                      8-byte magic number.
+*        byte_order (4 bytes)            0x01020304, as written.
+*        number_of_rooms (4 bytes)
+*        number_of_walls (4 bytes)       The total over all rooms.
+*        reserved (4 bytes)              0.
+*        checksum (8 bytes)              64-bit FNV-1a of everything after
+*                                        the header.
+*
+*        room * number_of_rooms:         jerry_x, jerry_y, tom_x, tom_y
+*                                        (4-byte floats), flags (4 bytes;
+*                                        1 = has Jerry, 2 = has Tom),
+*                                        first_wall, number_of_walls,
+*                                        reserved (4 bytes each).
+*
+*        wall * number_of_walls:         x1, y1, x2, y2 (4-byte floats).
+*                                        The walls of each room are
+*                                        consecutive.
+*
+*    $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#ifndef ROOMS_H_
+#define ROOMS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+**    A wall, in fractions of the playing area.
+*/
+typedef struct RoomWall {
+    float x1, y1, x2, y2;
+} RoomWall;
+
+/*
+**    A room.
+**
+**    Members:
+**        has_jerry, has_tom - Whether the room gives a starting position.
+**
+**        jerry_x, jerry_y, tom_x, tom_y - The starting positions, in
+**            fractions of the playing area, or 0 if not given.
+**
+**        number_of_walls, walls - The walls of the room. The array belongs
+**            to whoever filled in the room.
+*/
+typedef struct Room {
+    bool has_jerry;
+    bool has_tom;
+    float jerry_x, jerry_y;
+    float tom_x, tom_y;
+    int number_of_walls;
+    const RoomWall * walls;
+} Room;
+
+/*
+**    A level pack opened for reading. The structure is private to
+**    cab202_rooms.c.
+*/
+typedef struct ZdkLevelPack ZdkLevelPack;
+
+/**
+ *    Maps a file into memory, read-only.
+ *
+ *    Input:
+ *        file_name - The name of the file.
+ *        length - The address of a variable which receives the length of
+ *            the file.
+ *
+ *    Output: Returns the address of the contents, or NULL if the file could
+ *        not be opened. Release it with unmap_room_file().
+ */
+const char * map_room_file(const char * file_name, size_t * length);
+
+/**
+ *    Releases a file mapped by map_room_file().
+ */
+void unmap_room_file(const char * text, size_t length);
+
+/**
+ *    Parses a room file held in memory. The text need not be terminated.
+ *
+ *    Input:
+ *        text, length - The contents of the room file.
+ *        room - The address of a Room which receives the room. Its walls
+ *            member is set to walls.
+ *        walls - An array which receives the walls.
+ *        max_walls - The length of walls. Walls beyond it are counted but
+ *            not stored.
+ *
+ *    Output: Returns the number of walls in the room. If it is greater than
+ *        max_walls, room->number_of_walls is max_walls, and the room may be
+ *        parsed again with a larger array.
+ */
+int parse_room(const char * text, size_t length, Room * room, RoomWall * walls, int max_walls);
+
+/**
+ *    Writes a level pack, replacing any existing file of that name.
+ *
+ *    Input:
+ *        file_name - The name of the file.
+ *        rooms, number_of_rooms - The rooms, in order.
+ *
+ *    Output: Returns true if and only if the whole pack was written.
+ */
+bool levelpack_write(const char * file_name, const Room * rooms, int number_of_rooms);
+
+/**
+ *    Maps a level pack and checks its size, structure and checksum.
+ *
+ *    Output: Returns the address of a new pack, or NULL if the file could
+ *        not be opened or is not a valid level pack.
+ */
+ZdkLevelPack * levelpack_open(const char * file_name);
+
+/**
+ *    Gets the number of rooms in a level pack.
+ */
+int levelpack_rooms(const ZdkLevelPack * pack);
+
+/**
+ *    Gets a room from a level pack. The walls point into the pack, and
+ *    remain valid until it is closed.
+ *
+ *    Input:
+ *        pack - The address of a pack.
+ *        index - The index of the room, from 0.
+ *        room - The address of a Room which receives the room.
+ *
+ *    Output: Returns false if there is no room of that index.
+ */
+bool levelpack_room(const ZdkLevelPack * pack, int index, Room * room);
+
+/**
+ *    Unmaps a level pack and releases all resources associated with it.
+ */
+void levelpack_close(ZdkLevelPack * pack);
+
+#endif /* ROOMS_H_ */
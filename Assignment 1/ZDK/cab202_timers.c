@@ -11,6 +11,7 @@
 
 #include "cab202_timers.h"
 #include <assert.h>
+#include <errno.h>
 #include <stdlib.h>
 
 
@@ -74,6 +75,19 @@ bool timer_expired( timer_id timer ) {
 
 // ---------------------------------------------------------------------------
 
+/*
+ *	Virtual clock. While virtual_time is set, virtual_ns is the current
+ *	time, and only the sleeping functions move it. virtual_origin_ns and
+ *	virtual_origin_time are the system clocks when it was started, so that
+ *	get_current_time() continues from the wall clock.
+ */
+static bool virtual_time = false;
+static int64_t virtual_ns = 0;
+static int64_t virtual_origin_ns = 0;
+static double virtual_origin_time = 0;
+
+// ---------------------------------------------------------------------------
+
 void( *zdk_timer_pause )( long milliseconds ) = NULL;
 
 // ---------------------------------------------------------------------------
@@ -82,6 +96,9 @@ void timer_pause( long milliseconds ) {
 	if ( zdk_timer_pause ) {
 		zdk_timer_pause( milliseconds );
 	}
+	else if ( virtual_time ) {
+		virtual_ns += milliseconds * NS_PER_MILLISECOND;
+	}
 	else {
 #ifdef WIN32
 		Sleep( milliseconds );
@@ -103,6 +120,9 @@ double get_current_time() {
 	if ( zdk_get_current_time ) {
 		return zdk_get_current_time();
 	}
+	else if ( virtual_time ) {
+		return virtual_origin_time + ( virtual_ns - virtual_origin_ns ) / 1.0e+9;
+	}
 	else {
 		struct timespec timeval;
 
@@ -125,6 +145,758 @@ double get_current_time() {
 
 // ---------------------------------------------------------------------------
 
+int64_t get_current_ns( void ) {
+	if ( zdk_get_current_time ) {
+		return (int64_t)( zdk_get_current_time() * NS_PER_SECOND );
+	}
+
+	if ( virtual_time ) {
+		return virtual_ns;
+	}
+
+	return get_system_ns();
+}
+
+// ---------------------------------------------------------------------------
+
+int64_t get_system_ns( void ) {
+#ifdef WIN32
+	LARGE_INTEGER count, frequency;
+	QueryPerformanceCounter( &count );
+	QueryPerformanceFrequency( &frequency );
+	return (int64_t)( (double)count.QuadPart * NS_PER_SECOND / frequency.QuadPart );
+#else
+	struct timespec timeval;
+
+#ifdef __MACH__ // SYSTEM_CLOCK counts from boot and is not adjusted.
+	clock_serv_t cclock;
+	mach_timespec_t mts;
+	host_get_clock_service(mach_host_self(), SYSTEM_CLOCK, &cclock);
+	clock_get_time(cclock, &mts);
+	mach_port_deallocate(mach_task_self(), cclock);
+	timeval.tv_sec = mts.tv_sec;
+	timeval.tv_nsec = mts.tv_nsec;
+#else
+	clock_gettime( CLOCK_MONOTONIC, &timeval );
+#endif
+
+	return timeval.tv_sec * NS_PER_SECOND + timeval.tv_nsec;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+
+pacer_id create_pacer( int64_t period ) {
+	assert( period > 0 );
+
+	pacer_id pacer = malloc( sizeof( cab202_pacer_t ) );
+
+	pacer->period = period;
+	pacer_reset( pacer );
+
+	return pacer;
+}
+
+// ---------------------------------------------------------------------------
+
+void destroy_pacer( pacer_id pacer ) {
+	assert( pacer != NULL );
+
+	free( pacer );
+}
+
+// ---------------------------------------------------------------------------
+
+void pacer_reset( pacer_id pacer ) {
+	assert( pacer != NULL );
+
+	int64_t period = pacer->period;
+
+	*pacer = (cab202_pacer_t) { 0 };
+	pacer->period = period;
+	pacer->deadline = get_current_ns() + period;
+}
+
+// ---------------------------------------------------------------------------
+
+void pacer_resume( pacer_id pacer ) {
+	assert( pacer != NULL );
+
+	pacer->deadline = get_current_ns() + pacer->period;
+	pacer->overran = false;
+}
+
+// ---------------------------------------------------------------------------
+
+void timer_sleep_until( int64_t deadline ) {
+	int64_t now = get_current_ns();
+
+	if ( now >= deadline ) return;
+
+	// The time hooks measure time in their own way, so when either is set
+	// the pause is made through timer_pause() instead.
+	if ( zdk_timer_pause || zdk_get_current_time ) {
+		timer_pause( (long)( ( deadline - now + NS_PER_MILLISECOND - 1 ) / NS_PER_MILLISECOND ) );
+		return;
+	}
+
+	// Virtual time jumps straight to the deadline, without rounding.
+	if ( virtual_time ) {
+		virtual_ns = deadline;
+		return;
+	}
+
+#if defined(WIN32)
+	Sleep( (DWORD)( ( deadline - now + NS_PER_MILLISECOND - 1 ) / NS_PER_MILLISECOND ) );
+#elif defined(__MACH__)
+	struct timespec interval = { ( deadline - now ) / NS_PER_SECOND, ( deadline - now ) % NS_PER_SECOND };
+	nanosleep( &interval, NULL );
+#else
+	struct timespec when = { deadline / NS_PER_SECOND, deadline % NS_PER_SECOND };
+
+	while ( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &when, NULL ) == EINTR ) {}
+#endif
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Starts a frame at time now, which is not before the deadline: records
+ *	the lateness and moves on to the next deadline.
+ */
+static int64_t pacer_start( pacer_id pacer, int64_t now ) {
+	int64_t lateness = now > pacer->deadline ? now - pacer->deadline : 0;
+
+	pacer->total_lateness += lateness;
+
+	if ( lateness > pacer->max_lateness ) {
+		pacer->max_lateness = lateness;
+	}
+
+	pacer->deadline += pacer->period;
+	pacer->overran = false;
+
+	// If the next deadline has passed too, skip ahead rather than run a
+	// burst of frames to catch up.
+	if ( now >= pacer->deadline ) {
+		int64_t missed = ( now - pacer->deadline ) / pacer->period + 1;
+		pacer->skipped += missed;
+		pacer->deadline += missed * pacer->period;
+	}
+
+	return lateness;
+}
+
+// ---------------------------------------------------------------------------
+
+int64_t pacer_wait( pacer_id pacer ) {
+	assert( pacer != NULL );
+
+	int64_t now = get_current_ns();
+
+	pacer->frames++;
+
+	if ( now < pacer->deadline ) {
+		timer_sleep_until( pacer->deadline );
+		now = get_current_ns();
+
+		if ( now - pacer->deadline > PACER_LATE_NS ) {
+			pacer->late++;
+		}
+	}
+	else {
+		pacer->overruns++;
+	}
+
+	return pacer_start( pacer, now );
+}
+
+// ---------------------------------------------------------------------------
+
+bool pacer_poll( pacer_id pacer ) {
+	assert( pacer != NULL );
+
+	int64_t now = get_current_ns();
+
+	if ( now < pacer->deadline ) return false;
+
+	pacer->frames++;
+
+	if ( !pacer->overran && now - pacer->deadline > PACER_LATE_NS ) {
+		pacer->late++;
+	}
+
+	pacer_start( pacer, now );
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+
+void pacer_idle( pacer_id pacer ) {
+	assert( pacer != NULL );
+
+	if ( !pacer->overran && get_current_ns() >= pacer->deadline ) {
+		pacer->overran = true;
+		pacer->overruns++;
+	}
+}
+
+// ---------------------------------------------------------------------------
+
+void dump_pacer( FILE * stream, const char * label, pacer_id pacer ) {
+	if ( !pacer ) {
+		fprintf( stream, "%s: NULL pointer\n", label );
+		return;
+	}
+
+	fprintf( stream, "%s->%s: %.3f ms\n", label, "period", pacer->period / 1.0e+6 );
+	fprintf( stream, "%s->%s: %lu\n", label, "frames", pacer->frames );
+	fprintf( stream, "%s->%s: %lu\n", label, "overruns", pacer->overruns );
+	fprintf( stream, "%s->%s: %lu\n", label, "late", pacer->late );
+	fprintf( stream, "%s->%s: %lu\n", label, "skipped", pacer->skipped );
+	fprintf( stream, "%s->%s: %.3f ms\n", label, "max_lateness", pacer->max_lateness / 1.0e+6 );
+	fprintf( stream, "%s->%s: %.3f ms\n", label, "mean_lateness",
+		pacer->frames ? pacer->total_lateness / 1.0e+6 / pacer->frames : 0.0 );
+	fprintf( stream, "\n" );
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Event scheduler.
+ *
+ *	Pending events are kept in a hierarchical timer wheel of WHEEL_LEVELS
+ *	levels, each of WHEEL_SLOTS slots. Level 0 has one slot per tick, and
+ *	holds the events due within WHEEL_SLOTS ticks of next_tick. Each slot
+ *	of level n covers WHEEL_SLOTS^n ticks. Whenever the levels below it
+ *	wrap around, the events in the next slot of level n are redistributed
+ *	among the lower levels. Events too distant for the top level wait in
+ *	an overflow list, which is redistributed whenever the top level wraps.
+ *
+ *	Events live in a pool which grows as needed, and are linked by index,
+ *	so the pool may be reallocated while a callback runs. The slots of level
+ *	0 and the due list are kept in order of expiry, and among equal expiries
+ *	in the order the events were scheduled (their sequence), so events run
+ *	in order of deadline, first come first served. An event_id holds
+ *	the index of an event and its generation, which changes each time the
+ *	slot is freed, so stale IDs are recognised.
+ */
+
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS ( 1 << WHEEL_BITS )
+#define WHEEL_MASK ( WHEEL_SLOTS - 1 )
+#define WHEEL_LEVELS 4
+
+/*	Lists besides the slots of the wheel. */
+#define LIST_OVERFLOW ( WHEEL_LEVELS * WHEEL_SLOTS )
+#define LIST_DUE ( LIST_OVERFLOW + 1 )
+#define LIST_COUNT ( LIST_DUE + 1 )
+#define LIST_NONE ( -1 )
+
+#define NO_EVENT ( -1 )
+
+typedef struct {
+	int64_t expires;
+	int64_t period;
+	uint64_t sequence;
+	event_callback callback;
+	void * context;
+	uint32_t generation;
+	int list;
+	int next;
+	int prev;
+	bool cancelled;
+} cab202_event_t;
+
+/*
+ *	Members:
+ *		origin - get_current_ns() when the scheduler was created.
+ *		paused_total - Time spent paused before the current pause.
+ *		paused_at - get_current_ns() when the current pause began.
+ *		next_tick - The first tick which has not been run.
+ *		allocated - The number of events which are pending or running.
+ *		next_sequence - The sequence of the next event scheduled.
+ *		head, tail - The first and last event of each list.
+ *		occupied - Bit i is set if and only if slot i of level 0 is not empty.
+ *		events, capacity - The event pool.
+ *		free_list - The first unused event in the pool.
+ *		running - The event whose callback is running, or NO_EVENT.
+ */
+struct cab202_scheduler {
+	int64_t origin;
+	int64_t paused_total;
+	int64_t paused_at;
+	bool paused;
+	int64_t next_tick;
+	uint64_t next_sequence;
+	int allocated;
+	int head[LIST_COUNT];
+	int tail[LIST_COUNT];
+	uint64_t occupied;
+	cab202_event_t * events;
+	int capacity;
+	int free_list;
+	int running;
+};
+
+// ---------------------------------------------------------------------------
+
+scheduler_id create_scheduler( void ) {
+	scheduler_id scheduler = calloc( 1, sizeof( cab202_scheduler_t ) );
+
+	for ( int i = 0; i < LIST_COUNT; i++ ) {
+		scheduler->head[i] = NO_EVENT;
+		scheduler->tail[i] = NO_EVENT;
+	}
+
+	scheduler->free_list = NO_EVENT;
+	scheduler->running = NO_EVENT;
+	scheduler->origin = get_current_ns();
+
+	return scheduler;
+}
+
+// ---------------------------------------------------------------------------
+
+void destroy_scheduler( scheduler_id scheduler ) {
+	assert( scheduler != NULL );
+	assert( scheduler->running == NO_EVENT );
+
+	free( scheduler->events );
+	free( scheduler );
+}
+
+// ---------------------------------------------------------------------------
+
+static event_id make_event_id( scheduler_id scheduler, int index ) {
+	return (uint64_t) scheduler->events[index].generation << 32 | (uint32_t) index;
+}
+
+// ---------------------------------------------------------------------------
+
+static int alloc_event( scheduler_id scheduler ) {
+	if ( scheduler->free_list == NO_EVENT ) {
+		int capacity = scheduler->capacity ? scheduler->capacity * 2 : 16;
+
+		scheduler->events = realloc( scheduler->events, capacity * sizeof( cab202_event_t ) );
+
+		for ( int i = scheduler->capacity; i < capacity; i++ ) {
+			scheduler->events[i] = (cab202_event_t) { .generation = 1, .list = LIST_NONE, .next = i + 1 };
+		}
+
+		scheduler->events[capacity - 1].next = NO_EVENT;
+		scheduler->free_list = scheduler->capacity;
+		scheduler->capacity = capacity;
+	}
+
+	int index = scheduler->free_list;
+
+	scheduler->free_list = scheduler->events[index].next;
+	scheduler->allocated++;
+
+	return index;
+}
+
+// ---------------------------------------------------------------------------
+
+static void free_event( scheduler_id scheduler, int index ) {
+	cab202_event_t * event = &scheduler->events[index];
+
+	if ( ++event->generation == 0 ) {
+		event->generation = 1;
+	}
+
+	event->list = LIST_NONE;
+	event->cancelled = false;
+	event->next = scheduler->free_list;
+	scheduler->free_list = index;
+	scheduler->allocated--;
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Returns true if event a should run after event b.
+ */
+static bool runs_after( const cab202_event_t * a, const cab202_event_t * b ) {
+	return a->expires > b->expires || ( a->expires == b->expires && a->sequence > b->sequence );
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Links an event into a list after the events which run before it, or at
+ *	the end of a list of a higher level, whose order does not matter.
+ *	Nearly every event goes at the end, so the search starts there.
+ */
+static void link_event( scheduler_id scheduler, int index, int list ) {
+	cab202_event_t * event = &scheduler->events[index];
+	int after = scheduler->tail[list];
+
+	if ( list < WHEEL_SLOTS || list == LIST_DUE ) {
+		while ( after != NO_EVENT && runs_after( &scheduler->events[after], event ) ) {
+			after = scheduler->events[after].prev;
+		}
+	}
+
+	event->list = list;
+	event->prev = after;
+	event->next = after == NO_EVENT ? scheduler->head[list] : scheduler->events[after].next;
+
+	if ( event->next != NO_EVENT ) {
+		scheduler->events[event->next].prev = index;
+	}
+	else {
+		scheduler->tail[list] = index;
+	}
+
+	if ( after != NO_EVENT ) {
+		scheduler->events[after].next = index;
+	}
+	else {
+		scheduler->head[list] = index;
+	}
+
+	if ( list < WHEEL_SLOTS ) {
+		scheduler->occupied |= UINT64_C( 1 ) << list;
+	}
+}
+
+// ---------------------------------------------------------------------------
+
+static void unlink_event( scheduler_id scheduler, int index ) {
+	cab202_event_t * event = &scheduler->events[index];
+
+	if ( event->prev != NO_EVENT ) {
+		scheduler->events[event->prev].next = event->next;
+	}
+	else {
+		scheduler->head[event->list] = event->next;
+	}
+
+	if ( event->next != NO_EVENT ) {
+		scheduler->events[event->next].prev = event->prev;
+	}
+	else {
+		scheduler->tail[event->list] = event->prev;
+	}
+
+	if ( event->list < WHEEL_SLOTS && scheduler->head[event->list] == NO_EVENT ) {
+		scheduler->occupied &= ~( UINT64_C( 1 ) << event->list );
+	}
+
+	event->list = LIST_NONE;
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Links an event into the slot which covers its expiry time. An event
+ *	which is already due goes in the slot of next_tick.
+ */
+static void place_event( scheduler_id scheduler, int index ) {
+	int64_t expires = scheduler->events[index].expires;
+	int64_t delta = expires - scheduler->next_tick;
+	int list = LIST_OVERFLOW;
+
+	if ( delta < 0 ) {
+		list = scheduler->next_tick & WHEEL_MASK;
+	}
+	else {
+		for ( int level = 0; level < WHEEL_LEVELS; level++ ) {
+			if ( delta < INT64_C( 1 ) << ( WHEEL_BITS * ( level + 1 ) ) ) {
+				list = level * WHEEL_SLOTS + ( ( expires >> ( WHEEL_BITS * level ) ) & WHEEL_MASK );
+				break;
+			}
+		}
+	}
+
+	link_event( scheduler, index, list );
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Empties a list, returning its first event. The events stay linked to
+ *	each other.
+ */
+static int take_list( scheduler_id scheduler, int list ) {
+	int index = scheduler->head[list];
+
+	scheduler->head[list] = NO_EVENT;
+	scheduler->tail[list] = NO_EVENT;
+
+	if ( list < WHEEL_SLOTS ) {
+		scheduler->occupied &= ~( UINT64_C( 1 ) << list );
+	}
+
+	return index;
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Empties a list, placing each of its events afresh.
+ */
+static void redistribute( scheduler_id scheduler, int list ) {
+	int index = take_list( scheduler, list );
+
+	while ( index != NO_EVENT ) {
+		int next = scheduler->events[index].next;
+		place_event( scheduler, index );
+		index = next;
+	}
+}
+
+// ---------------------------------------------------------------------------
+
+static event_id schedule( scheduler_id scheduler, long milliseconds, long period, event_callback callback, void * context ) {
+	assert( scheduler != NULL );
+	assert( callback != NULL );
+	assert( milliseconds >= 0 );
+
+	// Round the current time up, so the event is never early.
+	int64_t now = ( scheduler_time( scheduler ) + SCHEDULER_TICK_NS - 1 ) / SCHEDULER_TICK_NS;
+	int64_t ticks_per_ms = NS_PER_MILLISECOND / SCHEDULER_TICK_NS;
+	int index = alloc_event( scheduler );
+	cab202_event_t * event = &scheduler->events[index];
+
+	event->expires = now + milliseconds * ticks_per_ms;
+	event->period = period * ticks_per_ms;
+	event->sequence = scheduler->next_sequence++;
+	event->callback = callback;
+	event->context = context;
+	place_event( scheduler, index );
+
+	return make_event_id( scheduler, index );
+}
+
+// ---------------------------------------------------------------------------
+
+event_id schedule_once( scheduler_id scheduler, long milliseconds, event_callback callback, void * context ) {
+	return schedule( scheduler, milliseconds, 0, callback, context );
+}
+
+// ---------------------------------------------------------------------------
+
+event_id schedule_every( scheduler_id scheduler, long milliseconds, event_callback callback, void * context ) {
+	assert( milliseconds > 0 );
+
+	return schedule( scheduler, milliseconds, milliseconds, callback, context );
+}
+
+// ---------------------------------------------------------------------------
+
+bool cancel_event( scheduler_id scheduler, event_id id ) {
+	assert( scheduler != NULL );
+
+	uint32_t index = (uint32_t) id;
+
+	if ( index >= (uint32_t) scheduler->capacity ) return false;
+
+	cab202_event_t * event = &scheduler->events[index];
+
+	if ( event->generation != id >> 32 ) return false;
+
+	if ( (int) index == scheduler->running ) {
+		// A periodic event cancelling itself is freed once its callback returns.
+		if ( event->period == 0 || event->cancelled ) return false;
+		event->cancelled = true;
+		return true;
+	}
+
+	if ( event->list == LIST_NONE ) return false;
+
+	unlink_event( scheduler, index );
+	free_event( scheduler, index );
+
+	return true;
+}
+
+// ---------------------------------------------------------------------------
+
+void scheduler_pause( scheduler_id scheduler ) {
+	assert( scheduler != NULL );
+
+	if ( !scheduler->paused ) {
+		scheduler->paused_at = get_current_ns();
+		scheduler->paused = true;
+	}
+}
+
+// ---------------------------------------------------------------------------
+
+void scheduler_resume( scheduler_id scheduler ) {
+	assert( scheduler != NULL );
+
+	if ( scheduler->paused ) {
+		scheduler->paused_total += get_current_ns() - scheduler->paused_at;
+		scheduler->paused = false;
+	}
+}
+
+// ---------------------------------------------------------------------------
+
+bool scheduler_paused( scheduler_id scheduler ) {
+	assert( scheduler != NULL );
+
+	return scheduler->paused;
+}
+
+// ---------------------------------------------------------------------------
+
+int64_t scheduler_time( scheduler_id scheduler ) {
+	assert( scheduler != NULL );
+
+	int64_t now = scheduler->paused ? scheduler->paused_at : get_current_ns();
+
+	return now - scheduler->origin - scheduler->paused_total;
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Returns the number of trailing zero bits in a non-zero word.
+ */
+static int trailing_zeros( uint64_t bits ) {
+#if defined(__GNUC__)
+	return __builtin_ctzll( bits );
+#else
+	int count = 0;
+	while ( !( bits & 1 ) ) {
+		bits >>= 1;
+		count++;
+	}
+	return count;
+#endif
+}
+
+// ---------------------------------------------------------------------------
+
+/*
+ *	Runs the events in the due list. A periodic event is placed again at
+ *	its next deadline after now, skipping any which have already passed.
+ */
+static int run_due( scheduler_id scheduler, int64_t now ) {
+	int calls = 0;
+	int index;
+
+	while ( ( index = scheduler->head[LIST_DUE] ) != NO_EVENT ) {
+		unlink_event( scheduler, index );
+
+		scheduler->running = index;
+		scheduler->events[index].callback( scheduler->events[index].context );
+		scheduler->running = NO_EVENT;
+		calls++;
+
+		// The callback may have grown the pool, so look the event up again.
+		cab202_event_t * event = &scheduler->events[index];
+
+		if ( event->period == 0 || event->cancelled ) {
+			free_event( scheduler, index );
+			continue;
+		}
+
+		event->expires += event->period;
+
+		if ( event->expires <= now ) {
+			event->expires += ( ( now - event->expires ) / event->period + 1 ) * event->period;
+		}
+
+		event->sequence = scheduler->next_sequence++;
+
+		place_event( scheduler, index );
+	}
+
+	return calls;
+}
+
+// ---------------------------------------------------------------------------
+
+int scheduler_run( scheduler_id scheduler ) {
+	assert( scheduler != NULL );
+	assert( scheduler->running == NO_EVENT );
+
+	if ( scheduler->paused ) return 0;
+
+	int64_t now = scheduler_time( scheduler ) / SCHEDULER_TICK_NS;
+	int calls = 0;
+
+	while ( scheduler->next_tick <= now ) {
+		if ( scheduler->allocated == 0 ) {
+			// Nothing is pending, so the wheel may jump straight to now.
+			scheduler->next_tick = now + 1;
+			break;
+		}
+
+		int slot = scheduler->next_tick & WHEEL_MASK;
+
+		if ( slot == 0 ) {
+			// Level 0 has wrapped: bring down the next slot of the level
+			// above, and so on up while each higher level wraps too.
+			for ( int level = 1; level < WHEEL_LEVELS; level++ ) {
+				int index = ( scheduler->next_tick >> ( WHEEL_BITS * level ) ) & WHEEL_MASK;
+
+				redistribute( scheduler, level * WHEEL_SLOTS + index );
+
+				if ( index != 0 ) break;
+
+				if ( level == WHEEL_LEVELS - 1 ) {
+					redistribute( scheduler, LIST_OVERFLOW );
+				}
+			}
+		}
+		else if ( !( scheduler->occupied >> slot & 1 ) ) {
+			// Skip empty slots, but stop where level 0 wraps so the
+			// higher levels are brought down in time.
+			uint64_t ahead = scheduler->occupied >> slot;
+			int64_t skip = ahead ? trailing_zeros( ahead ) : WHEEL_SLOTS - slot;
+
+			scheduler->next_tick += skip;
+
+			if ( scheduler->next_tick > now + 1 ) {
+				scheduler->next_tick = now + 1;
+			}
+
+			continue;
+		}
+
+		// Move the events of this tick to the due list, then run them.
+		int index = take_list( scheduler, slot );
+
+		while ( index != NO_EVENT ) {
+			int next = scheduler->events[index].next;
+			link_event( scheduler, index, LIST_DUE );
+			index = next;
+		}
+
+		scheduler->next_tick++;
+		calls += run_due( scheduler, now );
+	}
+
+	return calls;
+}
+
+// ---------------------------------------------------------------------------
+
+void timer_set_virtual( bool enabled ) {
+	if ( enabled && !virtual_time ) {
+		virtual_origin_ns = get_system_ns();
+		virtual_origin_time = get_current_time();
+		virtual_ns = virtual_origin_ns;
+	}
+
+	virtual_time = enabled;
+}
+
+// ---------------------------------------------------------------------------
+
+bool timer_is_virtual( void ) {
+	return virtual_time;
+}
+
+// ---------------------------------------------------------------------------
+
 bool timers_equal( const cab202_timer_t * a, const cab202_timer_t * b ) {
 	if ( a == b )  return true;
 	if ( a == NULL && b != NULL ) return false;
@@ -11,6 +11,7 @@
 #define __TIMER_H__
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 /*	Constant number of milliseconds in a second. */
@@ -92,16 +93,350 @@ void timer_pause( long milliseconds );
  *	Gets an estimate of the time elapsed since 01/01/1970 with 
  *	microsecond accuracy.
  *
+ *	This follows the system's wall clock, so it jumps if the clock is
+ *	adjusted. Use get_current_ns() to measure intervals.
+ *
  *	Input: void.
  *
  *	Output: Returns the current system time in measured in whole and fractional seconds.
  */
 double get_current_time( void );
 
+/*	Constant number of nanoseconds in a millisecond and in a second. */
+#define NS_PER_MILLISECOND INT64_C(1000000)
+#define NS_PER_SECOND INT64_C(1000000000)
+
+/**
+ *	get_current_ns:
+ *
+ *	Reads a monotonic clock, which is not affected by changes to the
+ *	system's wall-clock time. Use this rather than get_current_time() to
+ *	measure intervals.
+ *
+ *	Input: void.
+ *
+ *	Output: Returns the number of nanoseconds elapsed since an arbitrary
+ *	fixed point in the past. If zdk_get_current_time is set, returns the
+ *	time it reports, converted to nanoseconds, instead. Under virtual time
+ *	(see timer_set_virtual), returns the virtual clock.
+ */
+int64_t get_current_ns( void );
+
+/**
+ *	get_system_ns:
+ *
+ *	Reads the same monotonic clock as get_current_ns(), but ignores virtual
+ *	time and the time hooks. Use this to measure how long a simulation
+ *	really takes.
+ *
+ *	Input: void.
+ *
+ *	Output: Returns the number of nanoseconds elapsed since an arbitrary
+ *	fixed point in the past.
+ */
+int64_t get_system_ns( void );
+
+/**
+ *	timer_sleep_until:
+ *
+ *	Sleeps until get_current_ns() reaches a deadline. Because the deadline
+ *	is absolute, a sleep which is interrupted or starts late does not
+ *	overshoot. Returns immediately if the deadline has passed.
+ *
+ *	If zdk_timer_pause or zdk_get_current_time is set, sleeps by calling
+ *	timer_pause() instead, rounded up to whole milliseconds.
+ *
+ *	Input:
+ *	-	deadline: the time, in nanoseconds, at which to wake.
+ */
+void timer_sleep_until( int64_t deadline );
+
+/*	Data structure to pace a loop to a fixed period. All times are in
+ *	nanoseconds, as reported by get_current_ns().
+ *
+ *	Members:
+ *		period - The desired time between the starts of successive frames.
+ *		deadline - The time at which the next frame should start.
+ *		frames - The number of frames started by pacer_wait() or
+ *			pacer_poll().
+ *		overruns - Frames which were still working at their deadline, so
+ *			pacer_wait() did not sleep, or pacer_idle() found the deadline
+ *			already passed.
+ *		late - Frames which were not overruns, but started more than
+ *			PACER_LATE_NS after the deadline.
+ *		skipped - Deadlines abandoned because an overrun lasted longer than
+ *			a whole period. The pacer does not try to catch up on these.
+ *		max_lateness - The largest time by which a frame started after its
+ *			deadline.
+ *		total_lateness - The sum of the times by which frames started after
+ *			their deadlines.
+ *		overran - Set by pacer_idle() if the current frame is an overrun.
+ */
+typedef struct {
+	int64_t period;
+	int64_t deadline;
+	unsigned long frames;
+	unsigned long overruns;
+	unsigned long late;
+	unsigned long skipped;
+	int64_t max_lateness;
+	int64_t total_lateness;
+	bool overran;
+} cab202_pacer_t;
+
+/*	Data type to represent unique pacer ID. */
+typedef cab202_pacer_t * pacer_id;
+
+/*	A frame which wakes later than this after its deadline is counted late. */
+#define PACER_LATE_NS ( NS_PER_MILLISECOND )
+
+/**
+ *	create_pacer:
+ *
+ *	Creates a pacer whose first deadline is one period from now.
+ *
+ *	Input:
+ *	-	period: the desired frame period, in nanoseconds.
+ *
+ *	Output:
+ *		Returns the address of the pacer.
+ */
+pacer_id create_pacer( int64_t period );
+
+/**
+ *	Deallocates resources associated with a pacer.
+ */
+void destroy_pacer( pacer_id pacer );
+
+/**
+ *	pacer_reset:
+ *
+ *	Sets the next deadline one period from now and clears the counters.
+ */
+void pacer_reset( pacer_id pacer );
+
+/**
+ *	pacer_resume:
+ *
+ *	Sets the next deadline one period from now, keeping the counters.
+ *	Call this after a deliberate pause, such as waiting for a key press,
+ *	so that the pause is not counted as a late frame.
+ */
+void pacer_resume( pacer_id pacer );
+
+/**
+ *	pacer_wait:
+ *
+ *	Sleeps until the deadline of the current frame, then advances the
+ *	deadline by one period. Because deadlines are absolute, time spent
+ *	working in a frame does not lengthen the period.
+ *
+ *	If the deadline has already passed, returns immediately and counts an
+ *	overrun. The next deadline is still one period after the missed one,
+ *	so a short overrun is absorbed by the following frame. If the frame is
+ *	a whole period or more behind, the missed deadlines are skipped rather
+ *	than run back-to-back.
+ *
+ *	The pacer sleeps by calling timer_sleep_until().
+ *
+ *	Input:
+ *	-	pacer: the address of the pacer.
+ *
+ *	Output:
+ *		Returns the time, in nanoseconds, by which the frame started after
+ *		its deadline, or 0 if it started on time.
+ */
+int64_t pacer_wait( pacer_id pacer );
+
+/**
+ *	pacer_poll:
+ *
+ *	Checks, without sleeping, whether the deadline of the current frame has
+ *	passed. If so, starts the frame as pacer_wait() would and returns true.
+ *	Use this when the caller sleeps by other means, such as waiting for
+ *	input until pacer->deadline. The pacer cannot tell whether the caller
+ *	was busy or asleep when the deadline passed, so a frame is counted as
+ *	an overrun only if pacer_idle() found it still working at the
+ *	deadline. Otherwise a frame started late is counted late.
+ *
+ *	Input:
+ *	-	pacer: the address of the pacer.
+ *
+ *	Output:
+ *		Returns true if and only if a new frame is due.
+ */
+bool pacer_poll( pacer_id pacer );
+
+/**
+ *	pacer_idle:
+ *
+ *	Tells the pacer that the work of the current frame is done, before the
+ *	caller sleeps by other means and then calls pacer_poll(). If the
+ *	deadline has already passed, the frame is counted as an overrun. A
+ *	frame is counted at most once, however often this is called.
+ *
+ *	Input:
+ *	-	pacer: the address of the pacer.
+ */
+void pacer_idle( pacer_id pacer );
+
+/**
+ *	Writes the counters of a pacer to an output stream.
+ *
+ *	Input:
+ *		stream - The address of a stream to which the data will be written.
+ *		label - A literal which is displayed to help add context to the data.
+ *		pacer - The address of the pacer.
+ */
+void dump_pacer( FILE * stream, const char * label, pacer_id pacer );
+
+/*	Data structure to run callbacks at chosen times. See create_scheduler(). */
+typedef struct cab202_scheduler cab202_scheduler_t;
+
+/*	Data type to represent unique scheduler ID. */
+typedef cab202_scheduler_t * scheduler_id;
+
+/*	Data type to represent a scheduled event. 0 is never a valid event. */
+typedef uint64_t event_id;
+
+/*	A function called when an event falls due. */
+typedef void( *event_callback )( void * context );
+
+/*	The resolution of the scheduler. Events fall due on whole ticks. */
+#define SCHEDULER_TICK_NS ( NS_PER_MILLISECOND )
+
+/**
+ *	create_scheduler:
+ *
+ *	Creates an event scheduler. The scheduler keeps its own clock, which
+ *	starts at zero, follows get_current_ns(), and stands still while the
+ *	scheduler is paused. Events are due at a time on this clock, so
+ *	pausing the scheduler postpones all of them by the length of the pause.
+ *
+ *	Pending events are held in a hierarchical timer wheel: scheduling or
+ *	cancelling an event takes constant time, and scheduler_run() takes time
+ *	proportional to the number of events which fall due, not the number
+ *	pending.
+ *
+ *	Input: void.
+ *
+ *	Output:
+ *		Returns the address of the scheduler.
+ */
+scheduler_id create_scheduler( void );
+
+/**
+ *	Deallocates a scheduler and all of its pending events.
+ */
+void destroy_scheduler( scheduler_id scheduler );
+
+/**
+ *	schedule_once:
+ *
+ *	Arranges for callback( context ) to be called once, by the first call
+ *	to scheduler_run() made at least milliseconds from now.
+ *
+ *	Output:
+ *		Returns an ID which may be passed to cancel_event().
+ */
+event_id schedule_once( scheduler_id scheduler, long milliseconds, event_callback callback, void * context );
+
+/**
+ *	schedule_every:
+ *
+ *	Arranges for callback( context ) to be called every milliseconds,
+ *	starting milliseconds from now, until the event is cancelled. The
+ *	period is measured between deadlines, so the time taken by callbacks
+ *	does not accumulate as drift. If scheduler_run() is called late, the
+ *	event runs once and any further deadlines which have already passed
+ *	are skipped.
+ *
+ *	Output:
+ *		Returns an ID which may be passed to cancel_event().
+ */
+event_id schedule_every( scheduler_id scheduler, long milliseconds, event_callback callback, void * context );
+
+/**
+ *	cancel_event:
+ *
+ *	Removes a pending event. An event may cancel itself, or any other
+ *	event, from within its callback.
+ *
+ *	Output:
+ *		Returns true if and only if the event was pending. IDs of events
+ *		which have already run or been cancelled are safely ignored.
+ */
+bool cancel_event( scheduler_id scheduler, event_id event );
+
+/**
+ *	scheduler_pause, scheduler_resume:
+ *
+ *	Stop and restart the clock of a scheduler. No event runs while the
+ *	scheduler is paused, and the deadlines of all events are shifted by
+ *	the length of the pause.
+ */
+void scheduler_pause( scheduler_id scheduler );
+void scheduler_resume( scheduler_id scheduler );
+
+/**
+ *	Returns true if and only if the scheduler is paused.
+ */
+bool scheduler_paused( scheduler_id scheduler );
+
+/**
+ *	scheduler_time:
+ *
+ *	Output:
+ *		Returns the time on the scheduler's clock, in nanoseconds: the time
+ *		since it was created, less the time spent paused.
+ */
+int64_t scheduler_time( scheduler_id scheduler );
+
+/**
+ *	scheduler_run:
+ *
+ *	Calls the callbacks of all events which have fallen due, in order of
+ *	deadline. Events with the same deadline are called in the order they
+ *	were scheduled (for a periodic event, when it last ran). Call this once
+ *	per frame. Does nothing while paused.
+ *
+ *	Output:
+ *		Returns the number of callbacks called.
+ */
+int scheduler_run( scheduler_id scheduler );
+
 // ------------------------------------------------------------------
 //	Advanced facilities to support automated testing.
 // ------------------------------------------------------------------
 
+/**
+ *	timer_set_virtual:
+ *
+ *	Turns virtual time on or off. While it is on, the clock stands still
+ *	except when the program sleeps: timer_pause(), timer_sleep_until(),
+ *	pacer_wait() and wait_key_event() advance it by the time they would
+ *	have slept, and return at once. get_current_time(), get_current_ns(),
+ *	timers, pacers and schedulers all follow the virtual clock.
+ *
+ *	Combined with zdk_suppress_output, this runs a program's own loop,
+ *	including everything it schedules by time, as fast as the CPU allows.
+ *	The virtual clock starts from the system clock, so it does not jump
+ *	when turned on.
+ *
+ *	The zdk_timer_pause and zdk_get_current_time hooks, if set, take
+ *	precedence over virtual time.
+ *
+ *	Input:
+ *	-	enabled: true to turn virtual time on, false to return to the
+ *		system clock.
+ */
+void timer_set_virtual( bool enabled );
+
+/**
+ *	Returns true if and only if virtual time is on.
+ */
+bool timer_is_virtual( void );
+
 /**
  *	Override: timer_pause().
  *
@@ -121,7 +456,7 @@ double get_current_time( void );
  *	NOTE: This function is for internal use only. User code should NOT call 
  *	this function pointer directly.
  */
-void( *zdk_timer_pause )( long milliseconds );
+extern void( *zdk_timer_pause )( long milliseconds );
 
 /**
  *	Override: get_current_time().
@@ -142,7 +477,7 @@ void( *zdk_timer_pause )( long milliseconds );
  *	NOTE: This function is for internal use only. User code should NOT call
  *	this function pointer directly.
  */
-double( *zdk_get_current_time )( void );
+extern double( *zdk_get_current_time )( void );
 
 /**
  *	Determines if two timers have the same reset time and expiry period.
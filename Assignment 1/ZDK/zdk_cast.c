@@ -0,0 +1,140 @@
+/*
+**  zdk_cast.c
+**
+**  Replays or converts a binary screen-cast written by auto_save_cast().
+**
+**  Usage:
+**      ./zdk_cast play <file> [speed]
+**          Displays the frames in the terminal, paced by their time stamps.
+**          speed scales the playback rate (default 1). Press 'q' to stop.
+**
+**      ./zdk_cast totext <file> [output]
+**          Writes the cast in the Frame(...)/EndFrame text format produced by
+**          auto_save_screen(), to output or to the standard output stream.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curses.h>
+#include "cab202_cast.h"
+#include "cab202_graphics.h"
+#include "cab202_timers.h"
+
+/*
+ *	Selects the ZDK colours corresponding to a colour recorded in a cast,
+ *	which is the curses attribute computed by set_colours().
+ */
+static void select_colour(int colour) {
+	int pair = PAIR_NUMBER(colour);
+	int fg = WHITE, bg = BLACK;
+
+	if (pair > 0) {
+		fg = (pair - 1) % NUM_COLOURS;
+		bg = (pair - 1) / NUM_COLOURS;
+	}
+
+	if (colour & A_BOLD) fg |= BRIGHT;
+	if (colour & A_REVERSE) fg |= INVERSE;
+
+	set_colours(fg, bg);
+}
+
+static int play(ZdkCastReader * reader, double speed) {
+	CastEvent event;
+	double last_time = -1;
+	int result = 0;
+
+	setup_screen();
+
+	while (cast_read(reader, &event) == CAST_FRAME || event.type == CAST_CHAR) {
+		if (event.type == CAST_CHAR) continue;
+
+		if (last_time >= 0 && event.time > last_time) {
+			timer_pause((long)((event.time - last_time) * 1000 / speed));
+		}
+
+		last_time = event.time;
+
+		if (event.width != screen_width() || event.height != screen_height()) {
+			override_screen_size(event.width, event.height);
+		}
+
+		int colour = -1;
+
+		for (int y = 0; y < event.height; y++) {
+			for (int x = 0; x < event.width; x++) {
+				int i = y * event.width + x;
+
+				if (event.colours[i] != colour) {
+					colour = event.colours[i];
+					select_colour(colour);
+				}
+
+				draw_char(x, y, event.pixels[i]);
+			}
+		}
+
+		show_screen();
+
+		if (get_char() == 'q') break;
+	}
+
+	if (event.type == CAST_ERROR) result = 1;
+
+	cleanup_screen();
+
+	if (result) fprintf(stderr, "zdk_cast: cast is truncated or corrupt\n");
+
+	return result;
+}
+
+static int to_text(ZdkCastReader * reader, const char * file_name) {
+	FILE * f = file_name ? fopen(file_name, "w") : stdout;
+
+	if (!f) {
+		perror(file_name);
+		return 1;
+	}
+
+	bool ok = cast_to_text(reader, f);
+
+	if (f != stdout) fclose(f);
+
+	if (!ok) {
+		fprintf(stderr, "zdk_cast: cast is truncated or corrupt\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+	if (argc < 3 || (strcmp(argv[1], "play") != 0 && strcmp(argv[1], "totext") != 0)) {
+		fprintf(stderr, "usage: %s play <file> [speed]\n", argv[0]);
+		fprintf(stderr, "       %s totext <file> [output]\n", argv[0]);
+		return 2;
+	}
+
+	ZdkCastReader * reader = cast_open(argv[2]);
+
+	if (!reader) {
+		fprintf(stderr, "zdk_cast: %s is not a readable cast\n", argv[2]);
+		return 1;
+	}
+
+	int result;
+
+	if (strcmp(argv[1], "play") == 0) {
+		double speed = argc > 3 ? atof(argv[3]) : 1.0;
+		result = play(reader, speed > 0 ? speed : 1.0);
+	}
+	else {
+		result = to_text(reader, argc > 3 ? argv[3] : NULL);
+	}
+
+	cast_close_reader(reader);
+	return result;
+}
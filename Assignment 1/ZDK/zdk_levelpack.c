@@ -0,0 +1,110 @@
+/*
+**  zdk_levelpack.c
+**
+**  Compiles room files into a binary level pack, which a game can map and
+**  use without parsing (see cab202_rooms.h).
+**
+**  Usage:
+**      ./zdk_levelpack build <pack> <room file>...
+**          Parses the room files and writes them, in order, to pack.
+**
+**      ./zdk_levelpack list <pack>
+**          Checks a pack and lists its rooms.
+**
+**  $Revision:Sat Feb 23 00:47:31 EAST 2019$
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cab202_rooms.h"
+
+/*
+ *	Parses a room file into room, with an array of walls of its own.
+ */
+static bool read_room(const char * file_name, Room * room) {
+	size_t length;
+	const char * text = map_room_file(file_name, &length);
+
+	if (!text) {
+		perror(file_name);
+		return false;
+	}
+
+	int max_walls = 128;
+	RoomWall * walls = malloc(max_walls * sizeof(RoomWall));
+	int number_of_walls = parse_room(text, length, room, walls, max_walls);
+
+	// Parse again if there were more walls than expected.
+	if (number_of_walls > max_walls) {
+		free(walls);
+		walls = malloc(number_of_walls * sizeof(RoomWall));
+		parse_room(text, length, room, walls, number_of_walls);
+	}
+
+	unmap_room_file(text, length);
+	return walls != NULL;
+}
+
+static int build(const char * pack_name, int number_of_rooms, char * file_names[]) {
+	Room * rooms = calloc(number_of_rooms, sizeof(Room));
+	int number_of_walls = 0;
+	int result = 0;
+
+	for (int i = 0; i < number_of_rooms && result == 0; i++) {
+		if (!read_room(file_names[i], &rooms[i])) result = 1;
+		number_of_walls += rooms[i].number_of_walls;
+	}
+
+	if (result == 0 && !levelpack_write(pack_name, rooms, number_of_rooms)) {
+		perror(pack_name);
+		result = 1;
+	}
+
+	if (result == 0) {
+		printf("%s: %d rooms, %d walls\n", pack_name, number_of_rooms, number_of_walls);
+	}
+
+	for (int i = 0; i < number_of_rooms; i++) {
+		free((void *)rooms[i].walls);
+	}
+
+	free(rooms);
+	return result;
+}
+
+static int list(const char * pack_name) {
+	ZdkLevelPack * pack = levelpack_open(pack_name);
+
+	if (!pack) {
+		fprintf(stderr, "zdk_levelpack: %s is not a readable level pack\n", pack_name);
+		return 1;
+	}
+
+	for (int i = 0; i < levelpack_rooms(pack); i++) {
+		Room room;
+		levelpack_room(pack, i, &room);
+
+		printf("room %d: %d walls", i, room.number_of_walls);
+		if (room.has_jerry) printf(", J %g %g", room.jerry_x, room.jerry_y);
+		if (room.has_tom) printf(", T %g %g", room.tom_x, room.tom_y);
+		printf("\n");
+	}
+
+	levelpack_close(pack);
+	return 0;
+}
+
+int main(int argc, char * argv[]) {
+	if (argc >= 4 && strcmp(argv[1], "build") == 0) {
+		return build(argv[2], argc - 3, argv + 3);
+	}
+
+	if (argc == 3 && strcmp(argv[1], "list") == 0) {
+		return list(argv[2]);
+	}
+
+	fprintf(stderr, "usage: %s build <pack> <room file>...\n", argv[0]);
+	fprintf(stderr, "       %s list <pack>\n", argv[0]);
+	return 2;
+}
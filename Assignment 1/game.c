@@ -1,23 +1,54 @@
 #include <cab202_graphics.h>
+#include <cab202_particles.h>
+#include <cab202_profiler.h>
+#include <cab202_rooms.h>
 #include <cab202_timers.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#define DELAY (10) /* Millisecond delay between game updates */
-#define MAX_CHEESE (50)
-#define MAX_TRAPS (50)
-#define MAX_FIREWORKS (10)
+#define DELAY (10) /* Millisecond period between game updates */
+#define CHEESE_LIMIT (50) /* Rule of the game: most cheese out at once. The pools themselves grow as needed */
+#define TRAP_LIMIT (50)   /* Rule of the game: most traps out at once */
+#define POOL_BLOCK (64) /* Sprites per block of a pool; blocks never move, so sprite addresses stay valid */
+#define ROOM_WALLS (256) /* Walls parsed on the stack; larger rooms are parsed again */
+
+typedef uint64_t sprite_id; // Slot of a sprite in its pool, with the generation of the slot in the high 32 bits
 
 typedef struct Sprite
 {
     bool draw;
     double x, y, dx, dy;
     char image;
+    int cell;                                  // Cell of the entity grid the sprite is listed under, or -1
+    struct Sprite *next_in_cell, *prev_in_cell; // Other sprites listed under the same cell
+    sprite_id id;                              // Handle of the sprite in its pool
 } Sprite;
 
+typedef struct FlowField
+{
+    int target;    // Cell the field leads to, or -1 if it needs computing
+    int *distance; // Steps from each cell to target, or -1 if target cannot be reached
+    int *next;     // Neighbouring cell one step closer to target
+} FlowField;
+
+typedef struct SpritePool
+{
+    char image;              // Image of every sprite in the pool
+    Sprite **blocks;         // Blocks of POOL_BLOCK sprites, added as the pool grows
+    int capacity;            // Number of slots in the blocks
+    uint32_t *generations;   // Generation of each slot, bumped when it is freed so old handles go stale
+    int *next_free;          // Free list, linked through the slots
+    int free_head;           // First free slot, or -1 if the pool is full
+    int *live;               // Slots in use, packed densely for iteration
+    int *live_position;      // Index in live of each slot in use
+    int number_live;
+} SpritePool;
+
 typedef enum Collisions
 {
     WALL_LEFT,
@@ -27,6 +58,30 @@ typedef enum Collisions
     NO_COLLISION
 } Collision;
 
+typedef struct Wall
+{
+    int x1, y1, x2, y2;
+} Wall;
+
+typedef enum LevelStates
+{
+    LEVEL_UNLOADED,
+    LEVEL_LOADING,
+    LEVEL_LOADED
+} LevelState;
+
+typedef struct Level
+{
+    int jerry_x, jerry_y; // Starting position of jerry
+    int tom_x, tom_y;     // Starting position of tom
+    Wall *walls;          // Wall segments, in the order they were read
+    int number_of_walls;
+    const char *file;     // Room file of the level, or NULL if it is in a level pack
+    ZdkLevelPack *pack;   // Level pack holding the room, which stays mapped
+    int pack_room;        // Index of the room in pack
+    LevelState state;     // Changed only while holding level_lock
+} Level;
+
 // Game variables
 bool game_over = false; /* Set this to true when game is over */
 bool pause = false;     /* Set this to true when game is over */
@@ -36,16 +91,35 @@ int number_of_cheese = 0;
 int collected_cheese = 0;
 int number_of_mousetraps = 0;
 int number_of_fireworks = 0;
-int number_of_walls = 0;
-int levels[20][2][1000];
+Level *levels; // One per room from levels[1]; levels[0] and the one after the last have no walls
+int level_capacity = 0; // Number of levels allocated
+ZdkBackground *wall_background = NULL; // The walls of the current level, drawn once per level
 int current_level = 0;
 int number_of_levels;
+
+// Level loading variables (levels are read when first played, and the next one in the background)
+pthread_mutex_t level_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t level_loaded = PTHREAD_COND_INITIALIZER;    // Signalled when a level finishes loading
+pthread_cond_t prefetch_wanted = PTHREAD_COND_INITIALIZER; // Signalled when prefetch_level is set
+int prefetch_level = 0;  // Level the prefetch thread should read next, or 0 for none
+bool prefetching = false; // Set if the prefetch thread is running
 bool check_time = true;
 
 // Time related variables
-timer_id timer;
+scheduler_id game_events; // Runs the timed spawns; its clock stops while the game is paused
+pacer_id frame_pacer;      // Paces the main loop to one update every DELAY milliseconds
+bool frame_due = true;     // Set when frame_pacer says the game should move on a step
 int time_seconds, time_minutes;
-double current_time, current_time_diff, saved_time_diff;
+
+// Profiler variables (one scope per phase of the frame)
+ZdkProfileScope *prof_input, *prof_time, *prof_hud, *prof_walls, *prof_movement;
+ZdkProfileScope *prof_collisions, *prof_drawing, *prof_spawning, *prof_render, *prof_frame;
+bool show_profile = false; // With --profile, draw the profile on row 1 and print it at exit
+
+// Soak test variables
+int soak_steps = 0;      // With --soak N, play N frames in virtual time without a display
+int soak_restarts = 0;   // Number of times the soak player restarted after game over
+unsigned int seed;       // Seeds rand() once, from --seed N or the time the game started
 
 // Sprite variables
 Sprite **active_player;    // Current active player, either 'J' or 'T' , default is 'J'
@@ -58,29 +132,57 @@ char jerry_image = 'J';
 Sprite *tom;
 char tom_image = 'T';
 
-Sprite cheese[MAX_CHEESE];
+SpritePool cheese;
 char cheese_image = '#';
 
-Sprite traps[MAX_TRAPS];
+SpritePool traps;
 char traps_image = '%';
 
-Sprite fireworks[MAX_FIREWORKS];
+ZdkParticles fireworks;      // Positions and velocities as arrays, the fireworks in flight first
 char fireworks_image = 'F';
+int *firework_cells = NULL;  // Screen cell of each firework, checked against the walls in one batch
+bool *firework_keep = NULL;  // Cleared for each firework that hits tom or burns out
+int firework_cells_capacity = 0;
 
 Sprite door;
 char door_image = 'X';
 
+// Entity grid (the cheese, traps and door, listed under the screen cell they are drawn in)
+Sprite **entity_grid; // First sprite in each cell, indexed by y * width + x
+
+// Flow fields (shortest paths around the walls, searched once per level and target cell)
+bool *open_cells;           // Cells of the current level that sprites can move through
+int *flow_queue;            // Cells waiting to be visited by the search
+FlowField to_jerry, to_tom; // Tom chases along to_jerry; fireworks seek and jerry evades along to_tom
+
+// Free cells (open cells with no cheese, trap or door, kept as a set so a random spawn takes O(1))
+int *free_cells;             // The free cells, in no particular order
+int *free_position;          // Index of each cell in free_cells, or -1 if it is not free
+int number_of_free_cells = 0;
+int number_of_full_spawns = 0; // Spawns that found no free cell
+char spawn_message[32] = "";   // Shown on the display screen while spawns find no free cell
+
 // Functions which control certain stages/state of the game
 void setup(); // Sets up the game including global variables
 void loop();  // Processes all of the games functions
-void read_files();
+void read_files(char *file); // Adds the level of a room file, or every room of a level pack (file ending in .pack)
 void update_time();     // Will return a formatted string containing the time elapsed in the format of mm:ss
 void pause_game();      // Pauses the game
 void reset_game();      // Resets the game
 void reset_level();     // Resets the game
 void display_screen();  // Displays current game information
+void create_labels();   // Registers the game information labels with the ZDK
 void gameover_screen(); // Displays current game information
 void draw_walls();      // Draw the walls from given files
+void draw_level_background(); // Draws the walls once and saves them as the background of each frame
+void add_level(const char *file, ZdkLevelPack *pack, int pack_room); // Adds a level, to be read when it is first played
+void scale_room(Level *level, const Room *room); // Sets the start positions and walls of a level, scaled to the screen
+void read_level(Level *level);   // Reads the room of a level
+void claim_level(Level *level);  // Reads the room of a level unless it is loaded or loading (level_lock must be held)
+void load_level(int level);      // Makes sure a level is loaded, waiting for the prefetch thread if it has it
+void prefetch_level_room(int level); // Asks the prefetch thread to read a level
+void *prefetch_rooms(void *context);
+void start_prefetch();
 void draw_sprite(Sprite *player);
 void init_sprites();        // Initalize tom and jerry values for game
 void switch_player();       // Switches the current player from jerry to tom, vice versa
@@ -94,17 +196,471 @@ void caught_collision();
 void traps_collision();
 void place_trap();
 void cheese_collision();
-void spawn_cheese();
+void spawn_cheese(void *context);
+void spawn_moustraps(void *context);
 void place_cheese();
 void spawn_door();
 void next_level();
 void door_collision();
+void pool_init(SpritePool *pool, char image);
+Sprite *pool_sprite(SpritePool *pool, int slot); // Sprite in a slot of a pool
+Sprite *pool_live(SpritePool *pool, int i);      // The ith sprite in use, for 0 <= i < number_live
+bool resize_array(void **array, size_t size);   // Resizes an array, leaving it as it was if there is no memory
+bool pool_grow(SpritePool *pool);                // Adds a block of free slots; false if there is no memory
+Sprite *pool_alloc(SpritePool *pool);            // Takes a free slot, growing the pool if there is none (NULL if it cannot)
+Sprite *pool_get(SpritePool *pool, sprite_id id); // Sprite of a handle, or NULL if it has been freed
+bool pool_free(SpritePool *pool, sprite_id id);   // Returns a sprite's slot to the free list; false if already freed
+Sprite *spawn(SpritePool *pool, double x, double y); // Adds a sprite to a pool and the entity grid (NULL if it cannot)
+void despawn(SpritePool *pool, Sprite *sprite);     // Removes a sprite from the entity grid and its pool
+void despawn_all(SpritePool *pool);
+int sprite_cell(Sprite *sprite);   // Finds the grid cell of the screen cell a sprite is drawn in
+void grid_add(Sprite *sprite);     // Lists a sprite under its cell, when it is spawned
+void grid_remove(Sprite *sprite);  // Removes a sprite from the grid, when it is despawned
+void grid_move(Sprite *sprite);    // Moves a sprite to its new cell, after it moves
+Sprite *grid_first(Sprite *sprite); // First sprite listed under the cell of a sprite
+void init_flow_field(FlowField *field);
+void find_open_cells(); // Marks the cells without walls, after the walls of a level are drawn
+void compute_flow(FlowField *field, int target); // Breadth-first search out from target
+FlowField *flow_towards(FlowField *field, Sprite *target); // Searches again only if target has changed cell
+void steer_to_cell(Sprite *sprite, int cell, double speed); // Heads a sprite for the middle of a cell
+bool steer(Sprite *sprite, FlowField *field, Sprite *target, double speed); // Heads a sprite one step along a field
+void find_firework_cells(); // Fills firework_cells, growing it with the fireworks (or dropping those it cannot fit)
+void free_cell_add(int cell);    // Adds a cell to the free set, if it is not already in it
+void free_cell_remove(int cell); // Removes a cell from the free set, if it is in it
+void find_free_cells();  // Lists every open cell without an entity, after find_open_cells()
+bool set_aside(int cell, int n); // Swaps a free cell to position n - 1 of the set, leaving it out of a draw
+int random_free_cell();  // Uniformly random free cell away from jerry and tom, or -1 if there is none
+int spawn_cell(const char *what); // Random free cell for a spawn, reporting when there is none
+void create_profile_scopes(); // Registers a profiler scope for each phase of the frame
+void dump_profile();          // Prints the profile and the frame pacer counters when the game exits
+char soak_step_towards(Sprite *target); // Key which moves jerry one step nearer target
+void soak_player();
+void soak_report(int steps, int64_t real_start, int64_t virtual_start);
+
+/// SPRITE POOL FUNCTIONS ///
+
+void pool_init(SpritePool *pool, char image)
+{
+    memset(pool, 0, sizeof(SpritePool));
+    pool->image = image;
+    pool->free_head = -1;
+}
+
+Sprite *pool_sprite(SpritePool *pool, int slot)
+{
+    return &pool->blocks[slot / POOL_BLOCK][slot % POOL_BLOCK];
+}
+
+Sprite *pool_live(SpritePool *pool, int i)
+{
+    return pool_sprite(pool, pool->live[i]);
+}
+
+bool resize_array(void **array, size_t size)
+{
+    void *resized = realloc(*array, size);
+    if (resized == NULL)
+    {
+        return false;
+    }
+
+    *array = resized;
+    return true;
+}
+
+bool pool_grow(SpritePool *pool)
+{
+    // Each array is only replaced once it has grown, and the capacity only changes once
+    // everything has, so a pool which cannot grow is left as it was
+    int capacity = pool->capacity + POOL_BLOCK;
+    Sprite *block = calloc(POOL_BLOCK, sizeof(Sprite));
+    if (block == NULL
+        || !resize_array((void **)&pool->blocks, capacity / POOL_BLOCK * sizeof(Sprite *))
+        || !resize_array((void **)&pool->generations, capacity * sizeof(uint32_t))
+        || !resize_array((void **)&pool->next_free, capacity * sizeof(int))
+        || !resize_array((void **)&pool->live, capacity * sizeof(int))
+        || !resize_array((void **)&pool->live_position, capacity * sizeof(int)))
+    {
+        free(block);
+        return false;
+    }
+
+    // Free the new slots lowest first
+    pool->blocks[pool->capacity / POOL_BLOCK] = block;
+    for (int slot = capacity - 1; slot >= pool->capacity; slot--)
+    {
+        pool->generations[slot] = 0;
+        pool->next_free[slot] = pool->free_head;
+        pool->free_head = slot;
+    }
+    pool->capacity = capacity;
+    return true;
+}
+
+Sprite *pool_alloc(SpritePool *pool)
+{
+    if (pool->free_head < 0 && !pool_grow(pool))
+    {
+        return NULL;
+    }
+
+    int slot = pool->free_head;
+    pool->free_head = pool->next_free[slot];
+    pool->live_position[slot] = pool->number_live;
+    pool->live[pool->number_live++] = slot;
+
+    Sprite *sprite = pool_sprite(pool, slot);
+    memset(sprite, 0, sizeof(Sprite));
+    sprite->image = pool->image;
+    sprite->draw = true;
+    sprite->cell = -1;
+    sprite->id = (uint64_t)pool->generations[slot] << 32 | (uint32_t)slot;
+    return sprite;
+}
+
+Sprite *pool_get(SpritePool *pool, sprite_id id)
+{
+    int slot = (int)(uint32_t)id;
+    if (slot >= pool->capacity || pool->generations[slot] != (uint32_t)(id >> 32))
+    {
+        return NULL;
+    }
+
+    return pool_sprite(pool, slot);
+}
+
+bool pool_free(SpritePool *pool, sprite_id id)
+{
+    Sprite *sprite = pool_get(pool, id);
+    if (sprite == NULL)
+    {
+        return false;
+    }
+
+    // Move the last sprite in use into the freed place, keeping live dense
+    int slot = (int)(uint32_t)id;
+    int position = pool->live_position[slot];
+    int last = pool->live[--pool->number_live];
+    pool->live[position] = last;
+    pool->live_position[last] = position;
+
+    sprite->draw = false;
+    pool->generations[slot]++;
+    pool->next_free[slot] = pool->free_head;
+    pool->free_head = slot;
+    return true;
+}
+
+Sprite *spawn(SpritePool *pool, double x, double y)
+{
+    Sprite *sprite = pool_alloc(pool);
+    if (sprite == NULL)
+    {
+        return NULL; // Out of memory, so nothing is spawned
+    }
+
+    sprite->x = x;
+    sprite->y = y;
+    grid_add(sprite);
+    return sprite;
+}
+
+void despawn(SpritePool *pool, Sprite *sprite)
+{
+    if (pool_get(pool, sprite->id) == sprite) // A sprite hit twice in a frame is only removed once
+    {
+        grid_remove(sprite);
+        pool_free(pool, sprite->id);
+    }
+}
+
+void despawn_all(SpritePool *pool)
+{
+    while (pool->number_live > 0)
+    {
+        despawn(pool, pool_live(pool, pool->number_live - 1));
+    }
+}
+/// SPRITE POOL FUNCTIONS ///
+
+/// ENTITY GRID FUNCTIONS ///
+
+int sprite_cell(Sprite *sprite)
+{
+    int x = round(sprite->x);
+    int y = round(sprite->y);
+
+    // Sprites off the screen are listed under the nearest edge cell
+    x = x < 0 ? 0 : x >= width ? width - 1 : x;
+    y = y < 0 ? 0 : y >= height ? height - 1 : y;
+    return y * width + x;
+}
+
+void grid_add(Sprite *sprite)
+{
+    sprite->cell = sprite_cell(sprite);
+    sprite->prev_in_cell = NULL;
+    sprite->next_in_cell = entity_grid[sprite->cell];
+    if (sprite->next_in_cell != NULL)
+    {
+        sprite->next_in_cell->prev_in_cell = sprite;
+    }
+    entity_grid[sprite->cell] = sprite;
+    free_cell_remove(sprite->cell);
+}
+
+void grid_remove(Sprite *sprite)
+{
+    if (sprite->cell < 0)
+    {
+        return;
+    }
+
+    if (sprite->prev_in_cell != NULL)
+    {
+        sprite->prev_in_cell->next_in_cell = sprite->next_in_cell;
+    }
+    else
+    {
+        entity_grid[sprite->cell] = sprite->next_in_cell;
+    }
+
+    if (sprite->next_in_cell != NULL)
+    {
+        sprite->next_in_cell->prev_in_cell = sprite->prev_in_cell;
+    }
+
+    if (entity_grid[sprite->cell] == NULL && open_cells[sprite->cell])
+    {
+        free_cell_add(sprite->cell);
+    }
+    sprite->cell = -1;
+}
+
+void grid_move(Sprite *sprite)
+{
+    if (sprite->cell != sprite_cell(sprite))
+    {
+        grid_remove(sprite);
+        grid_add(sprite);
+    }
+}
+
+Sprite *grid_first(Sprite *sprite)
+{
+    return entity_grid[sprite_cell(sprite)];
+}
+/// ENTITY GRID FUNCTIONS ///
+
+/// FREE CELL FUNCTIONS ///
+
+void free_cell_add(int cell)
+{
+    if (free_position[cell] < 0)
+    {
+        free_position[cell] = number_of_free_cells;
+        free_cells[number_of_free_cells++] = cell;
+    }
+}
+
+void free_cell_remove(int cell)
+{
+    int i = free_position[cell];
+    if (i >= 0)
+    {
+        // Move the last free cell into the gap
+        int last = free_cells[--number_of_free_cells];
+        free_cells[i] = last;
+        free_position[last] = i;
+        free_position[cell] = -1;
+    }
+}
+
+void find_free_cells()
+{
+    number_of_free_cells = 0;
+    for (int cell = 0; cell < width * height; cell++)
+    {
+        free_position[cell] = -1;
+        if (open_cells[cell] && entity_grid[cell] == NULL)
+        {
+            free_cell_add(cell);
+        }
+    }
+}
+
+bool set_aside(int cell, int n)
+{
+    int i = free_position[cell];
+    if (i < 0 || i >= n)
+    {
+        return false;
+    }
+
+    int last = free_cells[n - 1];
+    free_cells[i] = last;
+    free_position[last] = i;
+    free_cells[n - 1] = cell;
+    free_position[cell] = n - 1;
+    return true;
+}
+
+int random_free_cell()
+{
+    // Jerry and tom move every frame, so rather than leaving the set they are swapped to its end and not drawn
+    int n = number_of_free_cells;
+    n -= set_aside(sprite_cell(jerry), n);
+    n -= set_aside(sprite_cell(tom), n);
+
+    if (n == 0)
+    {
+        return -1;
+    }
+    return free_cells[rand() % n];
+}
+
+int spawn_cell(const char *what)
+{
+    int cell = random_free_cell();
+    if (cell < 0)
+    {
+        snprintf(spawn_message, sizeof(spawn_message), "No free cell for %s", what);
+        number_of_full_spawns++;
+    }
+    else
+    {
+        spawn_message[0] = '\0';
+    }
+    return cell;
+}
+/// FREE CELL FUNCTIONS ///
+
+/// FLOW FIELD FUNCTIONS ///
+
+void init_flow_field(FlowField *field)
+{
+    field->target = -1;
+    field->distance = malloc(width * height * sizeof(int));
+    field->next = malloc(width * height * sizeof(int));
+}
+
+void find_open_cells()
+{
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            open_cells[y * width + x] = y > 3 && get_tag(x, y) != ZDK_TAG_WALL; // Below the display screen box
+        }
+    }
+
+    // The walls have changed, so every field must be searched again
+    to_jerry.target = -1;
+    to_tom.target = -1;
+}
+
+void compute_flow(FlowField *field, int target)
+{
+    static const int steps[8][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+
+    field->target = target;
+    memset(field->distance, -1, width * height * sizeof(int));
+
+    int head = 0, tail = 0;
+    field->distance[target] = 0;
+    field->next[target] = target;
+    flow_queue[tail++] = target;
+
+    while (head < tail)
+    {
+        int cell = flow_queue[head++];
+        int x = cell % width;
+        int y = cell / width;
+
+        for (int i = 0; i < 8; i++)
+        {
+            int nx = x + steps[i][0];
+            int ny = y + steps[i][1];
+            if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+            {
+                continue;
+            }
+
+            int neighbour = ny * width + nx;
+            if (!open_cells[neighbour] || field->distance[neighbour] >= 0)
+            {
+                continue;
+            }
+
+            // Diagonal steps may not cut the corner of a wall
+            if (!open_cells[y * width + nx] || !open_cells[ny * width + x])
+            {
+                continue;
+            }
+
+            field->distance[neighbour] = field->distance[cell] + 1;
+            field->next[neighbour] = cell;
+            flow_queue[tail++] = neighbour;
+        }
+    }
+}
+
+FlowField *flow_towards(FlowField *field, Sprite *target)
+{
+    int cell = sprite_cell(target);
+    if (field->target != cell)
+    {
+        compute_flow(field, cell);
+    }
+    return field;
+}
+
+void steer_to_cell(Sprite *sprite, int cell, double speed)
+{
+    double t1 = cell % width - sprite->x;
+    double t2 = cell / width - sprite->y;
+    double d = sqrt(t1 * t1 + t2 * t2);
+
+    if (d > 0) // Already there, so keep going the same way
+    {
+        sprite->dx = t1 * speed / d;
+        sprite->dy = t2 * speed / d;
+    }
+}
+
+bool steer(Sprite *sprite, FlowField *field, Sprite *target, double speed)
+{
+    int cell = sprite_cell(sprite);
+    if (cell != field->target)
+    {
+        if (field->distance[cell] < 0)
+        {
+            return false; // No way through the walls
+        }
+        steer_to_cell(sprite, field->next[cell], speed);
+        return true;
+    }
+
+    // In the target's cell, so head straight for it
+    double t1 = target->x - sprite->x;
+    double t2 = target->y - sprite->y;
+    double d = sqrt(t1 * t1 + t2 * t2);
+
+    if (d > 0)
+    {
+        sprite->dx = t1 * speed / d;
+        sprite->dy = t2 * speed / d;
+    }
+    return true;
+}
+/// FLOW FIELD FUNCTIONS ///
 
 /// COLLISION FUNCTIONS ///
 
 bool has_collided(Sprite *s1, Sprite *s2)
 {
-    return s1->x == s2->x && s1->y == s2->y;
+    // Sprites collide when they are drawn in the same cell
+    return round(s1->x) == round(s2->x) && round(s1->y) == round(s2->y);
 }
 
 Collision get_current_wall_collision(Sprite *player)
@@ -112,22 +668,22 @@ Collision get_current_wall_collision(Sprite *player)
     int x = round(player->x);
     int y = round(player->y);
 
-    if (x < 1 || scrape_char(x - 1, y) == '*')
+    if (x < 1 || get_tag(x - 1, y) == ZDK_TAG_WALL)
     {
         return WALL_LEFT;
     }
 
-    if (x >= width - 1 || scrape_char(x + 1, y) == '*')
+    if (x >= width - 1 || get_tag(x + 1, y) == ZDK_TAG_WALL)
     {
         return WALL_RIGHT;
     }
 
-    if (y <= 4 || scrape_char(x, y - 1) == '*')
+    if (y <= 4 || get_tag(x, y - 1) == ZDK_TAG_WALL)
     {
         return WALL_UP;
     }
 
-    if (y >= height - 1 || scrape_char(x, y + 1) == '*')
+    if (y >= height - 1 || get_tag(x, y + 1) == ZDK_TAG_WALL)
     {
         return WALL_DOWN;
     }
@@ -139,7 +695,7 @@ void door_collision()
     if (collected_cheese >= 5)
     {
         door.draw = true;
-        if (has_collided(jerry, &door))
+        if (door.cell == sprite_cell(jerry))
         {
             next_level();
         }
@@ -148,13 +704,13 @@ void door_collision()
 
 void cheese_collision()
 {
-    for (size_t i = 0; i < MAX_CHEESE; i++)
+    Sprite *next;
+    for (Sprite *sprite = grid_first(jerry); sprite != NULL; sprite = next)
     {
-        if (has_collided(jerry, &cheese[i]))
+        next = sprite->next_in_cell;
+        if (sprite->image == cheese_image)
         {
-            cheese[i].draw = false;
-            cheese[i].x = -1;
-            cheese[i].y = -1;
+            despawn(&cheese, sprite);
             score++;
             collected_cheese++;
             number_of_cheese--;
@@ -164,14 +720,13 @@ void cheese_collision()
 
 void traps_collision()
 {
-
-    for (size_t i = 0; i < MAX_TRAPS; i++)
+    Sprite *next;
+    for (Sprite *sprite = grid_first(jerry); sprite != NULL; sprite = next)
     {
-        if (has_collided(jerry, &traps[i]))
+        next = sprite->next_in_cell;
+        if (sprite->image == traps_image)
         {
-            traps[i].draw = false;
-            traps[i].x = -1;
-            traps[i].y = -1;
+            despawn(&traps, sprite);
             lives--;
         }
     }
@@ -186,225 +741,178 @@ void caught_collision()
     }
 }
 
+void find_firework_cells()
+{
+    if (firework_cells_capacity < fireworks.capacity
+        && resize_array((void **)&firework_cells, fireworks.capacity * sizeof(int))
+        && resize_array((void **)&firework_keep, fireworks.capacity * sizeof(bool)))
+    {
+        firework_cells_capacity = fireworks.capacity;
+    }
+
+    if (fireworks.count > firework_cells_capacity)
+    {
+        // No memory to check them all, so the newest fireworks burn out
+        number_of_fireworks -= fireworks.count - firework_cells_capacity;
+        fireworks.count = firework_cells_capacity;
+    }
+    particles_cells(&fireworks, width, height, firework_cells);
+}
+
 void firework_collision()
 {
-    Collision collision;
-    for (size_t i = 0; i < MAX_FIREWORKS; i++)
+    find_firework_cells();
+
+    // Fireworks that reach tom send him back to his starting position
+    int tom_cell = sprite_cell(tom);
+    bool hit_tom = false;
+    for (int i = 0; i < fireworks.count; i++)
     {
-        if (fireworks[i].draw)
-        {
-            collision = get_current_wall_collision(&fireworks[i]);
-            if (collision != NO_COLLISION)
-            {
-                fireworks[i].draw = false;
-                fireworks[i].x = 5;
-                fireworks[i].y = 5;
-                fireworks[i].dx = 0;
-                fireworks[i].dy = 0;
-                number_of_fireworks--;
-            }
+        firework_keep[i] = firework_cells[i] != tom_cell;
+        hit_tom |= !firework_keep[i];
+    }
 
-            if (has_collided(&fireworks[i], tom))
-            {
-                tom->x = (int)levels[current_level][0][1] - 1;
-                tom->y = (int)levels[current_level][1][1] - 1;
+    if (hit_tom)
+    {
+        tom->x = (int)levels[current_level].tom_x - 1;
+        tom->y = (int)levels[current_level].tom_y - 1;
+    }
 
-                fireworks[i].draw = false;
-                fireworks[i].dx = 0;
-                fireworks[i].dy = 0;
-            }
+    // Fireworks that fly into a wall, or have no way around the walls to tom, burn out
+    FlowField *field = flow_towards(&to_tom, tom);
+    for (int i = 0; i < fireworks.count; i++)
+    {
+        int cell = firework_cells[i];
+        if (firework_keep[i] && (cell < 0 || !open_cells[cell] || field->distance[cell] < 0))
+        {
+            firework_keep[i] = false;
+            number_of_fireworks--;
         }
     }
+
+    particles_compact(&fireworks, firework_keep);
 }
 
 void firework_seek()
 {
-    int d, t1, t2;
-    if (number_of_fireworks > 0)
+    // Aim every firework at the next step of the shortest path to tom, then move them all at once
+    FlowField *field = flow_towards(&to_tom, tom);
+    find_firework_cells();
+    for (int i = 0; i < fireworks.count; i++)
     {
-        for (size_t i = 0; i < MAX_FIREWORKS; i++)
+        int cell = firework_cells[i];
+        if (cell == field->target)
+        {
+            fireworks.aim_x[i] = tom->x;
+            fireworks.aim_y[i] = tom->y;
+        }
+        else if (cell >= 0 && field->distance[cell] > 0)
         {
-            t1 = tom->x - fireworks[i].x;
-            t2 = tom->y - fireworks[i].y;
-            d = sqrt(t1 * t1 + t2 * t2);
-            fireworks[i].dx = t1 * 0.5 / d;
-            fireworks[i].dy = t2 * 0.5 / d;
-            fireworks[i].x += fireworks[i].dx;
-            fireworks[i].y += fireworks[i].dy;
+            fireworks.aim_x[i] = field->next[cell] % width;
+            fireworks.aim_y[i] = field->next[cell] / width;
         }
     }
+    particles_advance(&fireworks, 0.5);
 }
 
 void chase()
 {
-    int d, t1, t2;
-    t1 = jerry->x - tom->x;
-    t2 = jerry->y - tom->y;
-    d = sqrt(t1 * t1 + t2 * t2);
+    // Tom chases jerry around the walls once jerry is within 10 steps
+    FlowField *field = flow_towards(&to_jerry, jerry);
+    int d = field->distance[sprite_cell(tom)];
 
-    if (d <= 10)
+    if (d >= 0 && d <= 10)
     {
-        tom->dx = t1 * 0.05 / d;
-        tom->dy = t2 * 0.05 / d;
+        steer(tom, field, jerry, 0.05);
     }
 }
 
 void evade()
 {
-    int d, t1, t2;
-    t1 = tom->x - jerry->x;
-    t2 = tom->y - jerry->y;
-    d = sqrt(t1 * t1 + t2 * t2);
+    // Jerry runs to the neighbouring cell furthest from tom once tom is within 10 steps
+    FlowField *field = flow_towards(&to_tom, tom);
+    int cell = sprite_cell(jerry);
+    int d = field->distance[cell];
 
-    if (d <= 10)
+    if (d >= 0 && d <= 10)
     {
-        jerry->dx = -t1 * 0.1 / d;
-        jerry->dy = -t2 * 0.1 / d;
+        int x = cell % width;
+        int y = cell / width;
+        int furthest = cell;
+
+        for (int ny = y - 1; ny <= y + 1; ny++)
+        {
+            for (int nx = x - 1; nx <= x + 1; nx++)
+            {
+                if (nx >= 0 && nx < width && ny >= 0 && ny < height && field->distance[ny * width + nx] > field->distance[furthest])
+                {
+                    furthest = ny * width + nx;
+                }
+            }
+        }
+
+        steer_to_cell(jerry, furthest, 0.1);
     }
 }
 
 /// COLLISION FUNCTIONS ///
 
 /// SPAWN FUNCTIONS ///
-void spawn_cheese()
+void spawn_cheese(void *context) // Called by game_events every 2 seconds
 {
-    srand(time(NULL));
-    int x, y;
-    double fractpart, intpart;
-    fractpart = modf(current_time_diff, &intpart);
     if (number_of_cheese <= 5)
     {
-        if (time_seconds % 2 == 0 && time_seconds != 0 && fractpart <= 0.01) // If it is at a 2 second interval
+        int cell = spawn_cell("cheese");
+        if (cell >= 0 && spawn(&cheese, cell % width, cell / width) != NULL)
         {
-            for (size_t i = 0; i < MAX_CHEESE; i++)
-            {
-                // Fith one isnt drawing because it isnt being reached
-                if (cheese[i].draw == false)
-                {
-                    x = rand() % width + 1;
-                    y = rand() % height + 4;
-
-                    while (!(scrape_char(x, y) == ' '))
-                    {
-                        x = rand() % width + 1;
-                        y = rand() % height + 4;
-                    }
-                    cheese[i].x = x;
-                    cheese[i].y = y;
-                    cheese[i].draw = true;
-                    number_of_cheese++;
-                }
-                else
-                {
-                    continue;
-                }
-                break;
-            }
+            number_of_cheese++;
         }
     }
 }
 
 void place_cheese()
 {
-    for (size_t i = 0; i < MAX_CHEESE; i++)
+    if (cheese.number_live < CHEESE_LIMIT && spawn(&cheese, round(tom->x), round(tom->y)) != NULL)
     {
-        if (cheese[i].draw == false)
-        {
-            cheese[i].x = round(tom->x);
-            cheese[i].y = round(tom->y);
-            cheese[i].draw = true;
-            number_of_cheese++;
-        }
-        else
-        {
-            continue;
-        }
-        break;
+        number_of_cheese++;
     }
 }
 
-void spawn_moustraps()
+void spawn_moustraps(void *context) // Called by game_events every 3 seconds
 {
-    double fractpart, intpart;
-    fractpart = modf(current_time_diff, &intpart);
-    if (number_of_mousetraps <= 5)
+    if (number_of_mousetraps <= 5 && traps.number_live < TRAP_LIMIT && spawn(&traps, round(tom->x), round(tom->y)) != NULL)
     {
-        if (time_seconds % 3 == 0 && time_seconds != 0 && fractpart <= 0.01) // If it is at a 3 second interval
-        {
-            for (size_t i = 0; i < MAX_TRAPS; i++)
-            {
-                // Fith one isnt drawing because it isnt being reached
-                if (traps[i].draw == false)
-                {
-                    traps[i].x = round(tom->x);
-                    traps[i].y = round(tom->y);
-                    traps[i].draw = true;
-                    number_of_mousetraps++;
-                }
-                else
-                {
-                    continue;
-                }
-                break;
-            }
-        }
+        number_of_mousetraps++;
     }
 }
 
 void place_trap()
 {
-    for (size_t i = 0; i < MAX_TRAPS; i++)
+    if (traps.number_live < TRAP_LIMIT && spawn(&traps, round(tom->x), round(tom->y)) != NULL)
     {
-        if (traps[i].draw == false)
-        {
-            traps[i].x = round(tom->x);
-            traps[i].y = round(tom->y);
-            traps[i].draw = true;
-            number_of_mousetraps++;
-        }
-        else
-        {
-            continue;
-        }
-        break;
+        number_of_mousetraps++;
     }
 }
 
 void spawn_firework()
 {
-    for (size_t i = 0; i < MAX_FIREWORKS; i++)
+    if (particles_add(&fireworks, jerry->x, jerry->y) >= 0)
     {
-        // Fith one isnt drawing because it isnt being reached
-        if (fireworks[i].draw == false)
-        {
-            fireworks[i].x = jerry->x;
-            fireworks[i].y = jerry->y;
-            fireworks[i].draw = true;
-            number_of_fireworks++;
-        }
-        else
-        {
-            continue;
-        }
-        break;
+        number_of_fireworks++;
     }
 }
 
 void spawn_door()
 {
-    srand(time(NULL));
-    int x, y;
-    x = rand() % width + 1;
-    y = rand() % height + 4;
-
-    while (!(scrape_char(x, y) == ' '))
+    int cell = spawn_cell("door");
+    if (cell < 0)
     {
-        x = rand() % width + 1;
-        y = rand() % height + 4;
+        return; // The door stays where it was
     }
 
-    door.x = x;
-    door.y = y;
+    door.x = cell % width;
+    door.y = cell / width;
+    grid_move(&door);
 }
 /// SPAWN FUNCTIONS ///
 
@@ -413,54 +921,75 @@ void draw_sprite(Sprite *sprite)
 {
     if (sprite->draw)
     {
-        draw_char(sprite->x, sprite->y, sprite->image);
+        set_draw_tag(ZDK_TAG_ENTITY);
+        draw_char(round(sprite->x), round(sprite->y), sprite->image); // The cell it collides in
+        set_draw_tag(ZDK_TAG_FREE);
     }
 }
 
 void draw_cheese()
 {
-    for (size_t i = 0; i < MAX_CHEESE; i++)
+    for (int i = 0; i < cheese.number_live; i++)
     {
-        draw_sprite(&cheese[i]);
+        draw_sprite(pool_live(&cheese, i));
     }
 }
 
 void draw_traps()
 {
-    for (size_t i = 0; i < MAX_TRAPS; i++)
+    for (int i = 0; i < traps.number_live; i++)
     {
-        draw_sprite(&traps[i]);
+        draw_sprite(pool_live(&traps, i));
     }
 }
 
 void draw_fireworks()
 {
-    for (size_t i = 0; i < MAX_FIREWORKS; i++)
+    set_draw_tag(ZDK_TAG_ENTITY);
+    for (int i = 0; i < fireworks.count; i++)
     {
-        draw_sprite(&fireworks[i]);
+        draw_char(round(fireworks.x[i]), round(fireworks.y[i]), fireworks_image);
     }
+    set_draw_tag(ZDK_TAG_FREE);
 }
 
 void draw_walls()
 {
-    int number_of_walls = (sizeof(levels[current_level][0]) / sizeof(int)) - 2;
-    for (size_t i = 2; i <= number_of_walls; i += 2)
+    Level *level = &levels[current_level];
+    set_draw_tag(ZDK_TAG_WALL);
+    for (int i = 0; i < level->number_of_walls; i++)
     {
-        draw_line(levels[current_level][0][i], levels[current_level][1][i], levels[current_level][0][i + 1], levels[current_level][1][i + 1], '*');
+        Wall *wall = &level->walls[i];
+        draw_line(wall->x1, wall->y1, wall->x2, wall->y2, '*');
     }
+    set_draw_tag(ZDK_TAG_FREE);
+}
+
+void draw_level_background()
+{
+    destroy_background(wall_background);
+    clear_screen();
+    draw_walls();
+    wall_background = save_background();
 }
 /// DRAW FUNCTIONS ///
 
 void next_level()
 {
+    if (current_level > number_of_levels)
+    {
+        return; // Already past the last level, so the game over screen is showing
+    }
 
     current_level++;
+    load_level(current_level);              // Normally already read by the prefetch thread
+    prefetch_level_room(current_level + 1); // Read the level after it while this one is played
 
-    jerry->x = (int)levels[current_level][0][0];
-    jerry->y = (int)levels[current_level][1][0];
+    jerry->x = (int)levels[current_level].jerry_x;
+    jerry->y = (int)levels[current_level].jerry_y;
 
-    tom->x = (int)levels[current_level][0][1] - 1;
-    tom->y = (int)levels[current_level][1][1] - 1;
+    tom->x = (int)levels[current_level].tom_x - 1;
+    tom->y = (int)levels[current_level].tom_y - 1;
 
     door.draw = false;
     number_of_cheese = 0;
@@ -468,18 +997,15 @@ void next_level()
     number_of_mousetraps = 0;
     collected_cheese = 0;
 
-    for (size_t i = 0; i < MAX_CHEESE; i++)
-    {
-        cheese[i].draw = false;
-    }
+    despawn_all(&cheese);
+    despawn_all(&traps);
 
-    for (size_t i = 0; i < MAX_TRAPS; i++)
-    {
-        traps[i].draw = false;
-    }
+    // Redraw with the new walls, so spawns avoid them
+    draw_level_background();
+    display_screen();
+    find_open_cells(); // Pursuit finds its way around the new walls
+    find_free_cells(); // Spawns avoid the new walls
 
-    spawn_cheese();
-    spawn_moustraps();
     spawn_door();
 }
 
@@ -502,7 +1028,6 @@ void switch_player()
 
 void player_randomly_turn(int from, int to)
 {
-    srand(time(NULL));
 
     Sprite *player = *active_seeker;
     double radians;
@@ -593,19 +1118,43 @@ void game_input(char code)
 /// Core functions ///
 void display_screen()
 {
-    // Draw the display screen box
+    // Draw the display screen box (the labels inside it are retained by the ZDK)
     draw_line(0, 3, width, 3, '~');
+}
+
+void create_labels()
+{
+    ZdkLabel *label;
+
+    create_label(0.05 * width, 0, "Student #: n10133810");
+
+    label = create_label(0.2 * width, 0, "Score: %d");
+    bind_label_int(label, &score);
+
+    label = create_label(0.3 * width, 0, "Lives: %d");
+    bind_label_int(label, &lives);
+
+    label = create_label(0.4 * width, 0, "Active Sprite: %c");
+    bind_label_char(label, &current_player);
+
+    label = create_label(0.5 * width, 0, "Time: %02d:%02d");
+    bind_label_int(label, &time_minutes);
+    bind_label_int(label, &time_seconds);
+
+    label = create_label(0.05 * width, 2, "Cheese: %d");
+    bind_label_int(label, &number_of_cheese);
 
-    draw_formatted(0.05 * width, 0, "Student #: n10133810");
-    draw_formatted(0.2 * width, 0, "Score: %d", score);
-    draw_formatted(0.3 * width, 0, "Lives: %d", lives);
-    draw_formatted(0.4 * width, 0, "Active Sprite: %c", current_player);
-    draw_formatted(0.5 * width, 0, "Time: %02d:%02d", time_minutes, time_seconds);
+    label = create_label(0.2 * width, 2, "Traps: %d");
+    bind_label_int(label, &number_of_mousetraps);
 
-    draw_formatted(0.05 * width, 2, "Cheese: %d", number_of_cheese);
-    draw_formatted(0.2 * width, 2, "Traps: %d", number_of_mousetraps);
-    draw_formatted(0.3 * width, 2, "Fireworks: %d", number_of_fireworks);
-    draw_formatted(0.4 * width, 2, "Level: %d", current_level);
+    label = create_label(0.3 * width, 2, "Fireworks: %d");
+    bind_label_int(label, &number_of_fireworks);
+
+    label = create_label(0.4 * width, 2, "Level: %d");
+    bind_label_int(label, &current_level);
+
+    label = create_label(0.5 * width, 2, "%s");
+    bind_label_string(label, spawn_message);
 }
 
 void gameover_screen()
@@ -618,10 +1167,13 @@ void gameover_screen()
 
         show_screen();
 
-        char input = wait_char();
+        char input = soak_steps > 0 ? 'r' : wait_char(); // The soak player restarts at once
+
+        pacer_resume(frame_pacer); // Waiting for input is not a late frame
 
         if (input == 'r')
         {
+            soak_restarts += soak_steps > 0;
             reset_game();
         }
         else if (input == 'q')
@@ -636,40 +1188,27 @@ void init_sprites()
     jerry = malloc(sizeof(Sprite));
     tom = malloc(sizeof(Sprite));
 
-    jerry->x = (int)levels[current_level][0][0];
-    jerry->y = (int)levels[current_level][1][0];
+    jerry->x = (int)levels[current_level].jerry_x;
+    jerry->y = (int)levels[current_level].jerry_y;
     jerry->dx = 0.1;
     jerry->dy = 0.1;
     jerry->image = jerry_image;
     jerry->draw = true;
 
-    tom->x = (int)levels[current_level][0][1];
-    tom->y = (int)levels[current_level][1][1];
+    tom->x = (int)levels[current_level].tom_x;
+    tom->y = (int)levels[current_level].tom_y;
     tom->dx = -0.1;
     tom->dy = -0.1;
     tom->image = tom_image;
     tom->draw = true;
 
-    for (size_t i = 0; i < MAX_CHEESE; i++)
-    {
-        cheese[i].image = cheese_image;
-        cheese[i].draw = false;
-    }
-
-    for (size_t i = 0; i < MAX_TRAPS; i++)
-    {
-        traps[i].image = traps_image;
-        traps[i].draw = false;
-    }
-
-    for (size_t i = 0; i < MAX_FIREWORKS; i++)
-    {
-        fireworks[i].image = fireworks_image;
-        fireworks[i].draw = false;
-    }
+    pool_init(&cheese, cheese_image);
+    pool_init(&traps, traps_image);
+    particles_init(&fireworks, POOL_BLOCK);
 
     door.image = door_image;
     door.draw = false;
+    door.cell = -1;
 }
 
 void reset_game()
@@ -685,98 +1224,217 @@ void reset_game()
 
 void reset_level()
 {
-    jerry->x = (int)levels[current_level][0][0];
-    jerry->y = (int)levels[current_level][1][0];
+    jerry->x = (int)levels[current_level].jerry_x;
+    jerry->y = (int)levels[current_level].jerry_y;
 
-    tom->x = (int)levels[current_level][0][1] - 1;
-    tom->y = (int)levels[current_level][1][1] - 1;
+    tom->x = (int)levels[current_level].tom_x - 1;
+    tom->y = (int)levels[current_level].tom_y - 1;
 }
 
 void update_time()
 {
-    current_time = get_current_time();
-    current_time_diff = current_time - timer->reset_time;
+    int elapsed = (int)(scheduler_time(game_events) / NS_PER_SECOND);
 
-    time_seconds = (int)current_time_diff % 60;
-    time_minutes = (int)current_time_diff / 60;
+    time_seconds = elapsed % 60;
+    time_minutes = elapsed / 60;
 }
 
 void pause_game()
 {
-    if (pause == false)
+    pause = !pause;
+
+    // Stopping the clock holds back the game time and every pending spawn
+    if (pause)
     {
-        pause = true;
-        saved_time_diff = current_time_diff;
+        scheduler_pause(game_events);
     }
     else
     {
-        pause = false;
-        timer->reset_time = get_current_time() - saved_time_diff;
+        scheduler_resume(game_events);
+        pacer_resume(frame_pacer); // The pause is not a late frame
     }
 }
 
-void parse_instructions(int level, FILE *stream)
+void add_level(const char *file, ZdkLevelPack *pack, int pack_room)
 {
-    int i = 2;
-    while (!feof(stream))
+    // Keep room for the new level and an empty one after it
+    if (number_of_levels + 3 > level_capacity)
     {
-        //  Declare a variable called command of type char.
-        char command;
-
-        //  Declare four variables of type int.
-        float a, b, c, d;
-        //  Use a single call to fscanf to (attempt to) read a char and four int
-        //  values into command, and your integer variables. Capture the value
-        //  returned by fscanf for later use.
-        int captured = fscanf(stream, "%c %f %f %f %f", &command, &a, &b, &c, &d);
-
-        if (captured == 3)
+        int capacity = level_capacity * 2;
+        if (!resize_array((void **)&levels, capacity * sizeof(Level)))
         {
-            a = round(a * width);
-            b = round(b * height);
-            if (command == 'J')
-            {
-                levels[level][0][0] = (int)a;
-                levels[level][1][0] = (int)b + 4.0;
-            }
-            else if (command == 'T')
-            {
-                levels[level][0][1] = (int)a - 1;
-                levels[level][1][1] = (int)b - 1;
-            }
+            printf("Out of memory for level %d\n", number_of_levels + 1); // Play the levels read so far
+            return;
         }
-        else if (captured == 5)
+        memset(&levels[level_capacity], 0, (capacity - level_capacity) * sizeof(Level));
+        level_capacity = capacity;
+    }
+
+    Level *level = &levels[++number_of_levels];
+    level->file = file;
+    level->pack = pack;
+    level->pack_room = pack_room;
+}
+
+void scale_room(Level *level, const Room *room)
+{
+    if (room->has_jerry)
+    {
+        level->jerry_x = (int)round(room->jerry_x * width);
+        level->jerry_y = (int)round(room->jerry_y * height) + 4;
+    }
+
+    if (room->has_tom)
+    {
+        level->tom_x = (int)round(room->tom_x * width) - 1;
+        level->tom_y = (int)round(room->tom_y * height) - 1;
+    }
+
+    level->number_of_walls = room->number_of_walls;
+    level->walls = malloc(room->number_of_walls * sizeof(Wall));
+    for (int i = 0; i < room->number_of_walls; i++)
+    {
+        const RoomWall *wall = &room->walls[i];
+        level->walls[i].x1 = (int)round(wall->x1 * width);
+        level->walls[i].y1 = (int)round(wall->y1 * height) + 4;
+        level->walls[i].x2 = (int)round(wall->x2 * width);
+        level->walls[i].y2 = (int)round(wall->y2 * height) + 4;
+    }
+}
+
+void read_level(Level *level)
+{
+    Room room;
+
+    if (level->pack != NULL)
+    {
+        // The room is read in place from the mapped pack
+        levelpack_room(level->pack, level->pack_room, &room);
+        scale_room(level, &room);
+        return;
+    }
+
+    if (level->file == NULL)
+    {
+        return; // The empty levels before the first and after the last
+    }
+
+    size_t length;
+    const char *text = map_room_file(level->file, &length);
+    if (text == NULL)
+    {
+        printf("Could not open file"); // The level is still played, with no walls
+        return;
+    }
+
+    RoomWall walls[ROOM_WALLS];
+    int number_of_walls = parse_room(text, length, &room, walls, ROOM_WALLS);
+    if (number_of_walls > ROOM_WALLS)
+    {
+        RoomWall *all_walls = malloc(number_of_walls * sizeof(RoomWall));
+        parse_room(text, length, &room, all_walls, number_of_walls);
+        scale_room(level, &room);
+        free(all_walls);
+    }
+    else
+    {
+        scale_room(level, &room);
+    }
+    unmap_room_file(text, length);
+}
+
+void claim_level(Level *level)
+{
+    if (level->state == LEVEL_UNLOADED)
+    {
+        // Read without the lock, so the other thread is only held up if it wants this level
+        level->state = LEVEL_LOADING;
+        pthread_mutex_unlock(&level_lock);
+        read_level(level);
+        pthread_mutex_lock(&level_lock);
+        level->state = LEVEL_LOADED;
+        pthread_cond_broadcast(&level_loaded);
+    }
+}
+
+void load_level(int level)
+{
+    pthread_mutex_lock(&level_lock);
+    claim_level(&levels[level]);
+    while (levels[level].state != LEVEL_LOADED)
+    {
+        pthread_cond_wait(&level_loaded, &level_lock); // The prefetch thread is part way through it
+    }
+    pthread_mutex_unlock(&level_lock);
+}
+
+void prefetch_level_room(int level)
+{
+    if (prefetching && level <= number_of_levels)
+    {
+        pthread_mutex_lock(&level_lock);
+        prefetch_level = level;
+        pthread_cond_signal(&prefetch_wanted);
+        pthread_mutex_unlock(&level_lock);
+    }
+}
+
+void *prefetch_rooms(void *context)
+{
+    pthread_mutex_lock(&level_lock);
+    for (;;)
+    {
+        while (prefetch_level == 0)
         {
-            if (command == 'W')
-            {
-                a = round(a * width);
-                b = round(b * height);
-                c = round(c * width);
-                d = round(d * height);
-
-                levels[level][0][i] = (int)a;
-                levels[level][1][i] = (int)b + 4.0;
-                i++;
-                levels[level][0][i] = (int)c;
-                levels[level][1][i] = (int)d + 4.0;
-                i++;
-            }
+            pthread_cond_wait(&prefetch_wanted, &level_lock);
         }
+
+        Level *level = &levels[prefetch_level];
+        prefetch_level = 0;
+        claim_level(level);
     }
+    return NULL;
 }
 
-void read_files(int level, char *file)
+void start_prefetch()
 {
-    FILE *stream = fopen(file, "r");
-    if (stream != NULL)
+    pthread_t thread;
+
+    // Keep signals such as Ctrl-C on the main thread, as the ZDK recorder does
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    prefetching = pthread_create(&thread, NULL, prefetch_rooms, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (prefetching)
     {
-        parse_instructions(level, stream);
-        fclose(stream);
+        pthread_detach(thread);
     }
-    else
+}
+
+void read_files(char *file)
+{
+    size_t length = strlen(file);
+
+    if (length > 5 && strcmp(file + length - 5, ".pack") == 0)
     {
-        printf("Could not open file");
+        // Opening a pack checks it, so a bad pack is reported at startup
+        ZdkLevelPack *pack = levelpack_open(file);
+        if (pack == NULL)
+        {
+            printf("Could not open level pack %s\n", file);
+            return;
+        }
+
+        for (int i = 0; i < levelpack_rooms(pack); i++)
+        {
+            add_level(NULL, pack, i);
+        }
+        return;
     }
+
+    add_level(file, NULL, 0);
 }
 /// Core functions ///
 
@@ -790,17 +1448,38 @@ void setup(int argc, char *argv[])
     score = 0;
     active_player = &jerry;
     active_seeker = &tom;
-    number_of_levels = argc - 1;
+    number_of_levels = 0;
 
-    // Initalize the timer
-    timer = create_timer(1);
+    // Start the game clock and the timed spawns
+    game_events = create_scheduler();
+    schedule_every(game_events, 2000, spawn_cheese, NULL);
+    schedule_every(game_events, 3000, spawn_moustraps, NULL);
 
-    // Read all of the instructions from the room files
+    // List the levels of the room files and level packs; each is read when it is first played
+    level_capacity = 2;
+    levels = calloc(level_capacity, sizeof(Level));
     for (size_t i = 1; i < argc; i++)
     {
-        read_files(i, argv[i]); // Read the room instructions
+        read_files(argv[i]); // Add the levels of each file
     }
 
+    start_prefetch(); // Read each next level in the background
+
+    create_labels(); // Register the game information labels
+
+    create_profile_scopes(); // Register the profiler scopes
+
+    entity_grid = calloc(width * height, sizeof(Sprite *)); // Every cell starts empty
+
+    open_cells = calloc(width * height, sizeof(bool));
+    flow_queue = malloc(width * height * sizeof(int));
+    init_flow_field(&to_jerry);
+    init_flow_field(&to_tom);
+
+    free_cells = malloc(width * height * sizeof(int));
+    free_position = malloc(width * height * sizeof(int));
+    memset(free_position, -1, width * height * sizeof(int)); // No cell is free until the first level is drawn
+
     init_sprites(); // Initalize the players
 
     next_level(); // Start the first level
@@ -809,44 +1488,71 @@ void setup(int argc, char *argv[])
 }
 void loop()
 {
-    char code = (char)get_char();
+    ZdkKeyEvent key;
 
-    game_input(code); // Check for keyboard input
+    profile_begin(prof_input);
+    int level = current_level;
+    while (next_key_event(&key)) // Handle every key pressed since the last frame
+    {
+        game_input((char)key.key);
 
-    clear_screen(); // Clear the screen
+        // Keys after a change of level or the end of the game are for the next frame
+        if (current_level != level || lives <= 0 || current_level > number_of_levels)
+        {
+            break;
+        }
+    }
+    profile_end(prof_input);
 
+    profile_begin(prof_time);
     if (!pause)
     {
         update_time(); // Update the time_seconds and time_minutes variables
     }
-    // Information based screens (depending on state of game)
-    display_screen(); // Draw the game information
-
-    gameover_screen(); // Draw the game over screen (if game over)
-
-    // Movement based functions
-
-    automatic_movement(); // Move the player that is chasing
+    profile_end(prof_time);
 
-    firework_seek();
+    gameover_screen(); // Draw the game over screen (if game over), which waits for a key
 
-    if (current_player == 'J')
+    profile_begin(prof_walls);
+    if (!clear_screen_to(wall_background)) // Start from the walls, so movement and spawns see them
     {
-        chase(); // If jerry is close to tom, tom starts chasing jerry
+        draw_level_background(); // The screen was resized, so draw the walls again
     }
-    else
+    profile_end(prof_walls);
+
+    profile_begin(prof_hud);
+    // Information based screens (depending on state of game)
+    display_screen(); // Draw the game information
+
+    if (show_profile)
     {
-        evade();
+        draw_profile(1); // Draw the profile between the rows of labels
     }
+    profile_end(prof_hud);
 
-    // Spawning functions
+    // Movement based functions (only on paced frames, so key presses in between do not speed up the game)
 
-    spawn_cheese(); // Spawn the cheese every 2 seconds
+    profile_begin(prof_movement);
+    if (frame_due && !pause)
+    {
+        automatic_movement(); // Move the player that is chasing
 
-    spawn_moustraps(); // Spawn the mousetrap every 3 seconds
+        firework_seek();
+
+        if (current_player == 'J')
+        {
+            chase(); // If jerry is close to tom, tom starts chasing jerry
+        }
+        else
+        {
+            evade();
+        }
+    }
+    profile_end(prof_movement);
 
     // Collision functions
 
+    profile_begin(prof_collisions);
     caught_collision(); // If tom catches jerry, reset_game the level and lose a life
 
     traps_collision(); // If jerry collides with a trap, he loses a life
@@ -856,9 +1562,11 @@ void loop()
     door_collision(); // If jerry touches the X, it moves to the next level
 
     firework_collision();
+    profile_end(prof_collisions);
 
     // Drawing sprites
 
+    profile_begin(prof_drawing);
     draw_sprite(tom); // Draw the Tom Sprite
 
     draw_sprite(jerry); // Draw the jerry player
@@ -870,18 +1578,169 @@ void loop()
     draw_fireworks();
 
     draw_sprite(&door);
+    profile_end(prof_drawing);
+
+    // Timed spawns (after drawing, so spawns avoid this frame's sprites)
+
+    profile_begin(prof_spawning);
+    scheduler_run(game_events); // Spawn cheese every 2 seconds and a mousetrap every 3
+    profile_end(prof_spawning);
+}
+/// Profiler functions ///
+void create_profile_scopes()
+{
+    prof_frame = profile_scope("frame");
+    prof_input = profile_scope("input");
+    prof_time = profile_scope("time");
+    prof_hud = profile_scope("hud");
+    prof_walls = profile_scope("walls");
+    prof_movement = profile_scope("move");
+    prof_collisions = profile_scope("collide");
+    prof_drawing = profile_scope("draw");
+    prof_spawning = profile_scope("spawn");
+    prof_render = profile_scope("render");
+}
+
+void dump_profile()
+{
+    cleanup_screen(); // Leave the terminal readable before printing
+    profile_dump(stderr);
+    if (frame_pacer != NULL)
+    {
+        dump_pacer(stderr, "frame_pacer", frame_pacer); // Overruns and late frames
+    }
+}
+
+/// Soak test functions ///
+char soak_step_towards(Sprite *target)
+{
+    int dx = round(target->x) - round(jerry->x);
+    int dy = round(target->y) - round(jerry->y);
+
+    if (abs(dx) >= abs(dy))
+    {
+        return dx < 0 ? 'a' : 'd';
+    }
+    return dy < 0 ? 'w' : 's';
+}
+
+void soak_player()
+{
+    // Every few frames, press a key as a player might: as jerry, usually a step towards
+    // the open door or some cheese, otherwise a random key so walls do not trap him
+    const char keys[] = "wasdwasdwasdfcmz";
+
+    if (rand() % 4 != 0)
+    {
+        return;
+    }
+
+    if (current_player == 'J' && rand() % 2 == 0)
+    {
+        if (door.draw)
+        {
+            game_input(soak_step_towards(&door));
+            return;
+        }
+        if (cheese.number_live > 0)
+        {
+            game_input(soak_step_towards(pool_live(&cheese, 0)));
+            return;
+        }
+    }
+    game_input(keys[rand() % (sizeof(keys) - 1)]);
+}
+
+void soak_report(int steps, int64_t real_start, int64_t virtual_start)
+{
+    double real = (get_system_ns() - real_start) / 1.0e9;
+    double simulated = (get_current_ns() - virtual_start) / 1.0e9;
 
-    draw_walls(); // Draw the walls for the current level
+    printf("soak: %d steps, %.1f s simulated in %.3f s, seed %u\n", steps, simulated, real, seed);
+    printf("soak: %.0f steps/s, %.0fx real time\n", steps / real, simulated / real);
+    printf("soak: score %d, level %d, restarts %d\n", score, current_level, soak_restarts);
+    printf("soak: %d spawns found no free cell\n", number_of_full_spawns);
 }
+
 int main(int argc, char *argv[])
 {
+    // Options come before the room files:
+    //   --soak N   plays N frames headless, as fast as possible
+    //   --profile  shows where the time goes in each frame
+    //   --seed N   seeds the random numbers, so a soak can be repeated
+    seed = time(NULL);
+    int options = 0;
+    while (options + 1 < argc && strncmp(argv[options + 1], "--", 2) == 0)
+    {
+        options++;
+        if (strcmp(argv[options], "--soak") == 0 && options + 1 < argc)
+        {
+            soak_steps = atoi(argv[++options]);
+            timer_set_virtual(true);
+            zdk_suppress_output = true;
+        }
+        else if (strcmp(argv[options], "--profile") == 0)
+        {
+            show_profile = true;
+            atexit(dump_profile);
+        }
+        else if (strcmp(argv[options], "--seed") == 0 && options + 1 < argc)
+        {
+            seed = strtoul(argv[++options], NULL, 10);
+        }
+    }
+    srand(seed);
+    argv[options] = argv[0];
+    argc -= options;
+    argv += options;
+
     setup_screen();
     setup(argc, argv);
-    while (!game_over)
+    frame_pacer = create_pacer(DELAY * NS_PER_MILLISECOND);
+
+    int64_t real_start = get_system_ns();
+    int64_t virtual_start = get_current_ns();
+    int steps = 0;
+    int start_score = score, start_level = current_level;
+    bool progressed = false; // Set once the soak player changes the score or level, or restarts
+
+    while (!game_over && (soak_steps == 0 || steps < soak_steps))
     {
+        if (soak_steps > 0)
+        {
+            soak_player();
+        }
+
+        profile_begin(prof_frame);
         loop();
+
+        profile_begin(prof_render);
         show_screen();
-        timer_pause(DELAY);
+        profile_end(prof_render);
+        profile_end(prof_frame);
+
+        // Sleep until the next frame is due or a key is pressed, whichever comes first.
+        // While paused nothing moves, so only a key press wakes the game.
+        if (!pause)
+        {
+            pacer_idle(frame_pacer); // Counts an overrun if this frame's work ran past the deadline
+        }
+        wait_key_event(pause ? -1 : frame_pacer->deadline);
+        frame_due = !pause && pacer_poll(frame_pacer);
+        steps++;
+        progressed |= score != start_score || current_level != start_level || soak_restarts > 0;
+    }
+
+    if (soak_steps > 0)
+    {
+        soak_report(steps, real_start, virtual_start);
+        if (!progressed)
+        {
+            // The timings are of a game which did nothing
+            fflush(stdout);
+            fprintf(stderr, "soak: the score, level and restarts never changed (seed %u)\n", seed);
+            return 1;
+        }
     }
     return 0;
 }
\ No newline at end of file